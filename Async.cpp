@@ -19,34 +19,137 @@ __attribute__((visibility("hidden")))
 XHCIAsyncEndpoint* XHCIAsyncEndpoint::withParameters(GenericUSBXHCI* provider, ringStruct* pRing, uint32_t maxPacketSize, uint32_t maxBurst, uint32_t multiple)
 {
 	XHCIAsyncEndpoint* obj;
+	uint32_t numTRBs, numTDs;
 	obj = static_cast<XHCIAsyncEndpoint*>(IOMalloc(sizeof *obj));
 	if (!obj)
 		return 0;
 	bzero(obj, sizeof *obj);
 	obj->provider = provider;
 	obj->pRing = pRing;
+	/*
+	 * Note: Only one TD is laid out at a time, on the workloop,
+	 *   so all endpoints share the controller's segment buffer.
+	 *   GenerateNextPhysicalSegment refetches if another endpoint's
+	 *   command took it over between counting and building.
+	 */
+	if (!provider->_tdSegmentCache.segments) {
+		provider->_tdSegmentCache.segments = static_cast<IODMACommand::Segment64*>(IOMalloc(kAsyncTDSegments * sizeof(IODMACommand::Segment64)));
+		if (!provider->_tdSegmentCache.segments) {
+			IOFree(obj, sizeof *obj);
+			return 0;
+		}
+		provider->_tdSegmentCache.command = 0;
+		provider->_tdSegmentCache.numSegments = 0U;
+		provider->_tdSegmentCache.maxSegments = kAsyncTDSegments;
+	}
 	obj->setParameters(maxPacketSize, maxBurst, multiple);
+	/*
+	 * Note: Preallocate enough TDs to fill the ring with
+	 *   maximum-size TDs, or the retention override if larger.
+	 *   Stream rings may not have pages yet, so assume one.
+	 */
+	numTRBs = pRing->numTRBs ? pRing->numTRBs : static_cast<uint32_t>(PAGE_SIZE / sizeof(TRBStruct));
+	numTDs = (numTRBs - 1U) / (obj->maxTDBytes / PAGE_SIZE + 2U);
+	if (numTDs < provider->_tdPoolRetain)
+		numTDs = provider->_tdPoolRetain;
+	obj->tdPoolBaseSize = kAsyncTDsPerChunk;
+	while (obj->tdPoolBaseSize < numTDs)
+		obj->tdPoolBaseSize *= 2U;
+	if (obj->ResizeTDPool(obj->tdPoolBaseSize) != kIOReturnSuccess) {
+		obj->nuke();
+		return 0;
+	}
 	return obj;
 }
 
-#define kAsyncMaxFragmentSize (1U << 17)
-
 __attribute__((visibility("hidden")))
 void XHCIAsyncEndpoint::setParameters(uint32_t maxPacketSize, uint32_t maxBurst, uint32_t multiple)
 {
-	uint32_t MBPMultiple;
-
 	this->maxPacketSize = maxPacketSize;
 	this->maxBurst = maxBurst;
 	this->multiple = multiple;
+	maxTDBytes = provider->_tdBytesOverride ? : kAsyncMaxFragmentSize;
+	if (provider->_tdBytesOverride && maxTDBytes > TDBytesLimit())
+		maxTDBytes = TDBytesLimit();
+	maxTDBytes = RoundTDBytes(maxTDBytes);
+}
+
+/*
+ * Note: A TD never takes more than a quarter of the ring.
+ *   Stream rings may not have pages yet, so assume one.
+ */
+__attribute__((visibility("hidden")))
+uint32_t XHCIAsyncEndpoint::TDBytesLimit(void) const
+{
+	uint32_t numTRBs = pRing->numTRBs ? pRing->numTRBs : static_cast<uint32_t>(PAGE_SIZE / sizeof(TRBStruct));
+
+	return ((numTRBs - 1U) / 4U - 2U) * PAGE_SIZE;
+}
+
+__attribute__((visibility("hidden")))
+uint32_t XHCIAsyncEndpoint::RoundTDBytes(uint32_t bytes) const
+{
+	uint32_t MBPMultiple;
+
 	/*
 	 * Note: MBP = maxPacketSize * (1U + maxBurst)
 	 *  (Max Burst Payload)
 	 */
 	MBPMultiple = maxPacketSize * (1U + maxBurst) * (1U + multiple);
-	maxTDBytes = kAsyncMaxFragmentSize;
-	if (MBPMultiple && MBPMultiple < kAsyncMaxFragmentSize)
-		maxTDBytes -= (kAsyncMaxFragmentSize % MBPMultiple);
+	if (MBPMultiple && MBPMultiple < bytes)
+		bytes -= (bytes % MBPMultiple);
+	return bytes;
+}
+
+/*
+ * Note: Keeps a running average of request sizes (weight 1/8).
+ *   Endpoints that stream large requests get TDs of up to 1MB,
+ *   so fewer Event Data TRBs and interrupts per MB, but never
+ *   more than TDBytesLimit.  Requests below 128KB are a single
+ *   TD anyway, so that is the floor.
+ */
+__attribute__((visibility("hidden")))
+void XHCIAsyncEndpoint::AdaptTDBytes(size_t requestBytes)
+{
+	uint32_t target, limit;
+
+	if (requestBytes > kAsyncMaxAdaptiveTDBytes)
+		requestBytes = kAsyncMaxAdaptiveTDBytes;
+	avgRequestBytes = avgRequestBytes - avgRequestBytes / 8U + static_cast<uint32_t>(requestBytes) / 8U;
+	target = kAsyncMaxFragmentSize;
+	while (target < avgRequestBytes && target < kAsyncMaxAdaptiveTDBytes)
+		target *= 2U;
+	limit = TDBytesLimit();
+	while (target > kAsyncMaxFragmentSize && target > limit)
+		target /= 2U;
+	target = RoundTDBytes(target);
+	if (target != maxTDBytes) {
+		maxTDBytes = target;
+		++provider->_diagCounters[DIAGCTR_TDBYTESADAPT];
+	}
+}
+
+__attribute__((visibility("hidden")))
+uint8_t XHCIAsyncEndpoint::QoSClass(void) const
+{
+	switch (pRing->epType | CTRL_EP) {
+		case CTRL_EP:
+			return kQoSClassControl;
+		case INT_IN_EP:
+			return kQoSClassInterrupt;
+		default:
+			return kQoSClassBulk;
+	}
+}
+
+/*
+ * Note: Interrupt IN endpoints usually keep a poll outstanding
+ *   all the time, so they don't count as pending work.
+ */
+__attribute__((visibility("hidden")))
+bool XHCIAsyncEndpoint::HasPriorityWork(void) const
+{
+	return pRing->epType == CTRL_EP || pRing->epType == INT_OUT_EP;
 }
 
 __attribute__((visibility("hidden")))
@@ -61,36 +164,22 @@ void XHCIAsyncEndpoint::release(void)
 	aborting = true;
 	pRing->returnInProgress = true;
 	MoveAllTDsFromReadyQToDoneQ();
-	if (numTDsDone)
+	if (NumTDs(&doneTDs))
 		Complete(kIOReturnAborted);
-	wipeAsyncList(freeHead, freeTail);
-	freeHead = 0;
-	freeTail = 0;
-	numTDsFree = 0U;
 	aborting = false;
 	pRing->returnInProgress = false;
+	provider->DisarmTimeoutWheel(this);
+	SizeTDMap(0U);
+	FreeTDPool();
 	IOFree(this, sizeof *this);
 }
 
-__attribute__((visibility("hidden")))
-void XHCIAsyncEndpoint::wipeAsyncList(XHCIAsyncTD* pHead, XHCIAsyncTD* pTail)
-{
-	XHCIAsyncTD* pNextTd;
-
-	while (pHead) {
-		pNextTd = (pHead != pTail) ? pHead->next : 0;
-		pHead->release();
-		pHead = pNextTd;
-	}
-}
-
 __attribute__((visibility("hidden")))
 void XHCIAsyncEndpoint::nuke(void)
 {
-	wipeAsyncList(queuedHead, queuedTail);
-	wipeAsyncList(scheduledHead, scheduledTail);
-	wipeAsyncList(doneHead, doneTail);
-	wipeAsyncList(freeHead, freeTail);
+	provider->DisarmTimeoutWheel(this);
+	SizeTDMap(0U);
+	FreeTDPool();
 	IOFree(this, sizeof *this);
 }
 
@@ -98,8 +187,10 @@ __attribute__((visibility("hidden")))
 IOReturn XHCIAsyncEndpoint::CreateTDs(IOUSBCommand* command, uint16_t streamId, uint32_t mystery, uint8_t immediateDataSize, uint8_t const* pImmediateData)
 {
 	XHCIAsyncTD* pTd;
-	size_t transferRequestBytes, numBytesLeft, bytesDone;
+	size_t transferRequestBytes, numBytesLeft, bytesDone, subTransactionOffset, subTransactionBytes, numTDs;
+	uint64_t queuedTime;
 	uint32_t maxBytesPerTD, currentTDBytes;
+	IOReturn rc;
 	uint16_t tdIndex;
 	bool haveImmediateData;
 	bool usingMultipleTDs;
@@ -107,10 +198,6 @@ IOReturn XHCIAsyncEndpoint::CreateTDs(IOUSBCommand* command, uint16_t streamId,
 	if (aborting)
 		return kIOReturnNotPermitted;
 	transferRequestBytes = command->GetReqCount();
-	if (transferRequestBytes >= (1U << 23) && (provider->_errataBits & kErrataAbsoluteEDTLA)) {
-		IOLog("%s: xHC with absolute EDTLA limited to 8MB per transaction\n", __FUNCTION__);
-		return kIOReturnUnsupported;
-	}
 	if (transferRequestBytes) {
 		IODMACommand* dmac = command->GetDMACommand();
 		if (!dmac || !dmac->getMemoryDescriptor()) {
@@ -118,6 +205,8 @@ IOReturn XHCIAsyncEndpoint::CreateTDs(IOUSBCommand* command, uint16_t streamId,
 			return kIOReturnBadArgument;
 		}
 	}
+	if (!provider->_tdBytesOverride)
+		AdaptTDBytes(transferRequestBytes);
 	command->SetUIMScratch(9U, 0U);
 	if (immediateDataSize <= sizeof pTd->immediateData) {
 		transferRequestBytes = immediateDataSize;
@@ -133,22 +222,48 @@ IOReturn XHCIAsyncEndpoint::CreateTDs(IOUSBCommand* command, uint16_t streamId,
 		usingMultipleTDs = true;
 		maxBytesPerTD = maxTDBytes;
 	}
+	/*
+	 * Note: tdIndex and numTDsThisTransaction are 16 bits, so a transaction
+	 *   filling a pool of kAsyncMaxTDs would count itself as 0 TDs.
+	 */
+	numTDs = usingMultipleTDs ? (transferRequestBytes + maxTDBytes - 1U) / maxTDBytes : 1U;
+	if (numTDs >= kAsyncMaxTDs) {
+		IOLog("%s: transaction needs %lu TDs, beyond transaction limit of %u\n", __FUNCTION__,
+			  static_cast<unsigned long>(numTDs), kAsyncMaxTDs - 1U);
+		return kIOReturnNoResources;
+	}
+	rc = ReserveTDs(static_cast<uint32_t>(numTDs));
+	if (rc != kIOReturnSuccess)
+		return rc;
+	/*
+	 * Note: An xHC with absolute EDTLA counts the Event Data length from the
+	 *   start of the TD chain and overflows at 8MB, so larger transactions
+	 *   are broken into unchained sub-transactions below that size.
+	 */
+	if (usingMultipleTDs &&
+		transferRequestBytes >= kAsyncMaxAbsoluteEDTLA &&
+		(provider->_errataBits & kErrataAbsoluteEDTLA))
+		subTransactionBytes = ((kAsyncMaxAbsoluteEDTLA - 1U) / maxBytesPerTD) * maxBytesPerTD;
+	else
+		subTransactionBytes = 0U;
+	subTransactionOffset = 0U;
+	queuedTime = mach_absolute_time();
 
 	numBytesLeft = transferRequestBytes;
 	bytesDone = 0U;
 	tdIndex = 1U;
 	currentTDBytes = maxBytesPerTD;
 	do {
-		pTd = GetTDFromFreeQueue(true);
-		if (!pTd)
-			return kIOReturnNoMemory;
+		pTd = GetTDFromFreeQueue(false);
 		pTd->command = command;
 		pTd->interruptThisTD = !(bytesDone % maxTDBytes);
 		pTd->multiTDTransaction = usingMultipleTDs;
 		pTd->bytesPreceedingThisTD = bytesDone;
+		pTd->subTransactionOffset = subTransactionOffset;
+		pTd->queuedTime = queuedTime;
 		pTd->bytesThisTD = currentTDBytes;
 		pTd->mystery = mystery;
-		pTd->maxNumPagesInTD = static_cast<uint16_t>((currentTDBytes / PAGE_SIZE) + 2U);
+		pTd->numTRBsInTD = (haveImmediateData || !currentTDBytes) ? 1U : 0U;	// Note: 0 is counted by ScheduleTDs
 		pTd->streamId = streamId;
 		pTd->shortfall = currentTDBytes;
 		if (haveImmediateData) {
@@ -156,44 +271,121 @@ IOReturn XHCIAsyncEndpoint::CreateTDs(IOUSBCommand* command, uint16_t streamId,
 			if (immediateDataSize)
 				bcopy(pImmediateData, &pTd->immediateData[0], immediateDataSize);
 		}
-		PutTD(&queuedHead, &queuedTail, pTd, &numTDsQueued);
+		PutTD(&queuedTDs, pTd);
 		bytesDone += currentTDBytes;
 		if (bytesDone >= transferRequestBytes)
 			break;
 		++tdIndex;
 		numBytesLeft -= currentTDBytes;
 		pTd->bytesFollowingThisTD = numBytesLeft;
+		if (subTransactionBytes) {
+			if (bytesDone - subTransactionOffset >= subTransactionBytes) {
+				pTd->lastTDInSubTransaction = true;
+				pTd->bytesFollowingThisTD = 0U;
+				subTransactionOffset = bytesDone;
+			} else if (subTransactionOffset + subTransactionBytes - bytesDone < numBytesLeft)
+				pTd->bytesFollowingThisTD = subTransactionOffset + subTransactionBytes - bytesDone;
+		}
 		currentTDBytes = (numBytesLeft < maxBytesPerTD) ? static_cast<uint32_t>(numBytesLeft) : maxBytesPerTD;
 	} while (true);
 	pTd->numTDsThisTransaction = tdIndex;
 	pTd->interruptThisTD = true;
 	pTd->finalTDInTransaction = true;
 	pTd->bytesFollowingThisTD = 0U;
+	++stats.transactions;
+	stats.bytesRequested += command->GetReqCount();
+	if (HasPriorityWork())
+		provider->_qos.pendingPriorityTDs += tdIndex;
 	return kIOReturnSuccess;
 }
 
 __attribute__((visibility("hidden")))
-void XHCIAsyncEndpoint::ScheduleTDs(void)
+bool XHCIAsyncEndpoint::ScheduleTDs(void)
 {
 	XHCIAsyncTD* pTd;
 	IOReturn rc;
+	uint64_t now, latency;
+	uint16_t streamId;
+	uint8_t qosClass;
+	bool ringDoorbell;
 
-	if (!queuedHead)
-		return;
+	pTd = PeekTD(&queuedTDs);
+	if (!pTd)
+		return false;
 	if (aborting) {
 		if (pRing->returnInProgress)
 			pRing->needsDoorbell = true;
-		return;
+		return false;
 	}
+	streamId = 0U;
+	ringDoorbell = false;
+	if (tdSeqForTrbSize < pRing->numTRBs &&
+		!NumTDs(&scheduledTDs))
+		SizeTDMap(pRing->numTRBs);
+	qosClass = QoSClass();
+	now = mach_absolute_time();
 	do {
-		if (!(provider->CanTDFragmentFit(pRing, maxTDBytes))) {
+		/*
+		 * Note: TRBs are counted once the TD is at the head, so the
+		 *   segments fetched for counting are the ones _buildTransfer uses.
+		 */
+		if (!pTd->numTRBsInTD)
+			pTd->numTRBsInTD = provider->CountTRBsInTD(&provider->_tdSegmentCache,
+													   pTd->command->GetDMACommand(),
+													   pTd->bytesPreceedingThisTD,
+													   pTd->bytesThisTD);
+		if (pRing->needsGrowth &&
+			!NumTDs(&scheduledTDs) &&
+			pRing->enqueueIndex == pRing->dequeueIndex)
+			GrowRing(pTd->numTRBsInTD);
+		/*
+		 * Note: A sub-transaction is held back until the previous one
+		 *   retires, so a short packet can't run the xHC into it.
+		 */
+		if (pTd->subTransactionOffset &&
+			pTd->bytesPreceedingThisTD == pTd->subTransactionOffset &&
+			NumTDs(&scheduledTDs) &&
+			TDWithIndex(scheduledTDs.slots[(scheduledTDs.tail - 1U) & (tdPoolSize - 1U)])->command == pTd->command)
+			break;
+		/*
+		 * Note: Bulk endpoints hold back while control or interrupt OUT
+		 *   work is pending.  Since the limit is only reached with TDs
+		 *   scheduled, a retirement always reschedules.
+		 */
+		if (qosClass == kQoSClassBulk &&
+			provider->_qos.bulkInFlightLimit &&
+			bytesInFlight >= provider->_qos.bulkInFlightLimit &&
+			provider->_qos.pendingPriorityTDs) {
+			++provider->_qos.bulkDeferrals;
+			break;
+		}
+		if (!(provider->CanTDFragmentFit(pRing, pTd->numTRBsInTD))) {
+			/*
+			 * Note: Nothing retires on an empty ring, so waiting won't
+			 *   help.  Grow it now, or fail the transaction if it can't.
+			 */
+			if (!NumTDs(&scheduledTDs) &&
+				pRing->enqueueIndex == pRing->dequeueIndex) {
+				if (GrowRing(pTd->numTRBsInTD))
+					continue;
+				++provider->_diagCounters[DIAGCTR_XFERLAYOUT];
+				MoveTDsFromReadyQToDoneQ(pTd->command);
+				Complete(kIOReturnNoResources);
+				pTd = PeekTD(&queuedTDs);
+				continue;
+			}
+			++stats.ringFullStalls;
 			if (gux_log_level >= 2 && provider)
 				++provider->_diagCounters[DIAGCTR_XFERKEEPAWAY];
+			/*
+			 * Note: Ring is grown next time it drains
+			 */
+			if (pRing->numPages < kMaxTransferRingPages &&
+				!provider->IsStreamsEndpoint(pRing->slot, pRing->endpoint))
+				pRing->needsGrowth = true;
 			break;
 		}
-		pTd = GetTD(&queuedHead, &queuedTail, &numTDsQueued);
-		if (!pTd)
-			continue;
+		GetTD(&queuedTDs);
 		rc = provider->_createTransfer(pTd,
 									   false,
 									   pTd->bytesThisTD,
@@ -207,75 +399,136 @@ void XHCIAsyncEndpoint::ScheduleTDs(void)
 		if (rc != kIOReturnSuccess) {
 			if (provider)
 				++provider->_diagCounters[DIAGCTR_XFERLAYOUT];
-			PutTDAtHead(&queuedHead, &queuedTail, pTd, &numTDsQueued);
+			PutTDAtHead(&queuedTDs, pTd);
 			break;
 		}
-		PutTD(&scheduledHead, &scheduledTail, pTd, &numTDsScheduled);
+		PutTD(&scheduledTDs, pTd);
+		if (static_cast<uint32_t>(pTd->lastTrbIndex) < tdSeqForTrbSize)
+			tdSeqForTrb[pTd->lastTrbIndex] = scheduledTDs.tail - 1U;
+		if (!pTd->bytesPreceedingThisTD) {
+			latency = now - pTd->queuedTime;
+			++provider->_qos.latency[qosClass].transactions;
+			provider->_qos.latency[qosClass].total += latency;
+			if (latency > provider->_qos.latency[qosClass].max)
+				provider->_qos.latency[qosClass].max = latency;
+		}
 		if (pRing->returnInProgress)
 			pRing->needsDoorbell = true;
-		else
-			provider->StartEndpoint(pRing->slot, pRing->endpoint, pTd->streamId);
-	} while(queuedHead);
+		else {
+			/*
+			 * Note: All TDs go to the same ring, so ring its doorbell once
+			 *   after the whole pass.
+			 */
+			if (ringDoorbell)
+				++provider->_diagCounters[DIAGCTR_DOORBELLSAVED];
+			ringDoorbell = true;
+			streamId = pTd->streamId;
+		}
+		pTd = PeekTD(&queuedTDs);
+	} while (pTd);
+	if (gux_log_level >= 3 && !provider->CheckRingInvariants(pRing)) {
+		++provider->_diagCounters[DIAGCTR_RINGINVARIANT];
+		IOLog("%s: ring invariants broken, slot %u ep %u enqueue %u dequeue %u cycle %u\n", __FUNCTION__,
+			  pRing->slot, pRing->endpoint, pRing->enqueueIndex, pRing->dequeueIndex, pRing->cycleState);
+	}
+	ArmTimeouts();
+	if (ringDoorbell)
+		provider->StartEndpoint(pRing->slot, pRing->endpoint, streamId);
+	return ringDoorbell;
+}
+
+/*
+ * Note: Only called with the ring empty.  Grows it to the smallest
+ *   doubling that holds a TD of numTRBs, within kMaxTransferRingPages.
+ */
+__attribute__((visibility("hidden")))
+bool XHCIAsyncEndpoint::GrowRing(uint32_t numTRBs)
+{
+	uint32_t numPages;
+
+	if (pRing->numPages >= kMaxTransferRingPages ||
+		provider->IsStreamsEndpoint(pRing->slot, pRing->endpoint))
+		return false;
+	numPages = 2U * pRing->numPages;
+	while (numPages < kMaxTransferRingPages &&
+		   numPages * static_cast<uint32_t>(PAGE_SIZE / sizeof(TRBStruct)) - 2U < numTRBs)
+		numPages *= 2U;
+	if (numPages > kMaxTransferRingPages)
+		numPages = kMaxTransferRingPages;
+	if (provider->ResizeRing(pRing, static_cast<int32_t>(numPages)) != kIOReturnSuccess)
+		return false;
+	if (tdSeqForTrbSize < pRing->numTRBs)
+		SizeTDMap(pRing->numTRBs);
+	return true;
 }
 
 __attribute__((visibility("hidden")))
 IOReturn XHCIAsyncEndpoint::Abort(void)
 {
+	XHCIAsyncTD* pTd;
+	IOReturn abortResult;
+
 	aborting = true;
 	pRing->returnInProgress = true;
-	while (scheduledHead) {
-		IOUSBCommand* command = scheduledHead->command;
-		FlushTDs(command, 0);
-		MoveTDsFromReadyQToDoneQ(command);
-	}
+	/*
+	 * Note: Every transaction goes, so there's no need to walk them
+	 *   one command at a time.  Callers reinitialize the ring
+	 *   afterwards, which takes care of the dequeue pointer.
+	 */
+	while ((pTd = GetTD(&scheduledTDs)))
+		PutTDonDoneQueue(pTd);
+	MoveAllTDsFromReadyQToDoneQ();
+	timeoutFrame = 0U;
+	if (NumTDs(&doneTDs)) {
+		abortResult = provider->GetNeedsReset(pRing->slot) ? kIOReturnNotResponding : kIOReturnAborted;
+		Complete(abortResult);
+	} else
+		abortResult = kIOReturnSuccess;
 	pRing->returnInProgress = false;
 	aborting = false;
-    
-    IOReturn abortResult = kIOReturnSuccess;
-    
-    if(numTDsDone && provider && pRing)
-        abortResult = provider->GetNeedsReset(pRing->slot) ? kIOReturnNotResponding : kIOReturnAborted;
-    else if(numTDsDone)
-        abortResult = kIOReturnAborted;
-
 	return abortResult;
 }
 
 __attribute__((visibility("hidden")))
 struct XHCIAsyncTD* XHCIAsyncEndpoint::GetTDFromActiveQueueWithIndex(uint16_t indexInQueue)
 {
-	XHCIAsyncTD *pPrevTd, *pTd;
-	uint32_t orphanCount = 0U;
-	pTd = pPrevTd = scheduledHead;
-	while (pTd) {
-		if (pTd->lastTrbIndex == indexInQueue)
-			break;
-		if (pTd == scheduledTail)
+	XHCIAsyncTD* pTd = 0;
+	uint32_t seq, orphanCount;
+
+	if (indexInQueue < tdSeqForTrbSize) {
+		/*
+		 * Note: The map entry may be stale, so it's only
+		 *   trusted if it still names a scheduled TD that
+		 *   ends on this TRB.
+		 */
+		seq = tdSeqForTrb[indexInQueue];
+		if (seq - scheduledTDs.head >= NumTDs(&scheduledTDs))
+			return 0;
+		pTd = TDWithIndex(scheduledTDs.slots[seq & (tdPoolSize - 1U)]);
+		if (pTd->lastTrbIndex != indexInQueue)
+			return 0;
+	} else {
+		for (seq = scheduledTDs.head; seq != scheduledTDs.tail; ++seq) {
+			pTd = TDWithIndex(scheduledTDs.slots[seq & (tdPoolSize - 1U)]);
+			if (pTd->lastTrbIndex == indexInQueue)
+				break;
+		}
+		if (seq == scheduledTDs.tail)
 			return 0;
-		++orphanCount;
-		pPrevTd = pTd;
-		pTd = pTd->next;
 	}
-	if (!pTd)
-		return 0;
 
+	orphanCount = seq - scheduledTDs.head;
 	if (orphanCount) {
 		/*
 		 * Flush all scheduled TDs prior to pTd
 		 */
-		if (doneHead)
-			doneTail->next = scheduledHead;
-		else
-			doneHead = scheduledHead;
-		doneTail = pPrevTd;
-		numTDsDone += orphanCount;
-		scheduledHead = pTd;
-		numTDsScheduled -= orphanCount;
+		while (scheduledTDs.head != seq)
+			PutTD(&doneTDs, GetTD(&scheduledTDs));
 		Complete(kIOReturnSuccess);
 		if (provider)
 			provider->_diagCounters[DIAGCTR_ORPHANEDTDS] += orphanCount;
 	}
-	GetTD(&scheduledHead, &scheduledTail, &numTDsScheduled);
+	GetTD(&scheduledTDs);
 
 	return pTd;
 }
@@ -283,9 +536,16 @@ struct XHCIAsyncTD* XHCIAsyncEndpoint::GetTDFromActiveQueueWithIndex(uint16_t in
 __attribute__((visibility("hidden")))
 void XHCIAsyncEndpoint::RetireTDs(XHCIAsyncTD* pTd, IOReturn passthruReturnCode, bool callCompletion, bool flush)
 {
-	bool reschedule = true;
+	uint32_t numFlushed;
+	bool reschedule = true, restart = false;
 
 	PutTDonDoneQueue(pTd);
+	/*
+	 * Note: Head transaction is changing, so its timeouts
+	 *   are looked at again once the flush is done.
+	 */
+	if (pTd->finalTDInTransaction || flush)
+		timeoutFrame = 0U;
 	if (flush) {
 		uint8_t slot = pRing->slot;
 		uint8_t endpoint = pRing->endpoint;
@@ -298,19 +558,32 @@ void XHCIAsyncEndpoint::RetireTDs(XHCIAsyncTD* pTd, IOReturn passthruReturnCode,
 				 *   Any events for flushed TDs are safely discarded in processTransferEvent2.
 				 *
 				 *   This condition is likely coming from a short packet.
+				 *
+				 *   If none of the transaction's remaining TDs made it to the ring,
+				 *     the xHC is already past it and there is nothing to skip, so
+				 *     no Stop Endpoint/Set TR Dequeue round trip is needed.  But
+				 *     only if the short TD closed its chain, otherwise the xHC
+				 *     would chain its Event Data TRB into whatever comes next.
 				 */
-				FlushTDs(pTd->command, 0);
+				numFlushed = FlushTDs(pTd->command, 0);
 				MoveTDsFromReadyQToDoneQ(pTd->command);
-				if (!scheduledHead) {
-					/*
-					 * Note: This is necessary in order to break the chain and
-					 *   make sure pRing->dequeueIndex is up-to-date.
-					 */
-					provider->QuiesceEndpoint(slot, endpoint);
-					provider->SetTRDQPtr(slot, endpoint, pTd->streamId, pRing->enqueueIndex);
-					if (pTd->streamId)
-						provider->RestartStreams(slot, endpoint, pTd->streamId);
+				if (NumTDs(&scheduledTDs))
+					break;
+				if (!numFlushed &&
+					(pTd->finalTDInTransaction || pTd->lastTDInSubTransaction) &&
+					pRing->dequeueIndex == pRing->enqueueIndex) {
+					++provider->_diagCounters[DIAGCTR_FLUSHFAST];
+					break;
 				}
+				++provider->_diagCounters[DIAGCTR_FLUSHSLOW];
+				/*
+				 * Note: This is necessary in order to break the chain and
+				 *   make sure pRing->dequeueIndex is up-to-date.
+				 */
+				provider->QuiesceEndpoint(slot, endpoint);
+				provider->SetTRDQPtr(slot, endpoint, pTd->streamId, pRing->enqueueIndex);
+				if (pTd->streamId)
+					provider->RestartStreams(slot, endpoint, pTd->streamId);
 				break;
 
 			case EP_STATE_STOPPED:
@@ -321,8 +594,8 @@ void XHCIAsyncEndpoint::RetireTDs(XHCIAsyncTD* pTd, IOReturn passthruReturnCode,
 				MoveTDsFromReadyQToDoneQ(pTd->command);
 				if (pTd->streamId)
 					provider->RestartStreams(slot, endpoint, 0U);
-				else if (scheduledHead)
-					provider->StartEndpoint(slot, endpoint, 0U);
+				else if (NumTDs(&scheduledTDs))
+					restart = true;	// Note: doorbell rung below, unless ScheduleTDs does it
 				break;
                 
             default:
@@ -342,8 +615,13 @@ void XHCIAsyncEndpoint::RetireTDs(XHCIAsyncTD* pTd, IOReturn passthruReturnCode,
 	}
 	if (callCompletion)
 		Complete(passthruReturnCode);
-	if (reschedule)
-		ScheduleTDs();
+	if (reschedule && ScheduleTDs() && restart) {
+		++provider->_diagCounters[DIAGCTR_DOORBELLSAVED];
+		restart = false;
+	}
+	if (restart)
+		provider->StartEndpoint(pRing->slot, pRing->endpoint, 0U);
+	ArmTimeouts();
 }
 
 __attribute__((visibility("hidden")))
@@ -351,30 +629,22 @@ XHCIAsyncTD* XHCIAsyncEndpoint::GetTDFromFreeQueue(bool newOneOk)
 {
 	XHCIAsyncTD* pTd;
 
-	if (!freeHead)
-		return newOneOk ? XHCIAsyncTD::ForEndpoint(this) : 0;
-	pTd = GetTD(&freeHead, &freeTail, &numTDsFree);
-	if (pTd)
-		pTd->reinit();
+	if (!NumTDs(&freeTDs) &&
+		(!newOneOk || ReserveTDs(1U) != kIOReturnSuccess))
+		return 0;
+	/*
+	 * Note: Taken from the tail, so the most recently retired
+	 *   (cache-warm) TD is reused first.
+	 */
+	pTd = TDWithIndex(freeTDs.slots[--freeTDs.tail & (tdPoolSize - 1U)]);
+	pTd->reinit();
 	return pTd;
 }
 
 __attribute__((visibility("hidden")))
 void XHCIAsyncEndpoint::PutTDonDoneQueue(XHCIAsyncTD* pTd)
 {
-	if (doneHead && !doneTail) {
-		XHCIAsyncTD* pLastTd = doneHead;
-		uint32_t count = 0U;
-		while (pLastTd->next) {
-			if (count++ > numTDsDone) {
-				pLastTd = 0;
-				break;
-			}
-			pLastTd = pLastTd->next;
-		}
-		doneTail = pLastTd;
-	}
-	PutTD(&doneHead, &doneTail, pTd, &numTDsDone);
+	PutTD(&doneTDs, pTd);
 }
 
 /*
@@ -384,19 +654,21 @@ void XHCIAsyncEndpoint::PutTDonDoneQueue(XHCIAsyncTD* pTd)
  *   2 - always update TRDQPtr
  */
 __attribute__((visibility("hidden")))
-void XHCIAsyncEndpoint::FlushTDs(IOUSBCommand* command, int32_t updateDequeueOption)
+uint32_t XHCIAsyncEndpoint::FlushTDs(IOUSBCommand* command, int32_t updateDequeueOption)
 {
 	XHCIAsyncTD* pTd;
-	uint32_t streamId;
+	uint32_t streamId, numFlushed;
 	int32_t indexInQueue;
 
-	pTd = scheduledHead;
+	pTd = PeekTD(&scheduledTDs);
 	if (!command || !pTd)
-		return;
+		return 0U;
 	indexInQueue = -1;
 	streamId = 0U;
+	numFlushed = 0U;
 	while (pTd && pTd->command == command) {
-		GetTD(&scheduledHead, &scheduledTail, &numTDsScheduled);
+		GetTD(&scheduledTDs);
+		++numFlushed;
 		if (updateDequeueOption) {
 			streamId = pTd->streamId;
 			indexInQueue = pTd->lastTrbIndex + 1;
@@ -404,31 +676,29 @@ void XHCIAsyncEndpoint::FlushTDs(IOUSBCommand* command, int32_t updateDequeueOpt
 				indexInQueue = 0;
 		}
 		PutTDonDoneQueue(pTd);
-		pTd = scheduledHead;
+		pTd = PeekTD(&scheduledTDs);
 	}
 	switch (updateDequeueOption) {
 		case 0:
-			return;
+			return numFlushed;
 		case 1:
-			if (scheduledHead)
-				return;
+			if (NumTDs(&scheduledTDs))
+				return numFlushed;
 			break;
 	}
-	if (indexInQueue < 0)
-		return;
-	provider->SetTRDQPtr(pRing->slot, pRing->endpoint, streamId, indexInQueue);
+	if (indexInQueue >= 0)
+		provider->SetTRDQPtr(pRing->slot, pRing->endpoint, streamId, indexInQueue);
+	return numFlushed;
 }
 
 __attribute__((visibility("hidden")))
 void XHCIAsyncEndpoint::MoveTDsFromReadyQToDoneQ(IOUSBCommand* command)
 {
 	XHCIAsyncTD* pTd;
-	while (queuedHead) {
-		if (command && command != queuedHead->command)
+	while ((pTd = PeekTD(&queuedTDs))) {
+		if (command && command != pTd->command)
 			break;
-		pTd = GetTD(&queuedHead, &queuedTail, &numTDsQueued);
-		if (pTd)
-			PutTDonDoneQueue(pTd);
+		PutTDonDoneQueue(GetTD(&queuedTDs));
 	}
 }
 
@@ -436,11 +706,8 @@ __attribute__((visibility("hidden")))
 void XHCIAsyncEndpoint::MoveAllTDsFromReadyQToDoneQ(void)
 {
 	XHCIAsyncTD* pTd;
-	while (queuedHead) {
-		pTd = GetTD(&queuedHead, &queuedTail, &numTDsQueued);
-		if (pTd)
-			PutTDonDoneQueue(pTd);
-	}
+	while ((pTd = GetTD(&queuedTDs)))
+		PutTDonDoneQueue(pTd);
 }
 
 __attribute__((visibility("hidden")))
@@ -449,18 +716,32 @@ void XHCIAsyncEndpoint::Complete(IOReturn passthruReturnCode)
 	XHCIAsyncTD* pTd;
 	IOUSBCommand* command;
 	IOUSBCompletion comp;
+	uint64_t latency;
+	uint32_t bucket;
+	bool priorityWork = HasPriorityWork();
 
-	while (doneHead) {
-		pTd = GetTD(&doneHead, &doneTail, &numTDsDone);
-		if (!pTd)
-			continue;
+	while ((pTd = GetTD(&doneTDs))) {
 		command = pTd->command;
+		if (priorityWork)
+			--provider->_qos.pendingPriorityTDs;
+		if (pTd->bytesPreceedingThisTD == pTd->subTransactionOffset)
+			absoluteShortfallBase = command->GetUIMScratch(9U);
 		if (pTd->absoluteShortfall)
-			command->SetUIMScratch(9U, pTd->shortfall);
+			command->SetUIMScratch(9U, absoluteShortfallBase + pTd->shortfall);
 		else
 			command->SetUIMScratch(9U, command->GetUIMScratch(9U) + pTd->shortfall);
+		++stats.tdsCompleted;
 		if (pTd->interruptThisTD &&
 			pTd->finalTDInTransaction) {
+			++stats.completions;
+			stats.bytesTransferred += command->GetReqCount() - command->GetUIMScratch(9U);
+			if (command->GetUIMScratch(9U))
+				++stats.shortTransactions;
+			absolutetime_to_nanoseconds(mach_absolute_time() - pTd->queuedTime, &latency);
+			latency /= 1000ULL;
+			for (bucket = 0U; latency >= 2ULL && bucket < kAsyncLatencyBuckets - 1U; latency >>= 1)
+				++bucket;
+			++stats.latency[bucket];
 			comp = command->GetUSLCompletion();
 			if (comp.action) {
 				/*
@@ -476,7 +757,7 @@ void XHCIAsyncEndpoint::Complete(IOReturn passthruReturnCode)
 			}
 			pTd->interruptThisTD = false;
 		}
-		PutTD(&freeHead, &freeTail, pTd, &numTDsFree);
+		PutTD(&freeTDs, pTd);
 	}
 }
 
@@ -487,7 +768,7 @@ bool XHCIAsyncEndpoint::NeedTimeouts(void)
 	IOUSBCommand* command;
 	uint32_t ndto, cto;
 
-	pTd = scheduledHead;
+	pTd = PeekTD(&scheduledTDs);
 	if (!pTd)
 		return true;
 	command = pTd->command;
@@ -502,6 +783,64 @@ bool XHCIAsyncEndpoint::NeedTimeouts(void)
 	return ndto || cto;
 }
 
+/*
+ * Note: Frame at which the head TD's timeouts next need a look, or 0
+ *   to look on the next wheel visit.  No-data timeouts are sampled at
+ *   least every half period so progress is noticed in time.
+ */
+__attribute__((visibility("hidden")))
+uint32_t XHCIAsyncEndpoint::NextTimeoutFrame(uint32_t frameNumber)
+{
+	XHCIAsyncTD* pTd;
+	IOUSBCommand* command;
+	uint32_t ndto, cto, firstSeen, TRTime, next, t;
+
+	pTd = PeekTD(&scheduledTDs);
+	if (!pTd)
+		return 0U;
+	command = pTd->command;
+	if (!command)
+		return 0U;
+	ndto = command->GetNoDataTimeout();
+	cto = command->GetCompletionTimeout();
+	firstSeen = command->GetUIMScratch(5U);
+	if (!ndto && !cto)
+		return 0U;
+	/*
+	 * Note: Not yet seen by UpdateTimeouts, or overdue while the
+	 *   ring was still moving, so look again on the next tick
+	 */
+	if (!firstSeen)
+		return frameNumber + 1U;
+	next = cto ? firstSeen + cto + 1U : frameNumber + (kTimeoutWheelBuckets << kTimeoutWheelShift) / 2U;
+	if (ndto) {
+		TRTime = command->GetUIMScratch(6U);
+		t = (TRTime ? TRTime : frameNumber) + ndto + 1U;
+		if (static_cast<int32_t>(t - next) < 0)
+			next = t;
+		t = frameNumber + ndto / 2U;
+		if (static_cast<int32_t>(t - next) < 0)
+			next = t;
+	}
+	if (static_cast<int32_t>(next - frameNumber) <= 0)
+		return frameNumber + 1U;
+	return next;
+}
+
+/*
+ * Note: Puts the endpoint on the timeout wheel once the head
+ *   transaction has timeouts.  Those without stay off it.
+ */
+__attribute__((visibility("hidden")))
+void XHCIAsyncEndpoint::ArmTimeouts(void)
+{
+	if (timeoutFrame)
+		return;
+	timeoutFrame = NextTimeoutFrame(provider->_timeoutWheel.lastFrame);
+	if (timeoutFrame)
+		provider->ArmTimeoutWheel(this, timeoutFrame);
+}
+
 #define OLDAS_MASK 0x80000000U
 
 __attribute__((visibility("hidden")))
@@ -516,7 +855,7 @@ void XHCIAsyncEndpoint::UpdateTimeouts(bool abortAll, uint32_t frameNumber, bool
 	int32_t next;
 	bool returnATransfer = false, absoluteShortfall = false, oldAS;
 
-	pTd = scheduledHead;
+	pTd = PeekTD(&scheduledTDs);
 	if (!pTd)
 		return;
 	addr = GenericUSBXHCI::GetTRBAddr64(&pRing->stopTrb);
@@ -529,7 +868,7 @@ void XHCIAsyncEndpoint::UpdateTimeouts(bool abortAll, uint32_t frameNumber, bool
 			shortfall = pTd->bytesThisTD - XHCI_TRB_2_REM_GET(pRing->stopTrb.c);
 			if (provider->_errataBits & kErrataAbsoluteEDTLA) {
 				absoluteShortfall = true;
-				shortfall += pTd->bytesPreceedingThisTD;
+				shortfall += pTd->bytesPreceedingThisTD - pTd->subTransactionOffset;
 			}
 		} else {
 			if (XHCI_TRB_2_ERROR_GET(pRing->stopTrb.c) == XHCI_TRB_ERROR_LENGTH)
@@ -584,7 +923,7 @@ void XHCIAsyncEndpoint::UpdateTimeouts(bool abortAll, uint32_t frameNumber, bool
 		pTd->absoluteShortfall = absoluteShortfall;
 		passthruReturnCode = kIOReturnNotResponding;
 	}
-	GetTD(&scheduledHead, &scheduledTail, &numTDsScheduled);
+	GetTD(&scheduledTDs);
 	if (provider->GetNeedsReset(pRing->slot))
 		passthruReturnCode = kIOReturnNotResponding;
 	/*
@@ -602,69 +941,230 @@ void XHCIAsyncEndpoint::UpdateTimeouts(bool abortAll, uint32_t frameNumber, bool
 }
 
 __attribute__((visibility("hidden")))
-XHCIAsyncTD* XHCIAsyncEndpoint::GetTD(XHCIAsyncTD** pHead, XHCIAsyncTD** pTail, uint32_t* pNumTDs)
+XHCIAsyncTD* XHCIAsyncEndpoint::TDWithIndex(uint16_t index) const
 {
-	XHCIAsyncTD* res = *pHead;
-	if (!res)
+	return &tdChunks[index / kAsyncTDsPerChunk][index % kAsyncTDsPerChunk];
+}
+
+__attribute__((visibility("hidden")))
+XHCIAsyncTD* XHCIAsyncEndpoint::PeekTD(XHCIAsyncTDQueue const* pQueue) const
+{
+	if (pQueue->head == pQueue->tail)
 		return 0;
-	if (res == *pTail) {
-		*pTail = 0;
-		*pHead = 0;
-	} else
-		*pHead = res->next;
-	--*pNumTDs;
-	return res;
+	return TDWithIndex(pQueue->slots[pQueue->head & (tdPoolSize - 1U)]);
 }
 
 __attribute__((visibility("hidden")))
-void XHCIAsyncEndpoint::PutTD(XHCIAsyncTD** pHead, XHCIAsyncTD** pTail, XHCIAsyncTD* pTd, uint32_t* pNumTDs)
+XHCIAsyncTD* XHCIAsyncEndpoint::GetTD(XHCIAsyncTDQueue* pQueue)
 {
-	if (*pHead)
-		(*pTail)->next = pTd;
-	else
-		*pHead = pTd;
-	*pTail = pTd;
-	++*pNumTDs;
+	XHCIAsyncTD* pTd;
+
+	if (pQueue->head == pQueue->tail)
+		return 0;
+	pTd = TDWithIndex(pQueue->slots[pQueue->head++ & (tdPoolSize - 1U)]);
+	if (pQueue == &scheduledTDs)
+		bytesInFlight -= pTd->bytesThisTD;
+	return pTd;
 }
 
+/*
+ * Note: A queue never holds more than tdPoolSize TDs, so
+ *   PutTD and PutTDAtHead cannot overrun.
+ */
 __attribute__((visibility("hidden")))
-void XHCIAsyncEndpoint::PutTDAtHead(XHCIAsyncTD** pHead, XHCIAsyncTD** pTail, XHCIAsyncTD* pTd, uint32_t* pNumTDs)
+void XHCIAsyncEndpoint::PutTD(XHCIAsyncTDQueue* pQueue, XHCIAsyncTD* pTd)
 {
-	if (*pHead)
-		pTd->next = *pHead;
-	else
-		*pTail = pTd;
-	*pHead = pTd;
-	++*pNumTDs;
+	pQueue->slots[pQueue->tail++ & (tdPoolSize - 1U)] = pTd->index;
+	if (pQueue == &scheduledTDs)
+		bytesInFlight += pTd->bytesThisTD;
 }
 
-#pragma mark -
-#pragma mark XHCIAsyncTD
-#pragma mark -
+__attribute__((visibility("hidden")))
+void XHCIAsyncEndpoint::PutTDAtHead(XHCIAsyncTDQueue* pQueue, XHCIAsyncTD* pTd)
+{
+	pQueue->slots[--pQueue->head & (tdPoolSize - 1U)] = pTd->index;
+}
 
 __attribute__((visibility("hidden")))
-XHCIAsyncTD* XHCIAsyncTD::ForEndpoint(XHCIAsyncEndpoint* provider)
+uint32_t XHCIAsyncEndpoint::NumTDs(XHCIAsyncTDQueue const* pQueue)
 {
+	return pQueue->tail - pQueue->head;
+}
+
+/*
+ * Note: TDs live in fixed chunks and never move, so TD pointers
+ *   held by callers stay valid across a resize.  Only the index
+ *   rings are reallocated.  Sequence numbers are kept, since
+ *   tdSeqForTrb refers to scheduled TDs by them.  The pool only
+ *   shrinks while every TD is free.
+ */
+__attribute__((visibility("hidden")))
+IOReturn XHCIAsyncEndpoint::ResizeTDPool(uint32_t newPoolSize)
+{
+	XHCIAsyncTDQueue* queues[4] = { &queuedTDs, &scheduledTDs, &doneTDs, &freeTDs };
+	uint16_t* newSlots[4];
+	XHCIAsyncTD** newChunks;
 	XHCIAsyncTD* pTd;
+	uint32_t oldNumChunks, newNumChunks, firstFreeTD, i, seq;
 
-	pTd = static_cast<XHCIAsyncTD*>(IOMalloc(sizeof *pTd));
-	if (!pTd)
-		return 0;
-	bzero(pTd, sizeof *pTd);
-	pTd->provider = provider;
-	return pTd;
+	if (newPoolSize > kAsyncMaxTDs)
+		return kIOReturnNoResources;
+	if (newPoolSize == tdPoolSize)
+		return kIOReturnSuccess;
+	if (newPoolSize < tdPoolSize && NumTDs(&freeTDs) != tdPoolSize)
+		return kIOReturnBusy;
+	oldNumChunks = tdPoolSize / kAsyncTDsPerChunk;
+	newNumChunks = newPoolSize / kAsyncTDsPerChunk;
+	newChunks = static_cast<XHCIAsyncTD**>(IOMalloc(newNumChunks * sizeof *newChunks));
+	if (!newChunks)
+		return kIOReturnNoMemory;
+	bzero(newChunks, newNumChunks * sizeof *newChunks);
+	bzero(&newSlots[0], sizeof newSlots);
+	for (i = oldNumChunks; i < newNumChunks; ++i) {
+		newChunks[i] = static_cast<XHCIAsyncTD*>(IOMallocAligned(kAsyncTDsPerChunk * sizeof(XHCIAsyncTD), 64U));
+		if (!newChunks[i])
+			goto nomem;
+	}
+	for (i = 0U; i != 4U; ++i) {
+		newSlots[i] = static_cast<uint16_t*>(IOMallocAligned(newPoolSize * sizeof(uint16_t), 64U));
+		if (!newSlots[i])
+			goto nomem;
+	}
+	if (newPoolSize < tdPoolSize) {
+		for (i = newNumChunks; i != oldNumChunks; ++i)
+			IOFreeAligned(tdChunks[i], kAsyncTDsPerChunk * sizeof(XHCIAsyncTD));
+		freeTDs.head = freeTDs.tail;
+		firstFreeTD = 0U;
+	} else
+		firstFreeTD = tdPoolSize;
+	for (i = 0U; i != 4U; ++i) {
+		for (seq = queues[i]->head; seq != queues[i]->tail; ++seq)
+			newSlots[i][seq & (newPoolSize - 1U)] = queues[i]->slots[seq & (tdPoolSize - 1U)];
+		if (queues[i]->slots)
+			IOFreeAligned(queues[i]->slots, tdPoolSize * sizeof(uint16_t));
+		queues[i]->slots = newSlots[i];
+	}
+	if (tdChunks) {
+		bcopy(tdChunks, newChunks, (oldNumChunks < newNumChunks ? oldNumChunks : newNumChunks) * sizeof *newChunks);
+		IOFree(tdChunks, oldNumChunks * sizeof *newChunks);
+	}
+	tdChunks = newChunks;
+	for (i = tdPoolSize; i < newPoolSize; ++i) {
+		pTd = &newChunks[i / kAsyncTDsPerChunk][i % kAsyncTDsPerChunk];
+		bzero(pTd, sizeof *pTd);
+		pTd->provider = this;
+		pTd->index = static_cast<uint16_t>(i);
+	}
+	tdPoolSize = newPoolSize;
+	for (i = firstFreeTD; i != newPoolSize; ++i)
+		PutTD(&freeTDs, TDWithIndex(static_cast<uint16_t>(i)));
+	return kIOReturnSuccess;
+
+nomem:
+	for (i = 0U; i != 4U; ++i)
+		if (newSlots[i])
+			IOFreeAligned(newSlots[i], newPoolSize * sizeof(uint16_t));
+	for (i = oldNumChunks; i < newNumChunks; ++i)
+		if (newChunks[i])
+			IOFreeAligned(newChunks[i], kAsyncTDsPerChunk * sizeof(XHCIAsyncTD));
+	IOFree(newChunks, newNumChunks * sizeof *newChunks);
+	return kIOReturnNoMemory;
 }
 
+/*
+ * Note: Makes sure numTDs TDs are free before a transaction is
+ *   queued, so CreateTDs never fails halfway through.
+ */
 __attribute__((visibility("hidden")))
-void XHCIAsyncTD::reinit(void)
+IOReturn XHCIAsyncEndpoint::ReserveTDs(uint32_t numTDs)
 {
-	XHCIAsyncEndpoint* p = provider;
-	bzero(this, sizeof *this);
-	provider = p;
+	IOReturn rc;
+	uint32_t newPoolSize;
+
+	if (NumTDs(&freeTDs) >= numTDs) {
+		++provider->_diagCounters[DIAGCTR_TDPOOLHIT];
+		return kIOReturnSuccess;
+	}
+	++provider->_diagCounters[DIAGCTR_TDPOOLMISS];
+	newPoolSize = tdPoolSize ? tdPoolSize : kAsyncTDsPerChunk;
+	while (newPoolSize - (tdPoolSize - NumTDs(&freeTDs)) < numTDs)
+		newPoolSize *= 2U;
+	rc = ResizeTDPool(newPoolSize);
+	if (rc == kIOReturnNoResources)
+		IOLog("%s: transaction needs %u TDs, beyond endpoint limit of %u\n", __FUNCTION__, numTDs, kAsyncMaxTDs);
+	return rc;
 }
 
 __attribute__((visibility("hidden")))
-void XHCIAsyncTD::release(void)
+void XHCIAsyncEndpoint::TrimTDPool(void)
 {
-	IOFree(this, sizeof *this);
+	if (tdPoolSize > tdPoolBaseSize)
+		ResizeTDPool(tdPoolBaseSize);
+}
+
+/*
+ * Note: Called with the ring empty (first use, or just after
+ *   ResizeRing), so there are no live entries to carry over.
+ *   On failure, lookups fall back to scanning scheduledTDs.
+ */
+__attribute__((visibility("hidden")))
+IOReturn XHCIAsyncEndpoint::SizeTDMap(uint32_t numTRBs)
+{
+	if (tdSeqForTrb) {
+		IOFree(tdSeqForTrb, tdSeqForTrbSize * sizeof *tdSeqForTrb);
+		tdSeqForTrb = 0;
+		tdSeqForTrbSize = 0U;
+	}
+	if (!numTRBs)
+		return kIOReturnSuccess;
+	tdSeqForTrb = static_cast<uint32_t*>(IOMalloc(numTRBs * sizeof *tdSeqForTrb));
+	if (!tdSeqForTrb)
+		return kIOReturnNoMemory;
+	/*
+	 * Note: An entry of head - 1 is out of range for any sequence window
+	 */
+	for (uint32_t i = 0U; i != numTRBs; ++i)
+		tdSeqForTrb[i] = scheduledTDs.head - 1U;
+	tdSeqForTrbSize = numTRBs;
+	return kIOReturnSuccess;
+}
+
+__attribute__((visibility("hidden")))
+void XHCIAsyncEndpoint::FreeTDPool(void)
+{
+	XHCIAsyncTDQueue* queues[4] = { &queuedTDs, &scheduledTDs, &doneTDs, &freeTDs };
+	uint32_t i, numChunks = tdPoolSize / kAsyncTDsPerChunk;
+
+	/*
+	 * Note: TDs that never made it through Complete are
+	 *   still counted as pending priority work
+	 */
+	if (tdPoolSize && HasPriorityWork())
+		provider->_qos.pendingPriorityTDs -= NumTDs(&queuedTDs) + NumTDs(&scheduledTDs) + NumTDs(&doneTDs);
+	for (i = 0U; i != 4U; ++i) {
+		if (queues[i]->slots)
+			IOFreeAligned(queues[i]->slots, tdPoolSize * sizeof(uint16_t));
+		bzero(queues[i], sizeof *queues[i]);
+	}
+	if (tdChunks) {
+		for (i = 0U; i != numChunks; ++i)
+			IOFreeAligned(tdChunks[i], kAsyncTDsPerChunk * sizeof(XHCIAsyncTD));
+		IOFree(tdChunks, numChunks * sizeof *tdChunks);
+		tdChunks = 0;
+	}
+	tdPoolSize = 0U;
+}
+
+#pragma mark -
+#pragma mark XHCIAsyncTD
+#pragma mark -
+
+__attribute__((visibility("hidden")))
+void XHCIAsyncTD::reinit(void)
+{
+	XHCIAsyncEndpoint* p = provider;
+	uint16_t i = index;
+	bzero(this, sizeof *this);
+	provider = p;
+	index = i;
 }
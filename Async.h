@@ -11,48 +11,104 @@
 
 struct XHCIAsyncTD;
 
+#define kAsyncTDsPerChunk 16U
+#define kAsyncMaxTDs (1U << 16)
+#define kAsyncMaxFragmentSize (1U << 17)
+#define kAsyncMaxAdaptiveTDBytes (1U << 20)
+#define kAsyncMaxAbsoluteEDTLA (1U << 23)
+#define kAsyncLatencyBuckets 20U
+#define kAsyncTDSegments (kAsyncMaxAdaptiveTDBytes / PAGE_SIZE + 2U)
+
+/*
+ * Note: Ring of TD indices.  head and tail are free-running
+ *   sequence numbers, masked by the endpoint's tdPoolSize - 1.
+ */
+struct XHCIAsyncTDQueue
+{
+	uint16_t* slots;
+	uint32_t head;
+	uint32_t tail;
+};
+
+/*
+ * Note: latency[i] counts transactions completed in
+ *   [2^i, 2^(i+1)) microseconds from CreateTDs, except
+ *   that bucket 0 is [0, 2) and the last is open-ended.
+ */
+struct XHCIAsyncEndpointStats
+{
+	uint64_t bytesRequested;
+	uint64_t bytesTransferred;
+	uint32_t transactions;
+	uint32_t completions;
+	uint32_t tdsCompleted;
+	uint32_t shortTransactions;
+	uint32_t ringFullStalls;
+	uint32_t latency[kAsyncLatencyBuckets];
+};
+
 struct XHCIAsyncEndpoint
 {
 	ringStruct* pRing;	// 0x10 (start)
-	XHCIAsyncTD* queuedHead;	// 0x18
-	XHCIAsyncTD* queuedTail;	// 0x20
-	XHCIAsyncTD* scheduledHead;	// 0x28
-	XHCIAsyncTD* scheduledTail;	// 0x30
-	XHCIAsyncTD* doneHead;	// 0x38
-	XHCIAsyncTD* doneTail;	// 0x40
-	XHCIAsyncTD* freeHead;	// 0x48
-	XHCIAsyncTD* freeTail;	// 0x50
-	uint32_t numTDsQueued;	// 0x58
-	uint32_t numTDsScheduled;	// 0x5C
-	uint32_t numTDsDone;	// 0x60
-	uint32_t numTDsFree;	// 0x64
+	XHCIAsyncTDQueue queuedTDs;	// originally queuedHead/Tail
+	XHCIAsyncTDQueue scheduledTDs;	// originally scheduledHead/Tail
+	XHCIAsyncTDQueue doneTDs;	// originally doneHead/Tail
+	XHCIAsyncTDQueue freeTDs;	// originally freeHead/Tail
+	XHCIAsyncTD** tdChunks;	// Added
+	uint32_t tdPoolSize;	// Added
+	uint32_t tdPoolBaseSize;	// Added - preallocated size, trimmed back to when idle
+	uint32_t* tdSeqForTrb;	// Added - scheduled sequence number of TD ending at each TRB
+	uint32_t tdSeqForTrbSize;	// Added
 	bool aborting;	// 0x68
 	uint32_t maxPacketSize;	// 0x6C
 	uint32_t maxBurst;	// 0x70
 	uint32_t multiple;	// 0x74
 	uint32_t maxTDBytes;	// 0x78
+	uint32_t avgRequestBytes;	// Added
+	uint32_t absoluteShortfallBase;	// Added - shortfall before current sub-transaction
+	XHCIAsyncEndpoint* wheelNext;	// Added
+	XHCIAsyncEndpoint** wheelLink;	// Added - link that points here, 0 if not in timeout wheel
+	uint32_t wheelFrame;	// Added - frame at which timeout wheel visits next
+	uint32_t timeoutFrame;	// Added - frame at which timeouts need checking, 0 means next visit
+	uint16_t streamId;	// Added
+	uint32_t bytesInFlight;	// Added - bytes in scheduled TDs
+	XHCIAsyncEndpointStats stats;	// Added
 	GenericUSBXHCI* provider;	// 0x80
-								// sizeof 0x88
 
 	IOReturn CreateTDs(IOUSBCommand*, uint16_t, uint32_t, uint8_t, uint8_t const*);
-	void ScheduleTDs(void);
+	bool ScheduleTDs(void);
+	bool GrowRing(uint32_t);
 	IOReturn Abort(void);
 	XHCIAsyncTD* GetTDFromActiveQueueWithIndex(uint16_t);
 	void RetireTDs(XHCIAsyncTD*, IOReturn, bool, bool);
 	XHCIAsyncTD* GetTDFromFreeQueue(bool);
 	void PutTDonDoneQueue(XHCIAsyncTD*);
-	void FlushTDs(IOUSBCommand*, int32_t);
+	uint32_t FlushTDs(IOUSBCommand*, int32_t);
 	void MoveTDsFromReadyQToDoneQ(IOUSBCommand*);
 	void MoveAllTDsFromReadyQToDoneQ(void);
 	void Complete(IOReturn);
 	bool NeedTimeouts(void);
+	uint32_t NextTimeoutFrame(uint32_t);
+	void ArmTimeouts(void);
 	void UpdateTimeouts(bool, uint32_t, bool);
-	static XHCIAsyncTD* GetTD(XHCIAsyncTD**, XHCIAsyncTD**, uint32_t*);
-	static void PutTD(XHCIAsyncTD**, XHCIAsyncTD**, XHCIAsyncTD*, uint32_t*);
-	static void PutTDAtHead(XHCIAsyncTD**, XHCIAsyncTD**, XHCIAsyncTD*, uint32_t*);
-	static void wipeAsyncList(XHCIAsyncTD*, XHCIAsyncTD*);
+	XHCIAsyncTD* TDWithIndex(uint16_t) const;
+	XHCIAsyncTD* PeekTD(XHCIAsyncTDQueue const*) const;
+	XHCIAsyncTD* GetTD(XHCIAsyncTDQueue*);
+	void PutTD(XHCIAsyncTDQueue*, XHCIAsyncTD*);
+	void PutTDAtHead(XHCIAsyncTDQueue*, XHCIAsyncTD*);
+	static uint32_t NumTDs(XHCIAsyncTDQueue const*);
+	IOReturn ResizeTDPool(uint32_t);
+	IOReturn ReserveTDs(uint32_t);
+	void TrimTDPool(void);
+	IOReturn SizeTDMap(uint32_t);
+	void FreeTDPool(void);
 	static XHCIAsyncEndpoint* withParameters(GenericUSBXHCI*, ringStruct*, uint32_t, uint32_t, uint32_t);
 	void setParameters(uint32_t, uint32_t, uint32_t);
+	uint32_t RoundTDBytes(uint32_t) const;
+	uint32_t TDBytesLimit(void) const;
+	void AdaptTDBytes(size_t);
+	uint8_t QoSClass(void) const;
+	bool HasPriorityWork(void) const;
 	bool checkOwnership(GenericUSBXHCI*, ringStruct*);
 	void release(void);
 	void nuke(void);
@@ -71,20 +127,21 @@ struct XHCIAsyncTD
 	uint16_t numTDsThisTransaction;	// 0x32
 	uint32_t mystery;	// 0x34
 	uint32_t shortfall;	// 0x38
-	uint16_t maxNumPagesInTD;	// 0x3C
+	uint16_t numTRBsInTD;	// 0x3C - originally maxNumPagesInTD
 	bool haveImmediateData;	// 0x3E
 	bool finalTDInTransaction;	// 0x3F
 	uint8_t immediateData[8];	// 0x40
 	uint16_t streamId;	// 0x48
 	int16_t lastTrbIndex;	// 0x4A
 	bool absoluteShortfall;	// Added
+	bool lastTDInSubTransaction;	// Added
+	size_t subTransactionOffset;	// Added
+	uint64_t queuedTime;	// Added
 	XHCIAsyncEndpoint* provider;	// 0x50
-	XHCIAsyncTD* next;	// 0x58
+	uint16_t index;	// originally next
 						// sizeof 0x60
 
-	static XHCIAsyncTD* ForEndpoint(XHCIAsyncEndpoint*);
 	void reinit(void);
-	void release(void);
 };
 
 #endif
@@ -122,10 +122,16 @@ int32_t CLASS::WaitForCMD(TRBStruct* trb, int32_t trbType, TRBCallback callback)
 		return ret;
 	WaitForChangeEvent<int32_t>(&ret, -1);
 	/*
-	 * Note: Scoop up stop TRBs
+	 * Note: Scoop up stop TRBs.  These arrive on the
+	 *   interrupter the stopped TRB was targeted at, whose
+	 *   filter may not have run yet, so drain those first.
 	 */
 	if (trbType == XHCI_TRB_TYPE_STOP_EP)
-		PollForCMDCompletions(0);
+		for (int32_t interrupter = 0; interrupter < _numInterrupters; ++interrupter) {
+			if (interrupter)
+				DrainEventRing(interrupter);
+			PollForCMDCompletions(interrupter);
+		}
 	if (ret != -1)
 		return ret;
 	IOLog("%s: Timeout waiting for command completion (opcode %#x), 100ms\n", __FUNCTION__, static_cast<uint32_t>(trbType));
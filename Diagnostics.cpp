@@ -7,6 +7,7 @@
 //
 
 #include "GenericUSBXHCI.h"
+#include "Async.h"
 #include "XHCITypes.h"
 #include <IOKit/IOFilterInterruptEventSource.h>
 #include <libkern/OSKextLib.h>
@@ -68,6 +69,20 @@ char const* stringForSpeed(uint32_t speed)
 	return "Unknown";
 }
 
+static
+char const* stringForQoSClass(uint8_t qosClass)
+{
+	switch (qosClass) {
+		case kQoSClassControl:
+			return "Control";
+		case kQoSClassInterrupt:
+			return "Interrupt";
+		case kQoSClassBulk:
+			return "Bulk";
+	}
+	return "Unknown";
+}
+
 static
 char const* stringForPIC(uint32_t pic)
 {
@@ -248,7 +263,7 @@ void printDiagCounters(PrintSink* pSink, int32_t const* pDiagCounters)
 	if (pDiagCounters[DIAGCTR_RESUME])
 		pSink->print("# Restore Errors %u\n", pDiagCounters[DIAGCTR_RESUME]);
 	if (pDiagCounters[DIAGCTR_BNCEOVRFLW])
-		pSink->print("# Event Queue Overflows %u\n", pDiagCounters[DIAGCTR_BNCEOVRFLW]);
+		pSink->print("# Event Queue Full Stalls %u\n", pDiagCounters[DIAGCTR_BNCEOVRFLW]);
 	if (pDiagCounters[DIAGCTR_CMDERR])
 		pSink->print("# Spurious Command Completion Events %u\n", pDiagCounters[DIAGCTR_CMDERR]);
 	if (pDiagCounters[DIAGCTR_XFERERR])
@@ -263,6 +278,26 @@ void printDiagCounters(PrintSink* pSink, int32_t const* pDiagCounters)
 		pSink->print("# Short Transfers with Success Code %u\n", pDiagCounters[DIAGCTR_SHORTSUCCESS]);
 	if (pDiagCounters[DIAGCTR_BADDOORBELL])
 		pSink->print("# Invalid Doorbell Rings %u\n", pDiagCounters[DIAGCTR_BADDOORBELL]);
+	if (pDiagCounters[DIAGCTR_RINGRESIZE])
+		pSink->print("# Transfer Ring Resizes %u\n", pDiagCounters[DIAGCTR_RINGRESIZE]);
+	if (pDiagCounters[DIAGCTR_RINGINVARIANT])
+		pSink->print("# Transfer Ring Invariant Violations %u\n", pDiagCounters[DIAGCTR_RINGINVARIANT]);
+	if (pDiagCounters[DIAGCTR_DOORBELLSAVED])
+		pSink->print("# Doorbell Rings Avoided %u\n", pDiagCounters[DIAGCTR_DOORBELLSAVED]);
+	if (pDiagCounters[DIAGCTR_RELOCATIONS])
+		pSink->print("# TD Fragment Relocations %u\n", pDiagCounters[DIAGCTR_RELOCATIONS]);
+	if (pDiagCounters[DIAGCTR_EARLYLINKS])
+		pSink->print("# Early Link TRBs %u\n", pDiagCounters[DIAGCTR_EARLYLINKS]);
+	if (pDiagCounters[DIAGCTR_TDPOOLHIT])
+		pSink->print("# Transactions Served from TD Pool %u\n", pDiagCounters[DIAGCTR_TDPOOLHIT]);
+	if (pDiagCounters[DIAGCTR_TDPOOLMISS])
+		pSink->print("# Transactions that Grew TD Pool %u\n", pDiagCounters[DIAGCTR_TDPOOLMISS]);
+	if (pDiagCounters[DIAGCTR_TDBYTESADAPT])
+		pSink->print("# TD Size Adjustments %u\n", pDiagCounters[DIAGCTR_TDBYTESADAPT]);
+	if (pDiagCounters[DIAGCTR_FLUSHFAST])
+		pSink->print("# Short Transactions Flushed without Commands %u\n", pDiagCounters[DIAGCTR_FLUSHFAST]);
+	if (pDiagCounters[DIAGCTR_FLUSHSLOW])
+		pSink->print("# Short Transactions Flushed with Stop Endpoint %u\n", pDiagCounters[DIAGCTR_FLUSHSLOW]);
 }
 
 #pragma mark -
@@ -419,6 +454,8 @@ void CLASS::PrintRuntimeRegs(PrintSink* pSink)
 		pSink->print("Will Reset on Resume\n");
 	if (_filterInterruptSource && !_filterInterruptSource->getAutoDisable())
 		pSink->print("Using MSI\n");
+	if (_numInterrupters > 1)
+		pSink->print("Using %d Interrupters\n", _numInterrupters);
 	if ((_errataBits & kErrataIntelPantherPoint) && !(_errataBits & kErrataSWAssistedIdle))
 		pSink->print("Intel Doze Disabled\n");
 	if (_pUSBLegSup)
@@ -432,6 +469,24 @@ void CLASS::PrintRuntimeRegs(PrintSink* pSink)
 				 _interruptCounters[2],
 				 _interruptCounters[3]);
 	printDiagCounters(pSink, &_diagCounters[0]);
+	pSink->print("# Ring Slab Pages: In Use %u, High Water Mark %u, Fallback Allocations %u\n",
+				 _ringSlabStats.pagesInUse,
+				 _ringSlabStats.highWater,
+				 _ringSlabStats.fallbacks);
+	for (uint8_t qosClass = 0U; qosClass < kNumQoSClasses; ++qosClass) {
+		uint64_t average, max;
+		if (!_qos.latency[qosClass].transactions)
+			continue;
+		absolutetime_to_nanoseconds(_qos.latency[qosClass].total / _qos.latency[qosClass].transactions, &average);
+		absolutetime_to_nanoseconds(_qos.latency[qosClass].max, &max);
+		pSink->print("# %s Queueing Latency: Transactions %u, Average %llu us, Max %llu us\n",
+					 stringForQoSClass(qosClass),
+					 _qos.latency[qosClass].transactions,
+					 average / 1000ULL,
+					 max / 1000ULL);
+	}
+	if (_qos.bulkDeferrals)
+		pSink->print("# Bulk Scheduling Deferrals %u, Bulk In-Flight Limit %u\n", _qos.bulkDeferrals, _qos.bulkInFlightLimit);
 	if (_inTestMode)
 		pSink->print("Test Mode Active\n");
 	if (m_invalid_regspace)
@@ -500,6 +555,13 @@ void CLASS::PrintRuntimeRegs(PrintSink* pSink)
 					 Read32Reg(&irs->erstsz) & XHCI_ERSTS_MASK,
 					 v3 & 7U,
 					 test_bit(v3, 3));
+		if (i < _numInterrupters)
+			pSink->print("            moderation %u - %u ns, %u interrupts/s, %u.%02u events/interrupt\n",
+						 250U * _imod.minimum,
+						 250U * _imod.maximum,
+						 _eventRing[i].interruptsPerSecond,
+						 _eventRing[i].eventsPerInterrupt / 100U,
+						 _eventRing[i].eventsPerInterrupt % 100U);
 	}
 }
 
@@ -551,6 +613,7 @@ __attribute__((visibility("hidden")))
 void CLASS::PrintEndpoints(uint8_t slot, PrintSink* pSink)
 {
 	ContextStruct *pContext, *pEpContext;
+	ringStruct const* pRing;
 	uint32_t numEps, endpoint, epState, maxPSA;
 
 	if (!pSink)
@@ -585,6 +648,16 @@ void CLASS::PrintEndpoints(uint8_t slot, PrintSink* pSink)
 						 2U << maxPSA,
 						 test_bit(pEpContext->_e.dwEpCtx0, 15),
 						 test_bit(pEpContext->_e.dwEpCtx1, 7));
+		else if ((pRing = ConstSlotPtr(slot)->ringArrayForEndpoint[endpoint]) != 0 &&
+				 !pRing->isInactive())
+			pSink->print("  Transfer Ring %u Pages, %u TRBs, Enqueue %u, Dequeue %u, Cycle %u, Invariants %s\n",
+						 pRing->numPages,
+						 pRing->numTRBs,
+						 pRing->enqueueIndex,
+						 pRing->dequeueIndex,
+						 pRing->cycleState,
+						 (pRing->epType | CTRL_EP) == ISOC_IN_EP ? "N/A" :
+						 (CheckRingInvariants(pRing) ? "OK" : "Broken"));
 	}
 }
 
@@ -611,3 +684,49 @@ void CLASS::PrintRootHubPortBandwidth(PrintSink* pSink)
 		pSink->print("\n");
 	}
 }
+
+__attribute__((visibility("hidden")))
+void CLASS::PrintEndpointStats(PrintSink* pSink)
+{
+	SlotStruct const* pSlot;
+	ringStruct const* pRing;
+	XHCIAsyncEndpoint const* pAsyncEp;
+	uint32_t bucket;
+
+	if (!pSink)
+		pSink = const_cast<PrintSink*>(&IOLogSink);
+	for (uint8_t slot = 1U; slot <= _numSlots; ++slot) {
+		pSlot = ConstSlotPtr(slot);
+		if (pSlot->isInactive())
+			continue;
+		for (uint8_t endpoint = 1U; endpoint != kUSBMaxPipes; ++endpoint) {
+			pRing = pSlot->ringArrayForEndpoint[endpoint];
+			if (!pRing)
+				continue;
+			for (uint16_t streamId = 0U; streamId <= pSlot->lastStreamForEndpoint[endpoint]; ++streamId) {
+				pAsyncEp = pRing[streamId].asyncEndpoint;
+				if (!pAsyncEp || !pAsyncEp->stats.transactions)
+					continue;
+				pSink->print("Slot %u, Endpoint %u, Stream %u, Type %s\n",
+							 slot,
+							 endpoint,
+							 streamId,
+							 stringForEPType(pRing[streamId].epType));
+				pSink->print("  Transactions %u, Completed %u, Short %u, TDs Completed %u, Ring Full Stalls %u\n",
+							 pAsyncEp->stats.transactions,
+							 pAsyncEp->stats.completions,
+							 pAsyncEp->stats.shortTransactions,
+							 pAsyncEp->stats.tdsCompleted,
+							 pAsyncEp->stats.ringFullStalls);
+				pSink->print("  Bytes Requested %llu, Transferred %llu\n",
+							 pAsyncEp->stats.bytesRequested,
+							 pAsyncEp->stats.bytesTransferred);
+				pSink->print("  Latency (us)");
+				for (bucket = 0U; bucket != kAsyncLatencyBuckets; ++bucket)
+					if (pAsyncEp->stats.latency[bucket])
+						pSink->print(" %u+:%u", bucket ? 1U << bucket : 0U, pAsyncEp->stats.latency[bucket]);
+				pSink->print("\n");
+			}
+		}
+	}
+}
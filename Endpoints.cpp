@@ -94,7 +94,7 @@ IOReturn CLASS::CreateEndpoint(int32_t slot, int32_t endpoint, uint16_t maxPacke
 		IOLog("%s: slot %d ep %d maxPacketSize %u interval %d epType %d maxStream %u maxBurst %u multiple %u\n", __FUNCTION__,
 			  slot, endpoint, maxPacketSize, intervalExponent, endpointType, maxStream, maxBurst, multiple);
 	_pIsochEndpoint = (endpointType | CTRL_EP) == ISOC_IN_EP ? static_cast<GenericUSBXHCIIsochEP*>(pIsochEndpoint) : 0;
-	numPagesInRingQueue = _pIsochEndpoint ? _pIsochEndpoint->numPagesInRingQueue : 1U;
+	numPagesInRingQueue = _pIsochEndpoint ? _pIsochEndpoint->numPagesInRingQueue : RingPagesForEndpoint(slot, endpointType, maxBurst);
 	/*
 	 * Note: For Isoch, this already checked in CreateIsochEndpoint
 	 */
@@ -308,6 +308,7 @@ bool CLASS::checkEPForTimeOuts(int32_t slot, int32_t endpoint, uint32_t streamId
 {
 	ringStruct* pRing;
 	XHCIAsyncEndpoint* pAsyncEp;
+	XHCIAsyncTD* pAsyncTd;
 	ContextStruct* pEpContext;
 	uint32_t ndto;
 	uint16_t dq;
@@ -325,7 +326,7 @@ bool CLASS::checkEPForTimeOuts(int32_t slot, int32_t endpoint, uint32_t streamId
 	 * Note: Isoch Endpoints are ruled out in CheckSlotForTimeouts
 	 */
 	pAsyncEp = pRing->asyncEndpoint;
-	if (!pAsyncEp || !pAsyncEp->scheduledHead)
+	if (!pAsyncEp || !(pAsyncTd = pAsyncEp->PeekTD(&pAsyncEp->scheduledTDs)))
 		return false;
 	if (abortAll)
 		pEpContext = GetSlotContext(slot, endpoint);
@@ -341,8 +342,8 @@ bool CLASS::checkEPForTimeOuts(int32_t slot, int32_t endpoint, uint32_t streamId
 		}
 	} else
 		return false;
-	if (pAsyncEp->scheduledHead->command)
-		ndto = pAsyncEp->scheduledHead->command->GetNoDataTimeout();
+	if (pAsyncTd->command)
+		ndto = pAsyncTd->command->GetNoDataTimeout();
 	else
 		ndto = 0U;
 	ClearStopTDs(slot, endpoint);
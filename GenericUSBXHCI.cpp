@@ -8,6 +8,7 @@
  */
 
 #include "GenericUSBXHCI.h"
+#include "Async.h"
 #include "GenericUSBXHCIUserClient.h"
 #include <IOKit/IOTimerEventSource.h>
 #include <libkern/version.h>
@@ -279,12 +280,32 @@ void ListOptions(PrintSink* pSink)
 	pSink->print("  -gux_nosleep: Disable XHCI suspend/resume method, and use reset-on-resume (forces USB Bus re-enumeration)\n");
 	pSink->print("  -gux_nomsi: Disable MSI and use pin interrupt (if available)\n");
 	pSink->print("  -gux_defer_usb2: For Intel Series 7/C210 or Intel Series 8/C220 - Switch USB 2.0 protocol ports from xHC to EHC\n");
-	pSink->print("  gux_log=n: Set logging level to n.  Available levels 1 - normal, 2 - higher\n\n");
+	pSink->print("  gux_log=n: Set logging level to n.  Available levels 1 - normal, 2 - higher, 3 - also check transfer ring invariants\n\n");
 	pSink->print("Properties in Info.plist personality\n");
 	pSink->print("  DisableUAS (boolean) - disables USB Attached SCSI\n");
 	pSink->print("  ASMediaEDLTAFix (boolean) - enables workaround for ASM 1042 EDTLA bug\n");
 	pSink->print("  UseLegacyInt (boolean) - override selection of pin interrupt or MSI\n");
 	pSink->print("  IntelDoze (boolean) - For Intel Series 7/C210 only - enables use of Doze mode\n");
+	pSink->print("  RingPagesControl, RingPagesInterrupt, RingPagesBulk, RingPagesBulkSS (number) - override transfer ring size in pages (1 - %u)\n",
+				 kMaxTransferRingPages);
+	pSink->print("  TDPoolRetain (number) - transfer descriptors preallocated and kept per endpoint when idle (up to %u)\n",
+				 kAsyncMaxTDs);
+	pSink->print("  MaxTDBytes (number) - fixed transfer descriptor size in bytes (%u - %u), instead of sizing by request pattern\n",
+				 static_cast<uint32_t>(PAGE_SIZE), kAsyncMaxAdaptiveTDBytes);
+	pSink->print("  EventRingSegments (number) - pages in each event ring, limited by ERST Max of xHC (1 - %u)\n",
+				 kMaxEventRingSegments);
+	pSink->print("  EventQueueEntries (number) - events buffered between primary interrupt and workloop, at least twice the event ring (default %u, up to %u)\n",
+				 kDefaultEventQueueEntries, UINT16_MAX);
+	pSink->print("  EventBatchSize (number) - events handled per pass of the workloop handler (default %u, 1 - %u)\n",
+				 kDefaultEventBatchSize, UINT16_MAX);
+	pSink->print("  Interrupters (number) - event rings to use if the xHC has enough MSI vectors, isoch on the 2nd, bulk on the 3rd (1 - %u)\n",
+				 kMaxActiveInterrupters);
+	pSink->print("  IMODMinimum, IMODMaximum (number) - bounds in us for interrupt moderation, equal means fixed (default %u - %u, up to %u)\n",
+				 kIMODDefaultMinimum, kIMODDefaultMaximum, kIMODMaxMicroseconds);
+	pSink->print("  IMODTargetRate (number) - interrupts per second above which moderation is raised (default %u)\n",
+				 kIMODDefaultTargetRate);
+	pSink->print("  BulkInFlightLimit (number) - bytes a bulk endpoint may have scheduled while control or interrupt OUT work is pending (default %u, 0 - no limit)\n",
+				 kQoSDefaultBulkInFlight);
 }
 
 }
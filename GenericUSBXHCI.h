@@ -18,7 +18,32 @@
 #define kMaxExternalHubPorts 15U
 #define kMaxRootPorts 30U
 #define kMaxStreamsAllowed 256U
-#define kMaxActiveInterrupters 1
+#define kMaxActiveInterrupters 3
+#define kInterrupterPrimary 0U		// commands, port status, control and interrupt endpoints
+#define kInterrupterIsoch 1U
+#define kInterrupterBulk 2U
+#define kMaxTransferRingPages 16U
+#define kTransferRingIdleTicks 30U
+#define kRingSlabPages 16U
+#define kRingBoundaryPages 16U		// 64KB, which ring segments may not cross
+#define kMaxRingSlabs 8U
+#define kTimeoutWheelBuckets 64U
+#define kTimeoutWheelShift 10U
+#define kMaxEventRingSegments 16U
+#define kDefaultEventRingSegments 4U
+#define kDefaultEventQueueEntries 5120U
+#define kDefaultEventBatchSize 64U
+#define kIMODInitialInterval 160U		// 250 ns units, 40 us
+#define kIMODDefaultMinimum 1U			// us
+#define kIMODDefaultMaximum 200U		// us
+#define kIMODMaxMicroseconds (XHCI_IMOD_IVAL_MASK / 4U)
+#define kIMODDefaultTargetRate 8000U	// interrupts per second
+#define kIMODSampleNanoseconds 10000000U
+#define kQoSClassControl 0U
+#define kQoSClassInterrupt 1U
+#define kQoSClassBulk 2U
+#define kNumQoSClasses 3U
+#define kQoSDefaultBulkInFlight (1U << 20)
 
 #include <IOKit/usb/IOUSBControllerV3.h>
 #include "XHCIRegs.h"
@@ -30,6 +55,22 @@
 class IOInterruptEventSource;
 class IOFilterInterruptEventSource;
 
+#define kSegmentCacheEntries 16U
+
+/*
+ * Physical segments of a TD, fetched from genIOVMSegments
+ *   by CountTRBsInTD, or in batches by _createTransfer
+ */
+struct SegmentCache
+{
+	IODMACommand* command;	// owner of cached segments
+	UInt64 cursorOffset;	// offset in buffer of segments[cursor]
+	UInt32 cursor;
+	UInt32 numSegments;
+	UInt32 maxSegments;
+	IODMACommand::Segment64* segments;
+};
+
 class EXPORT GenericUSBXHCI : public IOUSBControllerV3
 {
 	OSDeclareFinalStructors(GenericUSBXHCI);
@@ -75,6 +116,9 @@ private:
 									// offset 0x2F0
 	uint8_t _numSlots;				// offset 0x2F8 - originally uint16_t
 	int32_t _baseInterruptIndex;	// Added
+	int32_t _numInterrupters;		// Added - from personality, then limited by xHC and MSI vectors
+	IOFilterInterruptEventSource* _secondaryInterruptSources[kMaxActiveInterrupters - 1];
+									// Added - one per MSI vector after _filterInterruptSource
 
 	/*
 	 * DCBAA
@@ -252,6 +296,49 @@ private:
 									// align 5-byte
 	Completer _completer;			// Added
 	IOEventSource* _eventSource;	// Added
+	struct {
+		uint8_t control;
+		uint8_t interrupt;
+		uint8_t bulk;
+		uint8_t bulkSS;
+	} _ringPagesOverride;			// Added - from personality, 0 means use policy
+	struct {
+		IOBufferMemoryDescriptor* md;
+		uint8_t* ptr;
+		uint64_t physAddr;
+		uint32_t freeMap;			// bit set for each free page
+	} _ringSlabs[kMaxRingSlabs];	// Added
+	struct {
+		uint16_t pagesInUse;
+		uint16_t highWater;
+		uint32_t fallbacks;
+	} _ringSlabStats;				// Added
+	uint32_t _tdPoolRetain;			// Added - from personality, 0 means size from ring
+	uint32_t _tdBytesOverride;		// Added - from personality, 0 means adaptive
+	SegmentCache _tdSegmentCache;	// Added - segments of the head TD being scheduled, shared by async endpoints
+	uint16_t _eventRingSegments;	// Added - from personality, limited by _erstMax
+	uint16_t _eventQueueEntries;	// Added - from personality, bounce queue size
+	uint16_t _eventBatchSize;		// Added - from personality, events per PollEventRing2
+	struct {
+		XHCIAsyncEndpoint* buckets[kTimeoutWheelBuckets];
+		uint32_t lastFrame;			// frame of last expiry pass
+	} _timeoutWheel;				// Added
+	struct {
+		uint16_t minimum;			// from personality, 250 ns units
+		uint16_t maximum;			// from personality, 250 ns units, equal to minimum means fixed
+		uint32_t targetRate;		// from personality, interrupts per second
+		uint64_t samplePeriod;		// absolute time
+	} _imod;						// Added
+	struct {
+		uint32_t bulkInFlightLimit;	// from personality, bytes, 0 means unlimited
+		uint32_t pendingPriorityTDs;	// outstanding on control and interrupt OUT endpoints
+		uint32_t bulkDeferrals;
+		struct {
+			uint32_t transactions;
+			uint64_t total;			// absolute time
+			uint64_t max;			// absolute time
+		} latency[kNumQoSClasses];	// queued to scheduled
+	} _qos;							// Added
 
 	char _muxName[kMaxExternalHubPorts * 5U];	// offset 0x23B34
 									// sizeof 0x23B80
@@ -434,6 +521,7 @@ public:
 	void PrintSlots(PrintSink* = 0);
 	void PrintEndpoints(uint8_t, PrintSink* = 0);
 	void PrintRootHubPortBandwidth(PrintSink* = 0);
+	void PrintEndpointStats(PrintSink* = 0);
 	static void PrintContext(ContextStruct const*) {}
 	static void PrintEventTRB(TRBStruct const*, int32_t, bool, ringStruct const*) {}
 	/*
@@ -473,6 +561,11 @@ public:
 	uint16_t GetCompanionRootPort(uint8_t, uint16_t);
 	bool IsStillConnectedAndEnabled(int32_t);
 	void CheckSlotForTimeouts(int32_t, uint32_t, bool);
+	void ArmTimeoutWheel(XHCIAsyncEndpoint*, uint32_t);
+	void DisarmTimeoutWheel(XHCIAsyncEndpoint*);
+	void ExpireTimeoutWheel(uint32_t);
+	void CheckAsyncEndpointTimeouts(XHCIAsyncEndpoint*, uint32_t);
+	bool VisitTimeoutWheelEntry(XHCIAsyncEndpoint*, uint32_t);
 #ifdef DEBOUNCING
 	int32_t FindSlotFromPort(uint16_t);
 	IOReturn HandlePortDebouncing(uint16_t*, uint16_t*, uint16_t, uint16_t, uint8_t);
@@ -545,9 +638,13 @@ public:
 	static IOReturn AddDummyCommand(ringStruct*, IOUSBCommand*);
 	IOReturn _createTransfer(void*, bool, uint32_t, uint32_t, size_t, bool, bool, uint32_t*,
 							 uint32_t*, int16_t*);
+	template <bool, bool> IOReturn _buildTransfer(void*, uint32_t, uint32_t, size_t, bool, bool, uint32_t*,
+												  uint32_t*, int16_t*);
 	static TRBStruct* GetNextTRB(ringStruct*, void*, TRBStruct**, bool);
+	static bool PlaceEarlyLink(ringStruct*, uint32_t, bool);
 	static void CloseFragment(ringStruct*, TRBStruct*, uint32_t);
-	static IOReturn GenerateNextPhysicalSegment(TRBStruct*, uint32_t*, size_t, IODMACommand*);
+	static IOReturn GenerateNextPhysicalSegment(TRBStruct*, uint32_t*, size_t, IODMACommand*, SegmentCache*);
+	static uint16_t CountTRBsInTD(SegmentCache*, IODMACommand*, size_t, uint32_t);
 	static void PutBackTRB(ringStruct*, TRBStruct*);
 	void AddIsocFramesToSchedule(GenericUSBXHCIIsochEP*);
 	void AddIsocFramesToSchedule_stage2(GenericUSBXHCIIsochEP*, uint16_t, uint64_t*, bool*);
@@ -559,8 +656,14 @@ public:
 	ringStruct* CreateRing(int32_t, int32_t, uint32_t);
 	ringStruct* GetRing(int32_t, int32_t, uint32_t);
 	IOReturn AllocRing(ringStruct*, int32_t);
+	uint32_t RingPagesForEndpoint(int32_t, int32_t, uint32_t);
 	void InitPreallocedRing(ringStruct*);
-	static void DeallocRing(ringStruct*);
+	void DeallocRing(ringStruct*);
+	IOReturn ResizeRing(ringStruct*, int32_t);
+	void FreeRetiredRing(ringStruct*);
+	IOReturn AllocRingPages(int32_t, IOBufferMemoryDescriptor**, TRBStruct**, uint64_t*);
+	void FreeRingPages(IOBufferMemoryDescriptor*, TRBStruct*, int32_t);
+	void FinalizeRingSlabs(void);
 	static int32_t CountRingToED(ringStruct const*, int32_t, uint32_t*);
 	void ParkRing(uint8_t, uint8_t);
 	IOReturn ReturnAllTransfersAndReinitRing(int32_t, int32_t, uint32_t);
@@ -569,6 +672,7 @@ public:
 	static bool CanTDFragmentFit(ringStruct const*, uint32_t);
 	static uint32_t FreeSlotsOnRing(ringStruct const*);
 	static uint16_t NextTransferDQ(ringStruct const*, int32_t);
+	static bool CheckRingInvariants(ringStruct const*);
 	/*
 	 * Non-standard XHCI Extensions
 	 */
@@ -618,18 +722,25 @@ public:
 	void FilterInterrupt(IOFilterInterruptEventSource*);
 	bool preFilterEventRing(IOFilterInterruptEventSource*, int32_t);
 	void postFilterEventRing(int32_t);
+	void ModerateInterrupter(int32_t, uint32_t);
 	bool FilterEventRing(int32_t, bool*);
+	bool BounceQueueFull(EventRingStruct const*);
 	bool PollEventRing2(int32_t);
 	void PollForCMDCompletions(int32_t);
+	void DrainEventRing(int32_t);
 	bool DoStopCompletion(TRBStruct const*);
 	bool processTransferEvent(TRBStruct const*);
 	bool processTransferEvent2(TRBStruct const*, int32_t);
 	IOReturn InitAnEventRing(int32_t);
+	IOReturn InitSecondaryInterrupters(void);
+	void FinalizeSecondaryInterrupters(void);
+	uint32_t InterrupterForEndpoint(uint8_t) const;
 	void InitEventRing(int32_t, bool);
 	void FinalizeAnEventRing(int32_t);
 	void SaveAnInterrupter(int32_t);
 	void RestoreAnInterrupter(int32_t);
 	static int findInterruptIndex(IOService*, bool);
+	static int countInterruptVectors(IOService*, int);
 	/*
 	 * Feature Methods
 	 */
@@ -107,6 +107,13 @@ IOReturn GatedPrintRootHubPortBandwidth(OSObject* owner, void* pSink, void*, voi
 	return kIOReturnSuccess;
 }
 
+static
+IOReturn GatedPrintEndpointStats(OSObject* owner, void* pSink, void*, void*, void*)
+{
+	static_cast<GenericUSBXHCI*>(owner)->PrintEndpointStats(static_cast<PrintSink*>(pSink));
+	return kIOReturnSuccess;
+}
+
 IOReturn GenericUSBXHCIUserClient::clientClose(void)
 {
     if (!terminate())
@@ -195,6 +202,20 @@ IOReturn GenericUSBXHCIUserClient::clientMemoryForType(UInt32 type, IOOptionBits
 			*memory = md;
 			ret = kIOReturnSuccess;
 			break;
+		case kGUXEndpointStatsDump:
+			provider = OSDynamicCast(GenericUSBXHCI, getProvider());
+			if (!provider)
+				break;
+			ret = MakeMemoryAndPrintSink(4U * PAGE_SIZE, &md, &kernelMap, &sink);
+			if (ret != kIOReturnSuccess)
+				break;
+			provider->getWorkLoop()->runAction(GatedPrintEndpointStats, provider, &sink);
+			kernelMap->release();
+			md->complete();
+			*options = kIOMapReadOnly;
+			*memory = md;
+			ret = kIOReturnSuccess;
+			break;
 		case kGUXOptionsDump:
 			ret = MakeMemoryAndPrintSink(PAGE_SIZE, &md, &kernelMap, &sink);
 			if (ret != kIOReturnSuccess)
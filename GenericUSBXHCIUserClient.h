@@ -21,6 +21,7 @@
 #define kGUXEndpointsDump 4U
 #define kGUXBandwidthDump 5U
 #define kGUXOptionsDump 6U
+#define kGUXEndpointStatsDump 7U
 
 class EXPORT GenericUSBXHCIUserClient : public IOUserClient
 {
@@ -0,0 +1,582 @@
+//
+//  AsyncTests.cpp
+//  GenericUSBXHCI
+//
+//  Async endpoints: TD queues and pool, TD creation and scheduling,
+//  and transactions run end to end through the fake xHC.
+//
+
+#include "Harness.h"
+
+#define kBulkOutEndpoint 2
+#define kBulkInEndpoint 3
+
+HOST_TEST(TDQueueIsFIFOAcrossCounterWrap)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 1, 512U, BULK_OUT_EP);
+	XHCIAsyncTD* pTds[kAsyncTDsPerChunk];
+	uint32_t i;
+
+	CHECK(pAsyncEp);
+	CHECK(pAsyncEp->tdPoolSize >= kAsyncTDsPerChunk);
+	/*
+	 * Note: Counters are free-running, so start
+	 *   just short of wrapping around
+	 */
+	pAsyncEp->queuedTDs.head = pAsyncEp->queuedTDs.tail = UINT32_MAX - 5U;
+	for (i = 0U; i < kAsyncTDsPerChunk; ++i) {
+		pTds[i] = pAsyncEp->GetTDFromFreeQueue(false);
+		CHECK(pTds[i]);
+		pAsyncEp->PutTD(&pAsyncEp->queuedTDs, pTds[i]);
+	}
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs) == kAsyncTDsPerChunk);
+	CHECK(pAsyncEp->PeekTD(&pAsyncEp->queuedTDs) == pTds[0]);
+	for (i = 0U; i < kAsyncTDsPerChunk; ++i)
+		CHECK(pAsyncEp->GetTD(&pAsyncEp->queuedTDs) == pTds[i]);
+	CHECK(!pAsyncEp->GetTD(&pAsyncEp->queuedTDs));
+	/*
+	 * Note: PutTDAtHead puts back in front
+	 */
+	pAsyncEp->PutTD(&pAsyncEp->queuedTDs, pTds[1]);
+	pAsyncEp->PutTDAtHead(&pAsyncEp->queuedTDs, pTds[0]);
+	CHECK(pAsyncEp->GetTD(&pAsyncEp->queuedTDs) == pTds[0]);
+	CHECK(pAsyncEp->GetTD(&pAsyncEp->queuedTDs) == pTds[1]);
+	for (i = 0U; i < kAsyncTDsPerChunk; ++i)
+		pAsyncEp->PutTD(&pAsyncEp->freeTDs, pTds[i]);
+	DeleteController(hc);
+}
+
+/*
+ * Note: Shuffles TDs between the four queues at random, checking
+ *   that none is lost or duplicated and each queue stays FIFO.
+ */
+HOST_TEST(TDQueuesConserveTDs)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 1, 512U, BULK_OUT_EP);
+	XHCIAsyncTDQueue* queues[4];
+	uint32_t expectedHead[4], seen[kAsyncTDsPerChunk * 4U];
+	XHCIAsyncTD* pTd;
+	uint32_t i, from, to, total, random = 12345U;
+
+	CHECK(pAsyncEp);
+	queues[0] = &pAsyncEp->freeTDs;
+	queues[1] = &pAsyncEp->queuedTDs;
+	queues[2] = &pAsyncEp->scheduledTDs;
+	queues[3] = &pAsyncEp->doneTDs;
+	CHECK(pAsyncEp->tdPoolSize <= kAsyncTDsPerChunk * 4U);
+	for (i = 0U; i < 100000U; ++i) {
+		random = random * 1103515245U + 12345U;
+		from = (random >> 8) & 3U;
+		to = (random >> 12) & 3U;
+		if (from == to || from == 0U)
+			continue;
+		/*
+		 * Note: Moves the head of one queue to the tail of another,
+		 *   and the next head must be what was behind it
+		 */
+		pTd = pAsyncEp->PeekTD(queues[from]);
+		if (!pTd) {
+			pTd = pAsyncEp->GetTD(&pAsyncEp->freeTDs);
+			CHECK(pTd);
+			pAsyncEp->PutTD(queues[from], pTd);
+			continue;
+		}
+		expectedHead[from] = XHCIAsyncEndpoint::NumTDs(queues[from]) > 1U ?
+			queues[from]->slots[(queues[from]->head + 1U) & (pAsyncEp->tdPoolSize - 1U)] : UINT32_MAX;
+		CHECK(pAsyncEp->GetTD(queues[from]) == pTd);
+		pAsyncEp->PutTD(queues[to], pTd);
+		if (expectedHead[from] != UINT32_MAX)
+			CHECK(pAsyncEp->PeekTD(queues[from])->index == expectedHead[from]);
+	}
+	bzero(&seen[0], sizeof seen);
+	for (total = 0U, from = 0U; from < 4U; ++from)
+		for (i = queues[from]->head; i != queues[from]->tail; ++i, ++total) {
+			pTd = pAsyncEp->TDWithIndex(queues[from]->slots[i & (pAsyncEp->tdPoolSize - 1U)]);
+			CHECK(!seen[pTd->index]);
+			seen[pTd->index] = 1U;
+		}
+	CHECK(total == pAsyncEp->tdPoolSize);
+	while ((pTd = pAsyncEp->GetTD(&pAsyncEp->scheduledTDs)))
+		pAsyncEp->PutTD(&pAsyncEp->freeTDs, pTd);
+	while ((pTd = pAsyncEp->GetTD(&pAsyncEp->doneTDs)))
+		pAsyncEp->PutTD(&pAsyncEp->freeTDs, pTd);
+	while ((pTd = pAsyncEp->GetTD(&pAsyncEp->queuedTDs)))
+		pAsyncEp->PutTD(&pAsyncEp->freeTDs, pTd);
+	DeleteController(hc);
+}
+
+HOST_TEST(BulkTransactionCompletesThroughXHC)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 4, 512U, BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(512U * 1024U);
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+
+	CHECK(pAsyncEp);
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(gFakes.doorbells == 1U);
+	CHECK(GenericUSBXHCI::CheckRingInvariants(pAsyncEp->pRing));
+	while (XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs)) {
+		CHECK(FakeXHCRun(hc, pAsyncEp->pRing, &xhc));
+		CHECK(!xhc.corrupt);
+	}
+	CHECK(log.count == 1U);
+	CHECK(log.lastStatus == kIOReturnSuccess);
+	CHECK(log.lastRemaining == 0U);
+	CHECK(pAsyncEp->stats.bytesTransferred == 512U * 1024U);
+	CHECK(!XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs));
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->freeTDs) == pAsyncEp->tdPoolSize);
+	CHECK(pAsyncEp->pRing->dequeueIndex == pAsyncEp->pRing->enqueueIndex);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: Many short transactions take the ring through
+ *   several wraps, the xHC keeping pace.
+ */
+HOST_TEST(RingWrapsUnderSteadyTraffic)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 1, 512U, BULK_OUT_EP);
+	IOUSBCommand* command = NewCommand(3U * PAGE_SIZE);
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+	uint32_t i;
+
+	CHECK(pAsyncEp);
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBOut;
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	for (i = 0U; i < 1000U; ++i) {
+		CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+		CHECK(GenericUSBXHCI::CheckRingInvariants(pAsyncEp->pRing));
+		FakeXHCRun(hc, pAsyncEp->pRing, &xhc);
+		CHECK(!xhc.corrupt);
+	}
+	CHECK(log.count == 1000U && !log.failures);
+	CHECK(xhc.trbsConsumed > 10U * pAsyncEp->pRing->numTRBs);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: 512 byte segments make the head TD too long for an empty
+ *   one-page ring, so it has to grow before anything is scheduled.
+ */
+HOST_TEST(EmptyRingGrowsForTDThatDoesNotFit)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(kAsyncMaxFragmentSize, 512U);
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+
+	CHECK(pAsyncEp);
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(hc->_diagCounters[DIAGCTR_RINGRESIZE] == 1);
+	CHECK(pAsyncEp->pRing->numPages == 2U);
+	CHECK(gFakes.doorbells == 1U);
+	while (XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs)) {
+		CHECK(FakeXHCRun(hc, pAsyncEp->pRing, &xhc));
+		CHECK(!xhc.corrupt);
+	}
+	CHECK(log.count == 1U && !log.failures);
+	CHECK(!pAsyncEp->pRing->retiredMd);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: Stream rings don't grow, so the transaction fails
+ *   rather than sit on the queue for good.
+ */
+HOST_TEST(StreamRingFailsTDThatCannotFit)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP, 2U);
+	IOUSBCommand* command = NewCommand(kAsyncMaxFragmentSize, 512U);
+	CompletionLog log = { 0 };
+
+	CHECK(pAsyncEp);
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	hc->CreateTransfer(command, 1U);
+	hc->_completer.Flush();
+	CHECK(log.count == 1U);
+	CHECK(log.lastStatus == kIOReturnNoResources);
+	CHECK(log.lastRemaining == kAsyncMaxFragmentSize);
+	CHECK(!gFakes.doorbells);
+	CHECK(!XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs));
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->freeTDs) == pAsyncEp->tdPoolSize);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+HOST_TEST(SchedulingPassRingsDoorbellOnce)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 4, 512U, BULK_OUT_EP);
+	IOUSBCommand* command = NewCommand(4U * PAGE_SIZE);
+	uint32_t i;
+
+	CHECK(pAsyncEp);
+	command->endpoint = 1U;
+	command->direction = kUSBOut;
+	for (i = 0U; i < 5U; ++i)
+		CHECK(pAsyncEp->CreateTDs(command, 0U, 0U, 0xFFU, 0) == kIOReturnSuccess);
+	CHECK(pAsyncEp->ScheduleTDs());
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs) == 5U);
+	CHECK(gFakes.doorbells == 1U);
+	CHECK(hc->_diagCounters[DIAGCTR_DOORBELLSAVED] == 4);
+	/*
+	 * Note: While a return is in progress the doorbell is
+	 *   left for RetireTDs
+	 */
+	CHECK(pAsyncEp->CreateTDs(command, 0U, 0U, 0xFFU, 0) == kIOReturnSuccess);
+	pAsyncEp->pRing->returnInProgress = true;
+	CHECK(!pAsyncEp->ScheduleTDs());
+	CHECK(pAsyncEp->pRing->needsDoorbell);
+	CHECK(gFakes.doorbells == 1U);
+	pAsyncEp->pRing->returnInProgress = false;
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+HOST_TEST(TDPoolGrowsKeepingQueueOrder)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 1, 512U, BULK_OUT_EP);
+	XHCIAsyncTD* pTds[10];
+	uint32_t i, baseSize;
+
+	CHECK(pAsyncEp);
+	baseSize = pAsyncEp->tdPoolSize;
+	CHECK(baseSize == pAsyncEp->tdPoolBaseSize);
+	pAsyncEp->queuedTDs.head = pAsyncEp->queuedTDs.tail = UINT32_MAX - 3U;
+	for (i = 0U; i < 10U; ++i) {
+		pTds[i] = pAsyncEp->GetTDFromFreeQueue(false);
+		CHECK(pTds[i]);
+		pAsyncEp->PutTD(&pAsyncEp->queuedTDs, pTds[i]);
+	}
+	CHECK(pAsyncEp->ReserveTDs(baseSize) == kIOReturnSuccess);
+	CHECK(hc->_diagCounters[DIAGCTR_TDPOOLMISS] == 1);
+	CHECK(pAsyncEp->tdPoolSize == 2U * baseSize);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->freeTDs) == 2U * baseSize - 10U);
+	/*
+	 * Note: Shrinking needs every TD back on the free queue
+	 */
+	pAsyncEp->TrimTDPool();
+	CHECK(pAsyncEp->tdPoolSize == 2U * baseSize);
+	for (i = 0U; i < 10U; ++i)
+		CHECK(pAsyncEp->GetTD(&pAsyncEp->queuedTDs) == pTds[i]);
+	for (i = 0U; i < 10U; ++i)
+		pAsyncEp->PutTD(&pAsyncEp->freeTDs, pTds[i]);
+	pAsyncEp->TrimTDPool();
+	CHECK(pAsyncEp->tdPoolSize == baseSize);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->freeTDs) == baseSize);
+	CHECK(pAsyncEp->ReserveTDs(baseSize) == kIOReturnSuccess);
+	CHECK(hc->_diagCounters[DIAGCTR_TDPOOLHIT] == 1);
+	DeleteController(hc);
+}
+
+/*
+ * Note: A transaction of more TDs than the pool holds
+ *   grows it before any TD is queued
+ */
+HOST_TEST(LargeTransactionReservesTDs)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 16, 512U, BULK_IN_EP);
+	IOUSBCommand* command;
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+	uint32_t numTDs;
+
+	CHECK(pAsyncEp);
+	numTDs = 2U * pAsyncEp->tdPoolSize;
+	command = NewCommand(numTDs * pAsyncEp->maxTDBytes, 64U * 1024U);
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	hc->_tdBytesOverride = pAsyncEp->maxTDBytes;
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(pAsyncEp->tdPoolSize >= numTDs);
+	while (!log.count) {
+		CHECK(FakeXHCRun(hc, pAsyncEp->pRing, &xhc));
+		CHECK(!xhc.corrupt);
+	}
+	CHECK(!log.failures && !log.lastRemaining);
+	pAsyncEp->TrimTDPool();
+	CHECK(pAsyncEp->tdPoolSize == pAsyncEp->tdPoolBaseSize);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: A transaction may use every TD but one, so its
+ *   16 bit TD count never wraps to 0
+ */
+HOST_TEST(TransactionTDCountFitsIn16Bits)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 16, 512U, BULK_IN_EP);
+	IOUSBCommand* commands[2] = { NewCommand(kAsyncMaxTDs * 16U, 64U * 1024U), NewCommand((kAsyncMaxTDs - 1U) * 16U, 64U * 1024U) };
+	uint32_t mystery = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL);
+	XHCIAsyncTD* pTd;
+
+	CHECK(pAsyncEp);
+	hc->_tdBytesOverride = 16U;
+	pAsyncEp->maxTDBytes = 16U;	// Note: keeps the commands small
+	CHECK(pAsyncEp->CreateTDs(commands[0], 0U, mystery, 0xFFU, 0) == kIOReturnNoResources);
+	CHECK(!XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs));
+	CHECK(!pAsyncEp->stats.transactions);
+	CHECK(pAsyncEp->CreateTDs(commands[1], 0U, mystery, 0xFFU, 0) == kIOReturnSuccess);
+	CHECK(pAsyncEp->tdPoolSize == kAsyncMaxTDs);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs) == kAsyncMaxTDs - 1U);
+	pTd = pAsyncEp->TDWithIndex(pAsyncEp->queuedTDs.slots[(pAsyncEp->queuedTDs.tail - 1U) & (pAsyncEp->tdPoolSize - 1U)]);
+	CHECK(pTd->finalTDInTransaction);
+	CHECK(pTd->numTDsThisTransaction == kAsyncMaxTDs - 1U);
+	pAsyncEp->Abort();
+	DeleteController(hc);
+	DeleteCommand(commands[0]);
+	DeleteCommand(commands[1]);
+}
+
+/*
+ * Note: Neither adaptation nor the MaxTDBytes override
+ *   lets a TD take more than a quarter of the ring
+ */
+HOST_TEST(TDBytesStayWithinQuarterOfRing)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 4, 512U, BULK_IN_EP);
+	uint32_t limit, i;
+
+	CHECK(pAsyncEp);
+	limit = pAsyncEp->TDBytesLimit();
+	CHECK(limit == (1023U / 4U - 2U) * PAGE_SIZE);
+	for (i = 0U; i < 100U; ++i)
+		pAsyncEp->AdaptTDBytes(kAsyncMaxAdaptiveTDBytes);
+	CHECK(pAsyncEp->maxTDBytes == kAsyncMaxAdaptiveTDBytes / 2U);
+	hc->_tdBytesOverride = kAsyncMaxAdaptiveTDBytes;
+	pAsyncEp->setParameters(512U, 0U, 0U);
+	CHECK(pAsyncEp->maxTDBytes == limit);
+	hc->_tdBytesOverride = 64U * 1024U;
+	pAsyncEp->setParameters(512U, 0U, 0U);
+	CHECK(pAsyncEp->maxTDBytes == 64U * 1024U);
+	DeleteController(hc);
+}
+
+/*
+ * Note: Retires the head scheduled TD short, as processTransferEvent2
+ *   does, with the xHC past its last TRB
+ */
+static void RetireHeadTDShort(XHCIAsyncEndpoint* pAsyncEp)
+{
+	XHCIAsyncTD* pTd = pAsyncEp->GetTD(&pAsyncEp->scheduledTDs);
+	uint16_t next = static_cast<uint16_t>(pTd->lastTrbIndex + 1);
+
+	if (next >= pAsyncEp->pRing->numTRBs - 1U)
+		next = 0U;
+	pAsyncEp->pRing->dequeueIndex = next;
+	pAsyncEp->RetireTDs(pTd, kIOReturnSuccess, true, true);
+	pAsyncEp->provider->_completer.Flush();
+}
+
+HOST_TEST(ShortFinalTDSkipsStopEndpoint)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(16U * PAGE_SIZE);
+	CompletionLog log = { 0 };
+
+	CHECK(pAsyncEp);
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	RetireHeadTDShort(pAsyncEp);
+	CHECK(hc->_diagCounters[DIAGCTR_FLUSHFAST] == 1);
+	CHECK(!gFakes.quiesces && !gFakes.commands);
+	CHECK(log.count == 1U);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: The first TD of a two TD transaction comes back short while
+ *   the second one is still waiting for room.  Its Event Data TRB
+ *   chains on, so the endpoint has to be stopped and moved past it.
+ */
+HOST_TEST(ShortChainedTDStopsEndpoint)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 2, 512U, BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(2U * kAsyncMaxFragmentSize, 512U);
+	CompletionLog log = { 0 };
+
+	CHECK(pAsyncEp);
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs) == 1U);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs) == 1U);
+	CHECK(pAsyncEp->pRing->ptr[pAsyncEp->PeekTD(&pAsyncEp->scheduledTDs)->lastTrbIndex].d & XHCI_TRB_3_CHAIN_BIT);
+	RetireHeadTDShort(pAsyncEp);
+	CHECK(!hc->_diagCounters[DIAGCTR_FLUSHFAST]);
+	CHECK(hc->_diagCounters[DIAGCTR_FLUSHSLOW] == 1);
+	CHECK(gFakes.quiesces == 1U);
+	CHECK(gFakes.lastCommandType == XHCI_TRB_TYPE_SET_TR_DEQUEUE);
+	CHECK(log.count == 1U);
+	CHECK(!XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs));
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: The fake xHC keeps EDTLA running across chained Event Data
+ *   TRBs, so the transaction only adds up if every sub-transaction
+ *   ends its chain below 8MB.
+ */
+HOST_TEST(AbsoluteEDTLATransactionIsSplit)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 4, 512U, BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(12U * 1024U * 1024U, 64U * 1024U);
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+
+	CHECK(pAsyncEp);
+	hc->_errataBits |= kErrataAbsoluteEDTLA;
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	xhc.absoluteEDTLA = true;
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	while (!log.count && !xhc.corrupt && FakeXHCRun(hc, pAsyncEp->pRing, &xhc))
+		CHECK(GenericUSBXHCI::CheckRingInvariants(pAsyncEp->pRing));
+	CHECK(!xhc.corrupt);
+	CHECK(log.count == 1U);
+	CHECK(log.lastStatus == kIOReturnSuccess);
+	CHECK(log.lastRemaining == 0U);
+	CHECK(xhc.maxEdtla > kAsyncMaxAbsoluteEDTLA / 2U);
+	CHECK(xhc.maxEdtla < kAsyncMaxAbsoluteEDTLA);
+	CHECK(pAsyncEp->stats.bytesTransferred == 12U * 1024U * 1024U);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->freeTDs) == pAsyncEp->tdPoolSize);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: Enough transactions that most are still queued.  Abort
+ *   completes each one once, without a command to the xHC.
+ */
+HOST_TEST(AbortCompletesEveryTransactionOnce)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP);
+	IOUSBCommand* commands[200];
+	CompletionLog logs[200];
+	uint32_t i;
+
+	CHECK(pAsyncEp);
+	bzero(&logs[0], sizeof logs);
+	for (i = 0U; i < 200U; ++i) {
+		commands[i] = NewCommand(16U * 1024U);
+		commands[i]->endpoint = 1U;
+		commands[i]->direction = kUSBIn;
+		LogCompletions(commands[i], &logs[i]);
+		CHECK(hc->CreateTransfer(commands[i], 0U) == kIOReturnSuccess);
+	}
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs));
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs));
+	CHECK(pAsyncEp->Abort() == kIOReturnAborted);
+	hc->_completer.Flush();
+	for (i = 0U; i < 200U; ++i) {
+		CHECK(logs[i].count == 1U);
+		CHECK(logs[i].lastStatus == kIOReturnAborted);
+	}
+	CHECK(!gFakes.commands);
+	CHECK(!gFakes.quiesces);
+	CHECK(!XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs));
+	CHECK(!XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs));
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->freeTDs) == pAsyncEp->tdPoolSize);
+	CHECK(!pAsyncEp->aborting);
+	DeleteController(hc);
+	for (i = 0U; i < 200U; ++i)
+		DeleteCommand(commands[i]);
+}
+
+/*
+ * Note: Only transactions that got their TDs show up in the stats
+ */
+HOST_TEST(RejectedTransactionsAreNotCounted)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 16, 512U, BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(64U * 1024U * 1024U, 64U * 1024U);
+	IODMACommand* dmaCommand = command->dmaCommand;
+	uint32_t mystery = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL);
+
+	CHECK(pAsyncEp);
+	command->dmaCommand = 0;
+	CHECK(pAsyncEp->CreateTDs(command, 0U, mystery, 0xFFU, 0) == kIOReturnBadArgument);
+	command->dmaCommand = dmaCommand;
+	gFakes.failMalloc = true;
+	CHECK(pAsyncEp->CreateTDs(command, 0U, mystery, 0xFFU, 0) != kIOReturnSuccess);
+	gFakes.failMalloc = false;
+	CHECK(!pAsyncEp->stats.transactions);
+	CHECK(!pAsyncEp->stats.bytesRequested);
+	CHECK(!XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs));
+	CHECK(pAsyncEp->CreateTDs(command, 0U, mystery, 0xFFU, 0) == kIOReturnSuccess);
+	CHECK(pAsyncEp->stats.transactions == 1U);
+	CHECK(pAsyncEp->stats.bytesRequested == 64U * 1024U * 1024U);
+	pAsyncEp->Abort();
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: A device that goes away with control transfers outstanding
+ *   mustn't leave bulk endpoints held back for good
+ */
+HOST_TEST(NukeSlotDropsPendingPriorityTDs)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, 1, 1, 64U, CTRL_EP);
+	IOUSBCommand* commands[2] = { NewCommand(64U), NewCommand(64U) };
+	SlotStruct* pSlot = hc->SlotPtr(kTestSlot);
+	ContextStruct* ctx = pSlot->ctx;
+	uint32_t mystery = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_DATA_STAGE);
+
+	CHECK(pAsyncEp);
+	CHECK(pAsyncEp->CreateTDs(commands[0], 0U, mystery, 0xFFU, 0) == kIOReturnSuccess);
+	pAsyncEp->ScheduleTDs();
+	CHECK(pAsyncEp->CreateTDs(commands[1], 0U, mystery, 0xFFU, 0) == kIOReturnSuccess);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs) == 1U);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs) == 1U);
+	CHECK(hc->_qos.pendingPriorityTDs == 2U);
+	hc->NukeSlot(kTestSlot);
+	CHECK(!hc->_qos.pendingPriorityTDs);
+	pSlot->ctx = ctx;	// Note: the harness owns it
+	DeleteController(hc);
+	DeleteCommand(commands[0]);
+	DeleteCommand(commands[1]);
+}
@@ -0,0 +1,409 @@
+//
+//  EventRingTests.cpp
+//  GenericUSBXHCI
+//
+//  Event ring setup, and the bounce queue between FilterEventRing
+//  and PollEventRing2.
+//
+
+#include "Harness.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/*
+ * Note: Plays the xHC's part as event ring producer
+ */
+struct FakeEventProducer
+{
+	int32_t interrupter;
+	uint16_t index;
+	uint8_t cycleState;
+};
+
+static void PostEvent(GenericUSBXHCI* hc, FakeEventProducer* pProducer, uint32_t trbType, uint32_t tag)
+{
+	EventRingStruct* ePtr = &hc->_eventRing[pProducer->interrupter];
+	TRBStruct* pTrb = reinterpret_cast<TRBStruct*>(&ePtr->erstPtr[pProducer->index]);
+
+	pTrb->a = tag;
+	pTrb->b = 0U;
+	pTrb->c = XHCI_TRB_2_ERROR_SET(XHCI_TRB_ERROR_SUCCESS);
+	pTrb->d = XHCI_TRB_3_TYPE_SET(trbType) | (pProducer->cycleState ? XHCI_TRB_3_CYCLE_BIT : 0U);
+	if (++pProducer->index >= ePtr->numxHCEntries) {
+		pProducer->index = 0U;
+		pProducer->cycleState ^= 1U;
+	}
+}
+
+static GenericUSBXHCI* NewControllerWithEventRing(uint16_t numSegments, uint16_t queueEntries, FakeEventProducer* pProducer)
+{
+	GenericUSBXHCI* hc = NewController();
+
+	hc->_eventRingSegments = numSegments;
+	hc->_eventQueueEntries = queueEntries;
+	if (hc->InitAnEventRing(0) != kIOReturnSuccess) {
+		DeleteController(hc);
+		return 0;
+	}
+	pProducer->interrupter = 0;
+	pProducer->index = 0U;
+	pProducer->cycleState = 1U;
+	return hc;
+}
+
+HOST_TEST(SingleSegmentEventRingLayout)
+{
+	FakeEventProducer producer;
+	GenericUSBXHCI* hc = NewControllerWithEventRing(1U, 0U, &producer);
+	EventRingStruct* ePtr;
+	EventRingSegmentTable const* pErst;
+
+	CHECK(hc);
+	ePtr = &hc->_eventRing[0];
+	pErst = reinterpret_cast<EventRingSegmentTable const*>(ePtr->md->bytes);
+	CHECK(ePtr->numSegments == 1U);
+	CHECK(ePtr->erstEntries == 4U);
+	CHECK(ePtr->numxHCEntries == PAGE_SIZE / sizeof(TRBStruct) - 4U);
+	CHECK(ePtr->erstba == reinterpret_cast<uint64_t>(pErst));
+	CHECK(pErst[0].qwEvrsTablePtr == ePtr->erdp);
+	CHECK(pErst[0].dwEvrsTableSize == ePtr->numxHCEntries);
+	CHECK(!pErst[1].qwEvrsTablePtr && !pErst[1].dwEvrsTableSize);
+	CHECK(ePtr->numBounceEntries >= 2U * ePtr->numxHCEntries);
+	DeleteController(hc);
+}
+
+HOST_TEST(FilterEventRingBouncesEventsInOrder)
+{
+	FakeEventProducer producer;
+	GenericUSBXHCI* hc = NewControllerWithEventRing(1U, 0U, &producer);
+	EventRingStruct* ePtr;
+	bool invokeContinuation = false;
+	uint32_t i, count;
+
+	CHECK(hc);
+	ePtr = &hc->_eventRing[0];
+	/*
+	 * Note: Enough to wrap the event ring twice
+	 */
+	for (count = 0U, i = 0U; i < 2U * ePtr->numxHCEntries + 10U; ++i) {
+		PostEvent(hc, &producer, XHCI_TRB_EVENT_TRANSFER, i);
+		CHECK(hc->FilterEventRing(0, &invokeContinuation));
+		CHECK(!hc->FilterEventRing(0, &invokeContinuation));
+		CHECK(ePtr->bounceQueuePtr[ePtr->bounceDequeueIndex].a == count);
+		++count;
+		if (++ePtr->bounceDequeueIndex >= ePtr->numBounceEntries)
+			ePtr->bounceDequeueIndex = 0U;
+	}
+	CHECK(invokeContinuation);
+	CHECK(ePtr->xHCDequeueIndex == producer.index);
+	CHECK(ePtr->cycleState == producer.cycleState);
+	CHECK(!ePtr->numBounceQueueOverflows);
+	DeleteController(hc);
+}
+
+/*
+ * Note: Three pages share a 4 entry ERST at the start of the first,
+ *   and ERDP carries the index of the segment the dequeue pointer is in.
+ */
+HOST_TEST(MultiSegmentEventRingLayout)
+{
+	static uint16_t const dequeueIndices[] = { 0U, 251U, 252U, 507U, 508U, 763U };
+	static uint8_t const segments[] = { 0U, 0U, 1U, 1U, 2U, 2U };
+	FakeEventProducer producer;
+	GenericUSBXHCI* hc = NewControllerWithEventRing(3U, 0U, &producer);
+	XHCIInterruptRegisterSet volatile* irSet;
+	EventRingStruct* ePtr;
+	EventRingSegmentTable const* pErst;
+	bool invokeContinuation = false;
+	uint64_t erdp;
+	uint32_t i;
+	uint16_t numBounceEntries;
+
+	CHECK(hc);
+	ePtr = &hc->_eventRing[0];
+	irSet = &hc->_pXHCIRuntimeRegisters->irs[0];
+	pErst = reinterpret_cast<EventRingSegmentTable const*>(ePtr->md->bytes);
+	CHECK(ePtr->numSegments == 3U);
+	CHECK(ePtr->erstEntries == 4U);
+	CHECK(ePtr->numxHCEntries == 3U * (PAGE_SIZE / sizeof(TRBStruct)) - 4U);
+	CHECK(irSet->erstsz == 3U);
+	CHECK(irSet->erstba == ePtr->erstba);
+	CHECK(pErst[0].qwEvrsTablePtr == ePtr->erdp);
+	CHECK(pErst[0].dwEvrsTableSize == PAGE_SIZE / sizeof(TRBStruct) - 4U);
+	for (i = 1U; i < 3U; ++i) {
+		CHECK(pErst[i].qwEvrsTablePtr == ePtr->erstba + i * PAGE_SIZE);
+		CHECK(pErst[i].dwEvrsTableSize == PAGE_SIZE / sizeof(TRBStruct));
+	}
+	CHECK(!pErst[3].qwEvrsTablePtr && !pErst[3].dwEvrsTableSize);
+	for (i = 0U; i < sizeof dequeueIndices / sizeof dequeueIndices[0]; ++i) {
+		ePtr->xHCDequeueIndex = dequeueIndices[i];
+		ePtr->erdpNeedsUpdate = true;
+		hc->postFilterEventRing(0);
+		erdp = irSet->erdp;
+		CHECK((erdp & ~static_cast<uint64_t>(sizeof(TRBStruct) - 1U)) ==
+			  ePtr->erdp + dequeueIndices[i] * sizeof(TRBStruct));
+		CHECK((erdp & 7U) == segments[i]);
+	}
+	/*
+	 * Note: The producer writes the segments back to back, which is
+	 *   the order the xHC walks them in
+	 */
+	ePtr->xHCDequeueIndex = 0U;
+	for (i = 0U; i < 2U * ePtr->numxHCEntries + 10U; ++i) {
+		PostEvent(hc, &producer, XHCI_TRB_EVENT_TRANSFER, i);
+		CHECK(hc->FilterEventRing(0, &invokeContinuation));
+		CHECK(ePtr->bounceQueuePtr[ePtr->bounceDequeueIndex].a == i);
+		if (++ePtr->bounceDequeueIndex >= ePtr->numBounceEntries)
+			ePtr->bounceDequeueIndex = 0U;
+	}
+	CHECK(ePtr->xHCDequeueIndex == producer.index);
+	CHECK(ePtr->cycleState == producer.cycleState);
+	/*
+	 * Note: A burst longer than the bounce queue, starting short of
+	 *   the first segment boundary, stalls in segment 1.  ERDP and
+	 *   DESI must point at the held event, and filtering must pick
+	 *   up from it once the queue has been drained.
+	 */
+	numBounceEntries = ePtr->numBounceEntries;
+	ePtr->numBounceEntries = 300U;
+	ePtr->bounceEnqueueIndex = 0U;
+	ePtr->bounceDequeueIndex = 0U;
+	ePtr->xHCDequeueIndex = 200U;
+	producer.index = 200U;
+	for (i = 0U; i < 400U; ++i)
+		PostEvent(hc, &producer, XHCI_TRB_EVENT_TRANSFER, i);
+	i = 0U;
+	while (hc->FilterEventRing(0, &invokeContinuation))
+		++i;
+	CHECK(i == 299U);
+	CHECK(ePtr->bounceStalled);
+	CHECK(ePtr->numBounceQueueOverflows == 1);
+	CHECK(ePtr->xHCDequeueIndex == 499U);
+	hc->postFilterEventRing(0);
+	CHECK(irSet->erdp == ((ePtr->erdp + 499U * sizeof(TRBStruct)) | XHCI_ERDP_LO_BUSY | XHCI_ERDP_LO_SINDEX(1U)));
+	for (i = 0U; i < 299U; ++i) {
+		CHECK(ePtr->bounceQueuePtr[ePtr->bounceDequeueIndex].a == i);
+		if (++ePtr->bounceDequeueIndex >= ePtr->numBounceEntries)
+			ePtr->bounceDequeueIndex = 0U;
+	}
+	for (; hc->FilterEventRing(0, &invokeContinuation); ++i) {
+		CHECK(ePtr->bounceQueuePtr[ePtr->bounceDequeueIndex].a == i);
+		if (++ePtr->bounceDequeueIndex >= ePtr->numBounceEntries)
+			ePtr->bounceDequeueIndex = 0U;
+	}
+	CHECK(i == 400U);
+	CHECK(!ePtr->bounceStalled);
+	CHECK(ePtr->xHCDequeueIndex == 600U);
+	hc->postFilterEventRing(0);
+	CHECK(irSet->erdp == ((ePtr->erdp + 600U * sizeof(TRBStruct)) | XHCI_ERDP_LO_BUSY | XHCI_ERDP_LO_SINDEX(2U)));
+	ePtr->numBounceEntries = numBounceEntries;
+	DeleteController(hc);
+}
+
+static void FillBounceQueue(GenericUSBXHCI* hc, FakeEventProducer* pProducer)
+{
+	EventRingStruct* ePtr = &hc->_eventRing[0];
+	uint32_t i;
+
+	for (i = 0U; i < ePtr->numBounceEntries - 1U; ++i) {
+		PostEvent(hc, pProducer, XHCI_TRB_EVENT_TRANSFER, i);
+		hc->FilterEventRing(0, 0);
+	}
+}
+
+/*
+ * Note: Events the filter deals with itself go through
+ *   even though the bounce queue is full
+ */
+HOST_TEST(FullBounceQueueDoesNotStallFilteredEvents)
+{
+	FakeEventProducer producer;
+	GenericUSBXHCI* hc = NewControllerWithEventRing(1U, 0U, &producer);
+	EventRingStruct* ePtr;
+	uint32_t counter;
+
+	CHECK(hc);
+	ePtr = &hc->_eventRing[0];
+	FillBounceQueue(hc, &producer);
+	CHECK(hc->BounceQueueFull(ePtr));
+	CHECK(!ePtr->numBounceQueueOverflows);
+	counter = hc->_millsecondCounter;
+	PostEvent(hc, &producer, XHCI_TRB_EVENT_MFINDEX_WRAP, 0U);
+	CHECK(hc->FilterEventRing(0, 0));
+	CHECK(hc->_millsecondCounter == counter + 2048U);
+	CHECK(hc->_millsecondsTimers[1] == hc->_millsecondsTimers[0]);
+	CHECK(hc->_millsecondsTimers[3] == hc->_millsecondsTimers[2]);
+	gFakes.consumeCMDCompletions = true;
+	PostEvent(hc, &producer, XHCI_TRB_EVENT_CMD_COMPLETE, 0U);
+	CHECK(hc->FilterEventRing(0, 0));
+	CHECK(gFakes.cmdCompletions == 1U);
+	PostEvent(hc, &producer, XHCI_TRB_EVENT_PORT_STS_CHANGE, 0U);
+	CHECK(hc->FilterEventRing(0, 0));
+	CHECK(ePtr->xHCDequeueIndex == producer.index);
+	CHECK(!ePtr->numBounceQueueOverflows);
+	DeleteController(hc);
+}
+
+/*
+ * Note: An event that has to be bounced waits on the event ring
+ *   for room, and isn't filtered a second time when it gets it
+ */
+HOST_TEST(FullBounceQueueHoldsEventOnRing)
+{
+	FakeEventProducer producer;
+	GenericUSBXHCI* hc = NewControllerWithEventRing(1U, 0U, &producer);
+	EventRingStruct* ePtr;
+	uint16_t dequeueIndex;
+
+	CHECK(hc);
+	ePtr = &hc->_eventRing[0];
+	FillBounceQueue(hc, &producer);
+	dequeueIndex = ePtr->xHCDequeueIndex;
+	PostEvent(hc, &producer, XHCI_TRB_EVENT_CMD_COMPLETE, 0xC0DEU);
+	CHECK(!hc->FilterEventRing(0, 0));
+	CHECK(!hc->FilterEventRing(0, 0));
+	CHECK(ePtr->xHCDequeueIndex == dequeueIndex);
+	CHECK(ePtr->numBounceQueueOverflows == 2);
+	CHECK(gFakes.cmdCompletions == 1U);
+	if (++ePtr->bounceDequeueIndex >= ePtr->numBounceEntries)
+		ePtr->bounceDequeueIndex = 0U;
+	CHECK(hc->FilterEventRing(0, 0));
+	CHECK(gFakes.cmdCompletions == 1U);
+	CHECK(ePtr->xHCDequeueIndex == producer.index);
+	CHECK(!ePtr->bounceStalled);
+	CHECK(ePtr->bounceQueuePtr[(ePtr->bounceEnqueueIndex + ePtr->numBounceEntries - 1U) % ePtr->numBounceEntries].a == 0xC0DEU);
+	DeleteController(hc);
+}
+
+/*
+ * Note: A Stop Endpoint's transfer event sitting on the bulk
+ *   interrupter's event ring is picked up by the workloop without
+ *   waiting for that interrupter's filter
+ */
+HOST_TEST(DrainEventRingBouncesSecondaryEvents)
+{
+	FakeEventProducer producer;
+	GenericUSBXHCI* hc = NewControllerWithEventRing(1U, 0U, &producer);
+	EventRingStruct* ePtr;
+	TRBStruct const* pTrb;
+
+	CHECK(hc);
+	hc->_numInterrupters = 3;
+	CHECK(hc->InitAnEventRing(kInterrupterBulk) == kIOReturnSuccess);
+	ePtr = &hc->_eventRing[kInterrupterBulk];
+	producer.interrupter = kInterrupterBulk;
+	PostEvent(hc, &producer, XHCI_TRB_EVENT_TRANSFER, 0x5700U);
+	reinterpret_cast<TRBStruct*>(&ePtr->erstPtr[0])->c = XHCI_TRB_2_ERROR_SET(XHCI_TRB_ERROR_STOPPED);
+	hc->DrainEventRing(kInterrupterBulk);
+	CHECK(!ePtr->filterLock->held);
+	CHECK(ePtr->xHCDequeueIndex == 1U);
+	CHECK(!ePtr->erdpNeedsUpdate);
+	CHECK(ePtr->bounceEnqueueIndex == 1U);
+	pTrb = &ePtr->bounceQueuePtr[0];
+	CHECK(pTrb->a == 0x5700U);
+	CHECK(XHCI_TRB_2_ERROR_GET(pTrb->c) == XHCI_TRB_ERROR_STOPPED);
+	CHECK(hc->_pXHCIRuntimeRegisters->irs[kInterrupterBulk].erdp ==
+		  ((ePtr->erdp + sizeof(TRBStruct)) | XHCI_ERDP_LO_BUSY));
+	CHECK(!hc->_eventRing[0].xHCDequeueIndex);
+	DeleteController(hc);
+}
+
+#define kStressEvents 2000000U
+
+/*
+ * Note: The filter and the workloop each see every command
+ *   completion once, in the order it was posted
+ */
+static struct
+{
+	GenericUSBXHCI* hc;
+	uint32_t filtered;
+	uint32_t consumed;
+	uint32_t volatile outOfOrder;
+} gStress;
+
+static __thread bool tStressConsumer;
+
+static void StressCMDCompletion(TRBStruct const* pTrb)
+{
+	uint32_t* pSeq = tStressConsumer ? &gStress.consumed : &gStress.filtered;
+
+	if (pTrb->a != *pSeq)
+		__sync_fetch_and_add(&gStress.outOfOrder, 1U);
+	__atomic_store_n(pSeq, pTrb->a + 1U, __ATOMIC_RELEASE);
+}
+
+/*
+ * Note: Plays the xHC and the primary interrupt filter.  The xHC
+ *   holds off posting while the event ring is full, as it would
+ *   with ERDP parked on a stalled event.
+ */
+static void* StressProducer(void*)
+{
+	GenericUSBXHCI* hc = gStress.hc;
+	EventRingStruct* ePtr = &hc->_eventRing[0];
+	FakeEventProducer producer;
+	uint32_t posted = 0U;
+	uint16_t next;
+
+	producer.interrupter = 0;
+	producer.index = 0U;
+	producer.cycleState = 1U;
+	while (__atomic_load_n(&gStress.filtered, __ATOMIC_ACQUIRE) < kStressEvents) {
+		next = producer.index + 1U;
+		if (next >= ePtr->numxHCEntries)
+			next = 0U;
+		if (posted < kStressEvents && next != ePtr->xHCDequeueIndex)
+			PostEvent(hc, &producer, XHCI_TRB_EVENT_CMD_COMPLETE, posted++);
+		else if (ePtr->bounceStalled)
+			sched_yield();
+		while (hc->FilterEventRing(0, 0));
+		hc->postFilterEventRing(0);
+	}
+	return 0;
+}
+
+/*
+ * Note: Plays the workloop, pausing now and then
+ *   so the bounce queue fills up
+ */
+static void* StressConsumer(void*)
+{
+	GenericUSBXHCI* hc = gStress.hc;
+
+	tStressConsumer = true;
+	while (__atomic_load_n(&gStress.consumed, __ATOMIC_ACQUIRE) < kStressEvents) {
+		if (!hc->PollEventRing2(0))
+			sched_yield();
+		else if (!(gStress.consumed & 0xFFFFU))
+			usleep(200U);
+	}
+	return 0;
+}
+
+HOST_TEST(ThreadedBounceQueueKeepsOrderUnderBackpressure)
+{
+	FakeEventProducer producer;
+	GenericUSBXHCI* hc = NewControllerWithEventRing(1U, 0U, &producer);
+	EventRingStruct* ePtr;
+	pthread_t producerThread, consumerThread;
+
+	CHECK(hc);
+	ePtr = &hc->_eventRing[0];
+	bzero(&gStress, sizeof gStress);
+	gStress.hc = hc;
+	gFakes.cmdCompletionHook = StressCMDCompletion;
+	CHECK(!pthread_create(&consumerThread, 0, StressConsumer, 0));
+	CHECK(!pthread_create(&producerThread, 0, StressProducer, 0));
+	pthread_join(producerThread, 0);
+	pthread_join(consumerThread, 0);
+	CHECK(!gStress.outOfOrder);
+	CHECK(gStress.filtered == kStressEvents);
+	CHECK(gStress.consumed == kStressEvents);
+	CHECK(ePtr->bounceDequeueIndex == ePtr->bounceEnqueueIndex);
+	CHECK(!ePtr->bounceStalled);
+	CHECK(hc->_diagCounters[DIAGCTR_BNCEOVRFLW] + ePtr->numBounceQueueOverflows > 0);
+	DeleteController(hc);
+}
@@ -0,0 +1,333 @@
+//
+//  Fakes.cpp
+//  GenericUSBXHCI
+//
+//  Host build stand-ins for kernel services, and for the controller
+//  methods that talk to hardware.  Commands complete at once, and
+//  every call a test may care about is counted in gFakes.
+//
+
+#include "Harness.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+HostFakes gFakes;
+
+extern "C" {
+int gux_log_level = 0, gux_options = 0;
+UInt32 gUSBStackDebugFlags = 0U;
+}
+
+#pragma mark -
+#pragma mark Kernel Services
+#pragma mark -
+
+extern "C" void IOLog(char const* format, ...)
+{
+	va_list ap;
+
+	if (!gFakes.verbose)
+		return;
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+extern "C" void* IOMalloc(size_t size)
+{
+	if (gFakes.failMalloc)
+		return 0;
+	gFakes.mallocBytes += static_cast<int64_t>(size);
+	return malloc(size);
+}
+
+extern "C" void IOFree(void* p, size_t size)
+{
+	if (!p)
+		return;
+	gFakes.mallocBytes -= static_cast<int64_t>(size);
+	free(p);
+}
+
+extern "C" void* IOMallocAligned(size_t size, size_t alignment)
+{
+	void* p;
+
+	if (gFakes.failMalloc)
+		return 0;
+	if (alignment < sizeof(void*))
+		alignment = sizeof(void*);
+	if (posix_memalign(&p, alignment, size))
+		return 0;
+	gFakes.mallocBytes += static_cast<int64_t>(size);
+	return p;
+}
+
+extern "C" void IOFreeAligned(void* p, size_t size)
+{
+	if (!p)
+		return;
+	gFakes.mallocBytes -= static_cast<int64_t>(size);
+	free(p);
+}
+
+extern "C" void IOSleep(unsigned) {}
+extern "C" void IODelay(unsigned) {}
+
+/*
+ * Note: Absolute time is in nanoseconds, and only moves when a test
+ *   advances it.
+ */
+extern "C" uint64_t mach_absolute_time(void)
+{
+	return gFakes.clock;
+}
+
+extern "C" void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t* result)
+{
+	*result = abstime;
+}
+
+extern "C" void nanoseconds_to_absolutetime(uint64_t nanosecs, uint64_t* result)
+{
+	*result = nanosecs;
+}
+
+extern "C" uint64_t ml_cpu_int_event_time(void)
+{
+	return gFakes.clock;
+}
+
+#pragma mark -
+#pragma mark IOKit Classes
+#pragma mark -
+
+IOByteCount IOMemoryDescriptor::readBytes(IOByteCount offset, void* buffer, IOByteCount count)
+{
+	if (!bytes || offset >= length)
+		return 0U;
+	if (count > length - offset)
+		count = length - offset;
+	memcpy(buffer, bytes + offset, count);
+	return count;
+}
+
+IOBufferMemoryDescriptor::~IOBufferMemoryDescriptor(void)
+{
+	if (allocBase) {
+		--gFakes.liveBuffers;
+		free(allocBase);
+	}
+}
+
+/*
+ * Note: Walks the fake segment list from *offset, like IODMACommand
+ *   walks a prepared descriptor.
+ */
+IOReturn IODMACommand::genIOVMSegments(UInt64* offset, Segment64* segments, UInt32* numSegments)
+{
+	UInt64 base;
+	UInt32 i, n;
+
+	++genCalls;
+	++gFakes.genIOVMSegmentsCalls;
+	for (base = 0U, i = 0U; i < numFakeSegments && base + fakeSegments[i].fLength <= *offset; ++i)
+		base += fakeSegments[i].fLength;
+	for (n = 0U; n < *numSegments && i < numFakeSegments; ++n, ++i) {
+		segments[n].fIOVMAddr = fakeSegments[i].fIOVMAddr + (*offset - base);
+		segments[n].fLength = fakeSegments[i].fLength - (*offset - base);
+		base += fakeSegments[i].fLength;
+		*offset = base;
+	}
+	*numSegments = n;
+	return kIOReturnSuccess;
+}
+
+IOReturn IOService::getInterruptType(int source, int* interruptType)
+{
+	if (source < 0 || source > numMessageInterrupts)
+		return kIOReturnBadArgument;
+	*interruptType = source ? kIOInterruptTypePCIMessaged : 0;
+	return kIOReturnSuccess;
+}
+
+IOFilterInterruptEventSource* IOFilterInterruptEventSource::filterInterruptEventSource(OSObject*, Action, Filter, IOService*, int intIndex)
+{
+	IOFilterInterruptEventSource* source = new IOFilterInterruptEventSource;
+	source->intIndex = intIndex;
+	return source;
+}
+
+void IOUSBControllerV3::Complete(IOUSBCompletion completion, IOReturn status, UInt32 actualByteCount)
+{
+	++completions;
+	if (completion.action)
+		completion.action(completion.target, completion.parameter, status, actualByteCount);
+}
+
+#pragma mark -
+#pragma mark Controller
+#pragma mark -
+
+/*
+ * Note: Buffers are placed as badly as their alignment allows, aligned
+ *   to the lowest bit of mem_mask but never to twice that, so a buffer
+ *   that isn't asked to be 64KB aligned always starts mid-way through
+ *   a 64KB block.  Upper bits of mem_mask are ignored.
+ */
+IOReturn CLASS::MakeBuffer(uint32_t, size_t mem_capacity, uint64_t mem_mask, IOBufferMemoryDescriptor** pDesc, void** pVirtAddr, uint64_t* pPhysAddr)
+{
+	IOBufferMemoryDescriptor* md;
+	uint64_t alignment;
+	void* base;
+
+	++gFakes.makeBufferCalls;
+	if (gFakes.failMakeBuffer)
+		return kIOReturnNoMemory;
+	alignment = mem_mask & (~mem_mask + 1U);	// Note: lowest set bit
+	if (alignment < PAGE_SIZE)
+		alignment = PAGE_SIZE;
+	if (posix_memalign(&base, 2U * (alignment > 0x10000U ? alignment : 0x10000U), mem_capacity + 2U * alignment + 0x10000U))
+		return kIOReturnNoMemory;
+	md = new IOBufferMemoryDescriptor;
+	md->allocBase = base;
+	md->allocSize = mem_capacity;
+	md->bytes = static_cast<uint8_t*>(base) + alignment;
+	md->length = mem_capacity;
+	bzero(md->bytes, mem_capacity);
+	++gFakes.liveBuffers;
+	*pDesc = md;
+	if (pVirtAddr)
+		*pVirtAddr = md->bytes;
+	*pPhysAddr = reinterpret_cast<uint64_t>(md->bytes);
+	return kIOReturnSuccess;
+}
+
+/*
+ * Note: Doorbells and commands only update the endpoint
+ *   context the way the xHC would.
+ */
+IOReturn CLASS::StartEndpoint(int32_t slot, int32_t endpoint, uint16_t)
+{
+	ContextStruct* pContext = GetSlotContext(slot, endpoint);
+
+	++gFakes.doorbells;
+	if (XHCI_EPCTX_0_EPSTATE_GET(pContext->_e.dwEpCtx0) == EP_STATE_STOPPED)
+		pContext->_e.dwEpCtx0 = (pContext->_e.dwEpCtx0 & ~7U) | XHCI_EPCTX_0_EPSTATE_SET(EP_STATE_RUNNING);
+	return kIOReturnSuccess;
+}
+
+void CLASS::RestartStreams(int32_t, int32_t, uint32_t)
+{
+	++gFakes.restartStreams;
+}
+
+uint32_t CLASS::QuiesceEndpoint(int32_t slot, int32_t endpoint)
+{
+	ContextStruct* pContext = GetSlotContext(slot, endpoint);
+	uint32_t epState = XHCI_EPCTX_0_EPSTATE_GET(pContext->_e.dwEpCtx0);
+
+	++gFakes.quiesces;
+	if (epState == EP_STATE_RUNNING)
+		pContext->_e.dwEpCtx0 = (pContext->_e.dwEpCtx0 & ~7U) | XHCI_EPCTX_0_EPSTATE_SET(EP_STATE_STOPPED);
+	return epState;
+}
+
+void CLASS::ResetEndpoint(int32_t, int32_t, bool)
+{
+	++gFakes.resetEndpoints;
+}
+
+int32_t CLASS::WaitForCMD(TRBStruct* pTrb, int32_t trbType, TRBCallback)
+{
+	++gFakes.commands;
+	gFakes.lastCommandType = trbType;
+	gFakes.lastCommand = *pTrb;
+	return XHCI_TRB_ERROR_SUCCESS;
+}
+
+IOReturn CLASS::TranslateXHCIStatus(int32_t code, uint32_t, bool)
+{
+	switch (code) {
+		case XHCI_TRB_ERROR_SUCCESS:
+		case XHCI_TRB_ERROR_SHORT_PKT:
+			return kIOReturnSuccess;
+		case XHCI_TRB_ERROR_STALL:
+			return kIOUSBPipeStalled;
+		default:
+			return kIOReturnInternalError;
+	}
+}
+
+bool CLASS::checkEPForTimeOuts(int32_t, int32_t, uint32_t, uint32_t, bool)
+{
+	++gFakes.timeoutChecks;
+	return gFakes.timeoutsFound;
+}
+
+bool CLASS::DoCMDCompletion(TRBStruct trb)
+{
+	if (gFakes.cmdCompletionHook)
+		gFakes.cmdCompletionHook(&trb);
+	else
+		++gFakes.cmdCompletions;
+	return gFakes.consumeCMDCompletions;
+}
+
+/*
+ * Note: V1Pure.cpp's, less the root hub port change handling
+ */
+void CLASS::PollInterrupts(IOUSBCompletionAction)
+{
+	for (int32_t interrupter = 0; interrupter < _numInterrupters; ++interrupter)
+		while (PollEventRing2(interrupter));
+}
+
+void CLASS::ScheduleEventSource(void) {}
+void CLASS::GetInputContext(void) {}
+void CLASS::ReleaseInputContext(void) {}
+IOReturn CLASS::ResetController(void) { return kIOReturnSuccess; }
+IOReturn CLASS::StopUSBBus(void) { return kIOReturnSuccess; }
+IOReturn CLASS::WaitForUSBSts(uint32_t, uint32_t) { return kIOReturnSuccess; }
+IOReturn CLASS::XHCIRootHubPowerPort(uint16_t, bool) { return kIOReturnSuccess; }
+uint16_t CLASS::PortNumberProtocolToCanonical(uint16_t port, uint8_t) { return port; }
+
+IOReturn CLASS::TranslateCommandCompletion(int32_t code)
+{
+	return code > -1000 && code != -1 ? kIOReturnSuccess : kIOReturnInternalError;
+}
+
+uint8_t CLASS::TranslateEndpoint(int16_t endpointNumber, int16_t direction)
+{
+	return static_cast<uint8_t>(2 * endpointNumber + (direction != kUSBOut ? 1 : 0));
+}
+
+bool CLASS::IsIsocEP(int32_t slot, int32_t endpoint)
+{
+	ringStruct* pRing = GetRing(slot, endpoint, 0U);
+	return pRing && (pRing->epType | CTRL_EP) == ISOC_IN_EP;
+}
+
+ringStruct* CLASS::FindStream(int32_t slot, int32_t endpoint, uint64_t addr, int32_t* pTrbIndexInRingQueue)
+{
+	SlotStruct* pSlot = SlotPtr(slot);
+	ringStruct* pRing = pSlot->ringArrayForEndpoint[endpoint];
+
+	for (uint32_t streamId = 1U; pRing && streamId <= pSlot->lastStreamForEndpoint[endpoint]; ++streamId) {
+		int64_t index = DiffTRBIndex(addr, pRing[streamId].physAddr);
+		if (pRing[streamId].md && index >= 0 && index < pRing[streamId].numTRBs - 1) {
+			*pTrbIndexInRingQueue = static_cast<int32_t>(index);
+			return &pRing[streamId];
+		}
+	}
+	return 0;
+}
+
+IOReturn CLASS::AbortIsochEP(GenericUSBXHCIIsochEP*) { return kIOReturnSuccess; }
+IOReturn CLASS::NukeIsochEP(GenericUSBXHCIIsochEP*) { return kIOReturnSuccess; }
+void CLASS::AddIsocFramesToSchedule(GenericUSBXHCIIsochEP*) {}
+IOReturn CLASS::RetireIsocTransactions(GenericUSBXHCIIsochEP*, bool) { return kIOReturnSuccess; }
+
+int32_t GenericUSBXHCIIsochTD::FrameForEventIndex(uint32_t) const { return -1; }
+IOReturn GenericUSBXHCIIsochTD::UpdateFrameList(AbsoluteTime) { return kIOReturnSuccess; }
@@ -0,0 +1,268 @@
+//
+//  Harness.cpp
+//  GenericUSBXHCI
+//
+//  Test registry, fixtures and the fake xHC ring consumer.
+//
+
+#include "Harness.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#pragma mark -
+#pragma mark Test Registry
+#pragma mark -
+
+HostTest* gHostTests;
+static HostTest** gHostTestsTail = &gHostTests;
+static bool gHostTestFailed;
+
+HostTest::HostTest(char const* name, HostTestFunc func) : name(name), func(func), next(0)
+{
+	*gHostTestsTail = this;
+	gHostTestsTail = &next;
+}
+
+void HostTestFail(char const* file, int line, char const* expr)
+{
+	fprintf(stderr, "    %s:%d: CHECK(%s) failed\n", file, line, expr);
+	gHostTestFailed = true;
+}
+
+bool HostTestFailed(void)
+{
+	bool failed = gHostTestFailed;
+	gHostTestFailed = false;
+	return failed;
+}
+
+#pragma mark -
+#pragma mark Fixtures
+#pragma mark -
+
+static void* AllocZeroed(size_t size, size_t alignment)
+{
+	void* p;
+
+	if (posix_memalign(&p, alignment, size))
+		abort();
+	bzero(p, size);
+	return p;
+}
+
+GenericUSBXHCI* NewController(void)
+{
+	GenericUSBXHCI* hc = new (AllocZeroed(sizeof *hc, 512U)) GenericUSBXHCI;
+	SlotStruct* pSlot;
+
+	hc->_numSlots = 1U;
+	hc->_slotArray = static_cast<SlotStruct*>(AllocZeroed(sizeof *hc->_slotArray, 512U));
+	pSlot = hc->SlotPtr(kTestSlot);
+	pSlot->md = new IOBufferMemoryDescriptor;
+	pSlot->ctx = static_cast<ContextStruct*>(AllocZeroed((kUSBMaxPipes + 1U) * sizeof *pSlot->ctx, 64U));
+	hc->_addressMapper.Active[kTestAddress] = true;
+	hc->_addressMapper.Slot[kTestAddress] = kTestSlot;
+	hc->_v3ExpansionData = static_cast<V3ExpansionData*>(AllocZeroed(PAGE_SIZE, 64U));
+	hc->_pXHCIOperationalRegisters = static_cast<XHCIOpRegisters*>(AllocZeroed(PAGE_SIZE, 64U));
+	hc->_pXHCIRuntimeRegisters = static_cast<XHCIRuntimeRegisters*>(AllocZeroed(PAGE_SIZE, 64U));
+	hc->_HCCLow = 1U;	// Note: AC64, since fake physical addresses are host pointers
+	hc->_numInterrupters = 1;
+	hc->_erstMax = 8U;
+	hc->_eventBatchSize = 64U;
+	hc->_completer.setOwner(hc);
+	return hc;
+}
+
+void DeleteController(GenericUSBXHCI* hc)
+{
+	SlotStruct* pSlot = hc->SlotPtr(kTestSlot);
+	ringStruct* pRing;
+	uint32_t streamId;
+
+	for (int32_t endpoint = 1; endpoint < kUSBMaxPipes; ++endpoint) {
+		pRing = pSlot->ringArrayForEndpoint[endpoint];
+		if (!pRing)
+			continue;
+		for (streamId = 0U; streamId <= pSlot->maxStreamForEndpoint[endpoint]; ++streamId) {
+			if (pRing[streamId].asyncEndpoint)
+				pRing[streamId].asyncEndpoint->release();
+			hc->DeallocRing(&pRing[streamId]);
+		}
+		IOFree(pRing, (1U + pSlot->maxStreamForEndpoint[endpoint]) * sizeof *pRing);
+	}
+	hc->_completer.Flush();
+	hc->_completer.Finalize();
+	hc->FinalizeRingSlabs();
+	if (hc->_tdSegmentCache.segments)
+		IOFree(hc->_tdSegmentCache.segments, hc->_tdSegmentCache.maxSegments * sizeof *hc->_tdSegmentCache.segments);
+	for (int32_t i = 0; i < kMaxActiveInterrupters; ++i)
+		hc->FinalizeAnEventRing(i);
+	delete pSlot->md;
+	free(pSlot->ctx);
+	free(hc->_slotArray);
+	free(hc->_v3ExpansionData);
+	free(const_cast<XHCIOpRegisters*>(hc->_pXHCIOperationalRegisters));
+	free(const_cast<XHCIRuntimeRegisters*>(hc->_pXHCIRuntimeRegisters));
+	hc->~GenericUSBXHCI();
+	free(hc);
+}
+
+void SetEndpointState(GenericUSBXHCI* hc, int32_t endpoint, uint32_t epState)
+{
+	ContextStruct* pContext = hc->GetSlotContext(kTestSlot, endpoint);
+
+	pContext->_e.dwEpCtx0 = (pContext->_e.dwEpCtx0 & ~7U) | XHCI_EPCTX_0_EPSTATE_SET(epState);
+}
+
+XHCIAsyncEndpoint* NewAsyncEndpoint(GenericUSBXHCI* hc, int32_t endpoint, int32_t numPages,
+									uint32_t maxPacketSize, uint8_t epType, uint32_t maxStream)
+{
+	ringStruct* pRing = hc->CreateRing(kTestSlot, endpoint, maxStream);
+	ContextStruct* pContext = hc->GetSlotContext(kTestSlot, endpoint);
+
+	if (!pRing)
+		return 0;
+	if (maxStream > 1U) {
+		hc->SlotPtr(kTestSlot)->lastStreamForEndpoint[endpoint] = 1U;
+		++pRing;
+	}
+	if (hc->AllocRing(pRing, numPages) != kIOReturnSuccess)
+		return 0;
+	pRing->epType = epType;
+	pContext->_e.dwEpCtx1 = XHCI_EPCTX_1_MAXP_SIZE_SET(maxPacketSize);
+	SetEndpointState(hc, endpoint, EP_STATE_RUNNING);
+	pRing->asyncEndpoint = XHCIAsyncEndpoint::withParameters(hc, pRing, maxPacketSize, 0U, 0U);
+	if (pRing->asyncEndpoint && maxStream > 1U)
+		pRing->asyncEndpoint->streamId = 1U;
+	return pRing->asyncEndpoint;
+}
+
+IOUSBCommand* NewCommand(uint32_t numBytes, uint32_t segmentBytes, uint64_t physAddr)
+{
+	IOUSBCommand* command = new IOUSBCommand;
+	IOMemoryDescriptor* md = new IOMemoryDescriptor;
+	IODMACommand* dmaCommand = new IODMACommand;
+	uint32_t offset, length;
+
+	md->length = numBytes;
+	md->bytes = static_cast<uint8_t*>(calloc(1U, numBytes ? numBytes : 1U));
+	for (offset = 0U; offset < numBytes; ++offset)
+		md->bytes[offset] = static_cast<uint8_t>(offset + 1U);
+	/*
+	 * Note: Segments are spaced apart, so no two are contiguous
+	 */
+	dmaCommand->md = md;
+	for (offset = 0U; offset < numBytes; offset += length) {
+		length = numBytes - offset < segmentBytes ? numBytes - offset : segmentBytes;
+		if (dmaCommand->numFakeSegments >= IODMACommand::kMaxFakeSegments)
+			abort();
+		dmaCommand->fakeSegments[dmaCommand->numFakeSegments].fIOVMAddr = physAddr + 2U * offset;
+		dmaCommand->fakeSegments[dmaCommand->numFakeSegments].fLength = length;
+		++dmaCommand->numFakeSegments;
+	}
+	command->address = kTestAddress;
+	command->reqCount = numBytes;
+	command->buffer = md;
+	command->dmaCommand = dmaCommand;
+	return command;
+}
+
+static void LogCompletion(void* target, void*, IOReturn status, UInt32 bufferSizeRemaining)
+{
+	CompletionLog* pLog = static_cast<CompletionLog*>(target);
+
+	++pLog->count;
+	if (status != kIOReturnSuccess)
+		++pLog->failures;
+	pLog->lastStatus = status;
+	pLog->lastRemaining = bufferSizeRemaining;
+}
+
+void LogCompletions(IOUSBCommand* command, CompletionLog* pLog)
+{
+	command->uslCompletion.target = pLog;
+	command->uslCompletion.action = LogCompletion;
+}
+
+void DeleteCommand(IOUSBCommand* command)
+{
+	free(command->buffer->bytes);
+	delete command->buffer;
+	delete command->dmaCommand;
+	delete command;
+}
+
+#pragma mark -
+#pragma mark Fake xHC
+#pragma mark -
+
+void FakeXHCAttach(FakeXHCRing* pXHC, ringStruct const* pRing)
+{
+	bzero(pXHC, sizeof *pXHC);
+	pXHC->dequeue = pRing->physAddr + pRing->dequeueIndex * sizeof *pRing->ptr;
+	pXHC->cycleState = pRing->cycleState;
+}
+
+static bool FakeXHCInRing(ringStruct const* pRing, uint64_t addr)
+{
+	if (addr >= pRing->physAddr && addr < pRing->physAddr + pRing->numTRBs * sizeof *pRing->ptr)
+		return true;
+	if (pRing->retiredMd &&
+		addr >= reinterpret_cast<uint64_t>(pRing->retiredPtr) &&
+		addr < reinterpret_cast<uint64_t>(pRing->retiredPtr + pRing->retiredPages * (PAGE_SIZE / sizeof *pRing->ptr)))
+		return true;
+	return false;
+}
+
+uint32_t FakeXHCRun(GenericUSBXHCI* hc, ringStruct* pRing, FakeXHCRing* pXHC, uint32_t maxTRBs)
+{
+	TRBStruct const* pTrb;
+	TRBStruct event;
+	uint32_t numTRBs, trbType;
+
+	for (numTRBs = 0U; numTRBs < maxTRBs; ++numTRBs) {
+		if (!FakeXHCInRing(pRing, pXHC->dequeue)) {
+			pXHC->corrupt = true;
+			break;
+		}
+		pTrb = reinterpret_cast<TRBStruct const*>(pXHC->dequeue);
+		if (((pTrb->d & XHCI_TRB_3_CYCLE_BIT) != 0U) != (pXHC->cycleState != 0U))
+			break;
+		++pXHC->trbsConsumed;
+		trbType = XHCI_TRB_3_TYPE_GET(pTrb->d);
+		if (trbType == XHCI_TRB_TYPE_LINK) {
+			if (pTrb->d & XHCI_TRB_3_TC_BIT)
+				pXHC->cycleState ^= 1U;
+			pXHC->dequeue = GenericUSBXHCI::GetTRBAddr64(pTrb);
+			continue;
+		}
+		bzero(&event, sizeof event);
+		event.d = XHCI_TRB_3_TYPE_SET(XHCI_TRB_EVENT_TRANSFER) |
+			XHCI_TRB_3_SLOT_SET(pRing->slot) |
+			XHCI_TRB_3_EP_SET(pRing->endpoint);
+		if (trbType == XHCI_TRB_TYPE_EVENT_DATA) {
+			event.a = pTrb->a;
+			event.b = pTrb->b;
+			event.c = XHCI_TRB_2_ERROR_SET(XHCI_TRB_ERROR_SUCCESS) | XHCI_TRB_2_REM_SET(pXHC->edtla);
+			event.d |= XHCI_TRB_3_ED_BIT;
+			if (pXHC->edtla > pXHC->maxEdtla)
+				pXHC->maxEdtla = pXHC->edtla;
+			if (!pXHC->absoluteEDTLA || !(pTrb->d & XHCI_TRB_3_CHAIN_BIT))
+				pXHC->edtla = 0U;
+		} else {
+			GenericUSBXHCI::SetTRBAddr64(&event, pXHC->dequeue);
+			event.c = XHCI_TRB_2_ERROR_SET(XHCI_TRB_ERROR_SUCCESS);
+			if (trbType == XHCI_TRB_TYPE_NORMAL)
+				pXHC->edtla += XHCI_TRB_2_BYTES_GET(pTrb->c);
+		}
+		pXHC->dequeue += sizeof *pTrb;
+		if (pTrb->d & XHCI_TRB_3_IOC_BIT) {
+			++pXHC->events;
+			hc->processTransferEvent2(&event, 0);
+		}
+	}
+	hc->_completer.Flush();
+	return numTRBs;
+}
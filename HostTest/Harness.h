@@ -0,0 +1,146 @@
+//
+//  Harness.h
+//  GenericUSBXHCI
+//
+//  Host test and benchmark harness for the ring, TD and event ring code.
+//  The driver sources are compiled as they are against the stand-in
+//  headers in HostTest/include, with -Dprivate=public so tests can set
+//  up and inspect controller state directly.
+//
+
+#ifndef GenericUSBXHCI_Harness_h
+#define GenericUSBXHCI_Harness_h
+
+#include "GenericUSBXHCI.h"
+#include "Async.h"
+#include "Isoch.h"
+#include "XHCITypes.h"
+
+#pragma mark -
+#pragma mark Fakes
+#pragma mark -
+
+/*
+ * Note: Reset by the runner before each test
+ */
+struct HostFakes
+{
+	uint64_t clock;
+	int64_t mallocBytes;
+	int32_t liveBuffers;
+	uint32_t makeBufferCalls;
+	uint32_t genIOVMSegmentsCalls;
+	uint32_t doorbells;
+	uint32_t restartStreams;
+	uint32_t quiesces;
+	uint32_t resetEndpoints;
+	uint32_t commands;
+	int32_t lastCommandType;
+	TRBStruct lastCommand;
+	uint32_t timeoutChecks;
+	uint32_t cmdCompletions;
+	void (*cmdCompletionHook)(TRBStruct const*);	// replaces counting in cmdCompletions
+	bool timeoutsFound;
+	bool consumeCMDCompletions;
+	bool failMalloc;
+	bool failMakeBuffer;
+	bool verbose;
+};
+
+extern HostFakes gFakes;
+
+#pragma mark -
+#pragma mark Test Registry
+#pragma mark -
+
+typedef void (*HostTestFunc)(void);
+
+struct HostTest
+{
+	char const* name;
+	HostTestFunc func;
+	HostTest* next;
+
+	HostTest(char const*, HostTestFunc);
+};
+
+void HostTestFail(char const* file, int line, char const* expr);
+bool HostTestFailed(void);
+
+#define HOST_TEST(name) \
+	static void name(void); \
+	static HostTest name##_registration(#name, name); \
+	static void name(void)
+
+#define CHECK(expr) \
+	do { if (!(expr)) { HostTestFail(__FILE__, __LINE__, #expr); return; } } while (0)
+
+#pragma mark -
+#pragma mark Fixtures
+#pragma mark -
+
+#define kTestSlot 1
+#define kTestAddress 1
+
+/*
+ * Note: A controller with one slot and zeroed registers,
+ *   enough for the ring, TD and event ring code paths.
+ */
+GenericUSBXHCI* NewController(void);
+void DeleteController(GenericUSBXHCI*);
+
+/*
+ * Note: An async endpoint on kTestSlot in the running state.
+ *   maxStream > 1 makes it a stream endpoint, with stream 1 set up.
+ */
+XHCIAsyncEndpoint* NewAsyncEndpoint(GenericUSBXHCI*, int32_t endpoint, int32_t numPages,
+									uint32_t maxPacketSize, uint8_t epType, uint32_t maxStream = 0U);
+void SetEndpointState(GenericUSBXHCI*, int32_t endpoint, uint32_t epState);
+
+/*
+ * Note: A command on kTestAddress whose buffer has numBytes split
+ *   into segments of segmentBytes at a fake physical address.
+ */
+IOUSBCommand* NewCommand(uint32_t numBytes, uint32_t segmentBytes = PAGE_SIZE, uint64_t physAddr = 0x100000000ULL);
+void DeleteCommand(IOUSBCommand*);
+
+struct CompletionLog
+{
+	uint32_t count;
+	uint32_t failures;
+	IOReturn lastStatus;
+	uint32_t lastRemaining;
+};
+
+void LogCompletions(IOUSBCommand*, CompletionLog*);
+
+/*
+ * Note: Models the xHC consuming a transfer ring.  It follows Link TRBs
+ *   by physical address, which is the host address in this harness, so
+ *   a corrupt ring shows up as a cycle or link mismatch.  Each TRB with
+ *   IOC posts a Transfer Event to processTransferEvent2.
+ */
+struct FakeXHCRing
+{
+	uint64_t dequeue;
+	uint8_t cycleState;
+	uint32_t edtla;
+	uint32_t maxEdtla;
+	uint32_t trbsConsumed;
+	uint32_t events;
+	bool absoluteEDTLA;	// Note: EDTLA runs on across chained Event Data TRBs, as on ASMedia
+	bool corrupt;
+};
+
+void FakeXHCAttach(FakeXHCRing*, ringStruct const*);
+uint32_t FakeXHCRun(GenericUSBXHCI*, ringStruct*, FakeXHCRing*, uint32_t maxTRBs = UINT32_MAX);
+
+/*
+ * Note: _createTransfer before it was specialized into
+ *   _buildTransfer<>, see Reference.cpp
+ */
+IOReturn ReferenceCreateTransfer(GenericUSBXHCI*, void* pTd, bool isIsochTransfer, uint32_t bytesToTransfer, uint32_t mystery,
+								 size_t startingOffsetInBuffer, bool interruptNeeded, bool multiTDTransaction,
+								 uint32_t* pFirstTrbIndex, uint32_t* pTrbCount, int16_t* pLastTrbIndex);
+
+#endif
@@ -0,0 +1,41 @@
+//
+//  Main.cpp
+//  GenericUSBXHCI
+//
+//  Runs every registered host test, or those whose name
+//  contains one of the arguments.
+//
+
+#include "Harness.h"
+
+#include <stdio.h>
+
+extern HostTest* gHostTests;
+
+int main(int argc, char** argv)
+{
+	uint32_t run = 0U, failed = 0U;
+	bool selected;
+
+	for (HostTest* test = gHostTests; test; test = test->next) {
+		selected = argc < 2;
+		for (int i = 1; i < argc && !selected; ++i)
+			selected = strstr(test->name, argv[i]) != 0;
+		if (!selected)
+			continue;
+		bzero(&gFakes, sizeof gFakes);
+		test->func();
+		++run;
+		if (!HostTestFailed() && !gFakes.mallocBytes && !gFakes.liveBuffers) {
+			printf("PASS %s\n", test->name);
+			continue;
+		}
+		if (gFakes.mallocBytes || gFakes.liveBuffers)
+			fprintf(stderr, "    leaked %lld bytes, %d buffers\n",
+					static_cast<long long>(gFakes.mallocBytes), gFakes.liveBuffers);
+		printf("FAIL %s\n", test->name);
+		++failed;
+	}
+	printf("%u tests, %u failed\n", run, failed);
+	return failed ? 1 : 0;
+}
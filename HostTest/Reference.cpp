@@ -0,0 +1,235 @@
+//
+//  Reference.cpp
+//  GenericUSBXHCI
+//
+//  _createTransfer as it was before it was split into _buildTransfer
+//  specializations, with run-time tests for transfer kind and immediate
+//  data.  Ported to the current TD fields, and kept so tests and the
+//  benchmark can hold the specialized builders against it.
+//
+
+#include "Harness.h"
+
+IOReturn ReferenceCreateTransfer(GenericUSBXHCI* hc, void* pTd, bool isIsochTransfer, uint32_t bytesToTransfer, uint32_t mystery,
+								size_t startingOffsetInBuffer, bool interruptNeeded, bool multiTDTransaction,
+								uint32_t* pFirstTrbIndex, uint32_t* pTrbCount, int16_t* pLastTrbIndex)
+{
+	IODMACommand* command;
+	ringStruct* pRing;
+	ContextStruct* pContext;
+	TRBStruct *pFirstTrbInFragment, *pFirstTrbBefore, *pTrb;
+	SegmentCache localCache, *pCache;
+	IODMACommand::Segment64 localSegments[kSegmentCacheEntries];
+	size_t offsetInBuffer, residueEstimate, bytesFollowingThisTD, bytesPreceedingThisTD;
+	uint32_t bytesLeftInTD, bytesCurrentTrb, maxPacketSize, maxBurstSize, multiple, MBPMultiple, fourth, finalFourth;
+	int32_t lastTrbIndex, TrbCountInTD, TrbCountInFragment;
+	IOReturn rc;
+	uint32_t numTRBsInTD, irqTarget;
+	bool isNoopOrStatus, isFirstFragment, haveImmediateData, finalTDInTransaction;
+	uint8_t slot, endpoint, copyOfImmediateData[8];
+
+	offsetInBuffer = startingOffsetInBuffer;
+	bytesLeftInTD = bytesToTransfer;
+	pFirstTrbInFragment = 0;
+	localCache.command = 0;
+	localCache.numSegments = 0U;
+	localCache.maxSegments = kSegmentCacheEntries;
+	localCache.segments = &localSegments[0];
+	pCache = &localCache;
+	if (isIsochTransfer) {
+		GenericUSBXHCIIsochTD* pIsochTd = static_cast<GenericUSBXHCIIsochTD*>(pTd);
+		pRing = static_cast<GenericUSBXHCIIsochEP*>(pIsochTd->_pEndpoint)->pRing;
+		command = pIsochTd->command->GetDMACommand();
+		isNoopOrStatus = false;
+		bytesFollowingThisTD = 0U;
+		bytesPreceedingThisTD = 0U;
+		haveImmediateData = false;
+		finalTDInTransaction = false;
+		numTRBsInTD = (bytesToTransfer / PAGE_SIZE) + 3U;
+	} else {
+		XHCIAsyncTD* pATd = static_cast<XHCIAsyncTD*>(pTd);
+		/*
+		 * Note: For TRB chaining, a sub-transaction is a transaction of its own
+		 */
+		bytesFollowingThisTD = pATd->bytesFollowingThisTD;
+		finalTDInTransaction = pATd->finalTDInTransaction || pATd->lastTDInSubTransaction;
+		bytesPreceedingThisTD = pATd->bytesPreceedingThisTD - pATd->subTransactionOffset;
+		command = pATd->command->GetDMACommand();
+		pRing = pATd->provider->pRing;
+		pCache = &hc->_tdSegmentCache;
+		switch (XHCI_TRB_3_TYPE_GET(mystery)) {
+			case XHCI_TRB_TYPE_STATUS_STAGE:
+			case XHCI_TRB_TYPE_NOOP:
+				isNoopOrStatus = true;
+				break;
+			default:
+				isNoopOrStatus = false;
+				break;
+		}
+		haveImmediateData = pATd->haveImmediateData;
+		numTRBsInTD = pATd->numTRBsInTD;
+		if (haveImmediateData)
+			bcopy(&pATd->immediateData[0], &copyOfImmediateData[0], sizeof copyOfImmediateData);
+	}
+	slot = pRing->slot;
+	endpoint = pRing->endpoint;
+	irqTarget = XHCI_TRB_2_IRQ_SET(hc->InterrupterForEndpoint(pRing->epType));
+	pContext = hc->GetSlotContext(slot, endpoint);
+	maxPacketSize = XHCI_EPCTX_1_MAXP_SIZE_GET(pContext->_e.dwEpCtx1);
+	if (!maxPacketSize)
+		return kIOReturnBadArgument;
+	maxBurstSize = XHCI_EPCTX_1_MAXB_GET(pContext->_e.dwEpCtx1);
+	multiple = XHCI_EPCTX_0_MULT_GET(pContext->_e.dwEpCtx0);
+	MBPMultiple = maxPacketSize * (1U + maxBurstSize) * (1U + multiple);
+	residueEstimate = maxPacketSize + bytesFollowingThisTD - 1U;
+
+	isFirstFragment = true;
+	TrbCountInTD = 0;
+	fourth = 0U;
+	TrbCountInFragment = 0;
+	/*
+	 * TBD:
+	 *   If we call PutBackTRB and return an error, pTd is returned
+	 *     to the head of queuedTDs to be rescheduled later, but we may have
+	 *     already trigerred some TD fragments from it.  So pTd
+	 *     needs to be updated to reflect fragments completed.
+	 */
+	if (hc->PlaceEarlyLink(pRing, numTRBsInTD, !!bytesPreceedingThisTD))
+		++hc->_diagCounters[DIAGCTR_EARLYLINKS];
+	do {
+		pFirstTrbBefore = pFirstTrbInFragment;
+		pTrb = hc->GetNextTRB(pRing, 0, &pFirstTrbInFragment, isFirstFragment && !bytesPreceedingThisTD);
+		if (pFirstTrbBefore && pFirstTrbBefore != pFirstTrbInFragment)
+			++hc->_diagCounters[DIAGCTR_RELOCATIONS];
+		if (!pTrb) {
+			hc->PutBackTRB(pRing, pFirstTrbInFragment);
+			return kIOReturnInternalError;
+		}
+		finalFourth = fourth;
+		bytesCurrentTrb = bytesLeftInTD;
+		++TrbCountInFragment;
+		fourth = pTrb->d & XHCI_TRB_3_CYCLE_BIT;
+		fourth ^= XHCI_TRB_3_CYCLE_BIT;
+		if (haveImmediateData) {
+			if (bytesLeftInTD)
+				bcopy(&copyOfImmediateData[0], pTrb, bytesLeftInTD);
+		} else {
+			rc = hc->GenerateNextPhysicalSegment(pTrb,
+											 &bytesCurrentTrb,
+											 offsetInBuffer,
+											 command,
+											 pCache);
+			if (rc != kIOReturnSuccess) {
+				/*
+				 * TBD: The transaction should be aborted if this
+				 *   happens, since it means genIOVMSegments has
+				 *   failed and there's a defect in the memory descriptor.
+				 *   If the TD is requeued, it causes an infinite loop.
+				 */
+				hc->PutBackTRB(pRing, pFirstTrbInFragment);
+				return rc;
+			}
+		}
+		if (!bytesLeftInTD) {
+			pTrb->a = 0U;
+			pTrb->b = 0U;
+		}
+		bytesLeftInTD -= bytesCurrentTrb;
+		if (!bytesLeftInTD &&
+			!haveImmediateData &&
+			finalTDInTransaction &&
+			TrbCountInTD > 0)
+			fourth |= XHCI_TRB_3_ENT_BIT;
+		pTrb->c = irqTarget;
+		if (!isNoopOrStatus) {
+			uint32_t TDSize = static_cast<uint32_t>((residueEstimate + bytesLeftInTD) / maxPacketSize);
+			if (TDSize > 31U)
+				TDSize = 31U;
+			pTrb->c |= XHCI_TRB_2_TDSZ_SET(TDSize) | XHCI_TRB_2_BYTES_SET(bytesCurrentTrb);
+		}
+		fourth |= mystery ? : XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL);
+		if (!haveImmediateData)
+			fourth |= XHCI_TRB_3_CHAIN_BIT;
+		lastTrbIndex = static_cast<int32_t>(pTrb - pRing->ptr);
+		if (pFirstTrbInFragment != pTrb) {
+			pTrb->d = fourth;
+			fourth = finalFourth;
+		}
+		offsetInBuffer += bytesCurrentTrb;
+		if (offsetInBuffer &&
+			!isIsochTransfer &&
+			bytesLeftInTD &&
+			!(offsetInBuffer % MBPMultiple)) {
+			hc->CloseFragment(pRing, pFirstTrbInFragment, fourth);
+			pFirstTrbInFragment = 0;
+			isFirstFragment = false;
+			TrbCountInFragment = 0;
+		}
+		mystery = 0U;
+		++TrbCountInTD;
+	} while(bytesLeftInTD);
+
+	if (TrbCountInTD == 1) {
+		if (hc->GetRing(slot, endpoint, 0U)) {
+			if (interruptNeeded) {
+				fourth |= XHCI_TRB_3_IOC_BIT;
+				switch (XHCI_TRB_3_TYPE_GET(fourth)) {
+					case XHCI_TRB_TYPE_NORMAL:
+					case XHCI_TRB_TYPE_DATA_STAGE:
+					case XHCI_TRB_TYPE_ISOCH:
+						fourth |= XHCI_TRB_3_ISP_BIT;
+						break;
+				}
+			} else if (endpoint & 1U)	/* in/ctrl endpoint */
+				switch (XHCI_TRB_3_TYPE_GET(fourth)) {
+					case XHCI_TRB_TYPE_NORMAL:
+					case XHCI_TRB_TYPE_ISOCH:
+						fourth |= XHCI_TRB_3_BEI_BIT | XHCI_TRB_3_ISP_BIT;
+						break;
+					case XHCI_TRB_TYPE_DATA_STAGE:
+						fourth |= XHCI_TRB_3_ISP_BIT;
+						break;
+				}
+			fourth &= ~(XHCI_TRB_3_CHAIN_BIT | XHCI_TRB_3_ENT_BIT);
+			if (lastTrbIndex == static_cast<int32_t>(pRing->numTRBs) - 2)
+				pRing->ptr[pRing->numTRBs - 1U].d &= ~XHCI_TRB_3_CHAIN_BIT;
+		}
+	} else {
+		finalFourth = fourth;
+		pFirstTrbBefore = pFirstTrbInFragment;
+		pTrb = hc->GetNextTRB(pRing,
+						  (finalTDInTransaction || !multiTDTransaction) ? pTd : 0,
+						  &pFirstTrbInFragment,
+						  isFirstFragment && !bytesPreceedingThisTD);
+		if (pFirstTrbBefore && pFirstTrbBefore != pFirstTrbInFragment)
+			++hc->_diagCounters[DIAGCTR_RELOCATIONS];
+		if (!pTrb) {
+			hc->PutBackTRB(pRing, pFirstTrbInFragment);
+			return kIOReturnInternalError;
+		}
+		lastTrbIndex = static_cast<int32_t>(pTrb - pRing->ptr);
+		hc->SetTRBAddr64(pTrb, pRing->physAddr + lastTrbIndex * sizeof *pRing->ptr);
+		pTrb->c = irqTarget;
+		fourth = pTrb->d & XHCI_TRB_3_CYCLE_BIT;
+		fourth ^= (XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_EVENT_DATA) | XHCI_TRB_3_CYCLE_BIT);
+		if (multiTDTransaction && !finalTDInTransaction)
+			fourth |= XHCI_TRB_3_CHAIN_BIT;	// Note: chains TDs through their Event Data TRBs
+		++TrbCountInFragment;
+		++TrbCountInTD;
+		if (interruptNeeded)
+			fourth |= XHCI_TRB_3_IOC_BIT;
+		else if (endpoint & 1U) /* in/ctrl endpoint */
+			fourth |= XHCI_TRB_3_BEI_BIT | XHCI_TRB_3_IOC_BIT;
+		pTrb->d = fourth;
+		fourth = finalFourth;
+	}
+	if (TrbCountInFragment)
+		hc->CloseFragment(pRing, pFirstTrbInFragment, fourth);
+	if (pFirstTrbIndex)
+		*pFirstTrbIndex = pFirstTrbInFragment ? static_cast<uint32_t>(pFirstTrbInFragment - pRing->ptr) : UINT32_MAX;
+	if (pLastTrbIndex)
+		*pLastTrbIndex = static_cast<int16_t>(lastTrbIndex);
+	if (pTrbCount)
+		*pTrbCount = static_cast<uint32_t>(TrbCountInTD);
+	return kIOReturnSuccess;
+}
@@ -0,0 +1,429 @@
+//
+//  RingBench.cpp
+//  GenericUSBXHCI
+//
+//  Pushes transactions of several sizes through CreateTransfer and the
+//  fake xHC, and reports transactions, TRBs and TDs per second along with
+//  the ring diagnostic counters.  Numbers measure the driver's own
+//  enqueue and retire paths, so only compare runs on the same machine.
+//  Cycles are TSC ticks on x86, nanoseconds elsewhere.
+//
+
+#include "Harness.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double Seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+static uint64_t Cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return static_cast<uint64_t>(Seconds() * 1e9);
+#endif
+}
+
+/*
+ * Note: Fetches one DMA segment per genIOVMSegments call,
+ *   as GenerateNextPhysicalSegment did before batching
+ */
+static void OneSegmentPerFetch(GenericUSBXHCI* hc, XHCIAsyncEndpoint*)
+{
+	hc->_tdSegmentCache.maxSegments = 1U;
+}
+
+/*
+ * Note: CreateTransfer only uses Immediate Data with a max
+ *   packet size of 8 or more, so small OUT transfers go
+ *   through DMA segment generation as they did before IDT
+ */
+static void NoImmediateData(GenericUSBXHCI*, XHCIAsyncEndpoint* pAsyncEp)
+{
+	pAsyncEp->maxPacketSize = 4U;
+}
+
+/*
+ * Note: Caps TDs at kAsyncMaxFragmentSize, as before
+ *   TD sizes adapted to the requests seen
+ */
+static void FixedSizeTDs(GenericUSBXHCI* hc, XHCIAsyncEndpoint* pAsyncEp)
+{
+	hc->_tdBytesOverride = kAsyncMaxFragmentSize;
+	pAsyncEp->setParameters(pAsyncEp->maxPacketSize, pAsyncEp->maxBurst, pAsyncEp->multiple);
+}
+
+/*
+ * Note: Splits every transaction into page-sized TDs, so
+ *   the TD pool turns over once per page moved
+ */
+static void PageSizedTDs(GenericUSBXHCI* hc, XHCIAsyncEndpoint* pAsyncEp)
+{
+	hc->_tdBytesOverride = PAGE_SIZE;
+	pAsyncEp->maxTDBytes = PAGE_SIZE;
+}
+
+/*
+ * Note: depth transactions are kept queued, and the xHC is
+ *   run every time another one is added.  setup, if given,
+ *   adjusts the controller or endpoint before the run.
+ */
+static void Bench(char const* name, int32_t ringPages, uint32_t numBytes, uint32_t segmentBytes,
+				  uint8_t epType, uint32_t depth, uint32_t numTransactions,
+				  void (*setup)(GenericUSBXHCI*, XHCIAsyncEndpoint*) = 0)
+{
+	GenericUSBXHCI* hc = NewController();
+	int32_t endpoint = epType == BULK_IN_EP ? 3 : 2;
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, endpoint, ringPages, 512U, epType);
+	IOUSBCommand* commands[16];
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+	double start, elapsed, mebibytes;
+	uint64_t cycles;
+	uint32_t i, submitted, doorbells, genCalls;
+
+	if (!pAsyncEp || depth > 16U)
+		return;
+	if (setup)
+		setup(hc, pAsyncEp);
+	for (i = 0U; i < depth; ++i) {
+		commands[i] = NewCommand(numBytes, segmentBytes);
+		commands[i]->endpoint = 1U;
+		commands[i]->direction = endpoint & 1 ? kUSBIn : kUSBOut;
+		LogCompletions(commands[i], &log);
+	}
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	doorbells = gFakes.doorbells;
+	genCalls = gFakes.genIOVMSegmentsCalls;
+	start = Seconds();
+	cycles = Cycles();
+	for (submitted = 0U; submitted < numTransactions; ++submitted) {
+		while (submitted - log.count >= depth)
+			FakeXHCRun(hc, pAsyncEp->pRing, &xhc);
+		hc->CreateTransfer(commands[submitted % depth], 0U);
+	}
+	while (log.count < numTransactions && !xhc.corrupt)
+		FakeXHCRun(hc, pAsyncEp->pRing, &xhc);
+	cycles = Cycles() - cycles;
+	elapsed = Seconds() - start;
+	mebibytes = static_cast<double>(numBytes) * numTransactions / (1024.0 * 1024.0);
+	printf("%-28s %9.0f xact/s %11.0f TRB/s %10.0f TD/s  %5.2f doorbells/xact  %6.0f cycles/xact  "
+		   "%7.1f gen/MiB %8.1f events/MiB %10.0f cycles/MiB  "
+		   "relocations %d  early links %d  ring resizes %d  TD pool misses %d%s\n",
+		   name,
+		   numTransactions / elapsed,
+		   xhc.trbsConsumed / elapsed,
+		   pAsyncEp->stats.tdsCompleted / elapsed,
+		   static_cast<double>(gFakes.doorbells - doorbells) / numTransactions,
+		   static_cast<double>(cycles) / numTransactions,
+		   (gFakes.genIOVMSegmentsCalls - genCalls) / mebibytes,
+		   xhc.events / mebibytes,
+		   cycles / mebibytes,
+		   hc->_diagCounters[DIAGCTR_RELOCATIONS],
+		   hc->_diagCounters[DIAGCTR_EARLYLINKS],
+		   hc->_diagCounters[DIAGCTR_RINGRESIZE],
+		   hc->_diagCounters[DIAGCTR_TDPOOLMISS],
+		   xhc.corrupt || log.failures ? "  ** FAILED **" : "");
+	DeleteController(hc);
+	for (i = 0U; i < depth; ++i)
+		DeleteCommand(commands[i]);
+}
+
+/*
+ * Note: Alternates small and large transactions on one bulk
+ *   endpoint, and samples the TDs scheduled on the ring and
+ *   still queued each time the xHC is run.  The xHC consumes
+ *   at most 64 TRBs per run, so the ring backs up.
+ */
+static void BenchMixed(char const* name, uint32_t smallBytes, uint32_t largeBytes, uint32_t numTransactions)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, 3, 1, 512U, BULK_IN_EP);
+	IOUSBCommand* commands[8];
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+	double start, elapsed, scheduled = 0.0, queued = 0.0;
+	uint32_t i, submitted, samples = 0U, maxScheduled = 0U;
+
+	if (!pAsyncEp)
+		return;
+	for (i = 0U; i < 8U; ++i) {
+		commands[i] = NewCommand(i & 1U ? largeBytes : smallBytes);
+		commands[i]->endpoint = 1U;
+		commands[i]->direction = kUSBIn;
+		LogCompletions(commands[i], &log);
+	}
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	start = Seconds();
+	for (submitted = 0U; submitted < numTransactions || log.count < numTransactions; ) {
+		if (submitted < numTransactions && submitted - log.count < 8U) {
+			hc->CreateTransfer(commands[submitted % 8U], 0U);
+			++submitted;
+			continue;
+		}
+		i = XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs);
+		if (i > maxScheduled)
+			maxScheduled = i;
+		scheduled += i;
+		queued += XHCIAsyncEndpoint::NumTDs(&pAsyncEp->queuedTDs);
+		++samples;
+		FakeXHCRun(hc, pAsyncEp->pRing, &xhc, 64U);
+		if (xhc.corrupt)
+			break;
+	}
+	elapsed = Seconds() - start;
+	printf("%-28s %9.0f xact/s  TDs scheduled avg %5.1f max %3u  queued avg %5.1f  "
+		   "ring full stalls/xact %4.2f%s\n",
+		   name,
+		   numTransactions / elapsed,
+		   scheduled / samples,
+		   maxScheduled,
+		   queued / samples,
+		   static_cast<double>(pAsyncEp->stats.ringFullStalls) / numTransactions,
+		   xhc.corrupt || log.failures ? "  ** FAILED **" : "");
+	DeleteController(hc);
+	for (i = 0U; i < 8U; ++i)
+		DeleteCommand(commands[i]);
+}
+
+/*
+ * Note: Lays out the same TD numRounds times with _createTransfer,
+ *   or with the reference builder it was specialized from.  The ring
+ *   is marked empty after each round, so the TD walks round it.
+ */
+static double BuilderCyclesPerTRB(bool reference, bool out, uint32_t numBytes, uint32_t numRounds)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, out ? 2 : 3, 4, 512U, out ? BULK_OUT_EP : BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(numBytes);
+	static uint8_t const immediateData[8] = { 0U };
+	XHCIAsyncTD* pTd;
+	uint64_t cycles, trbs = 0U;
+	uint32_t round, first, count;
+	int16_t last;
+	IOReturn rc;
+
+	command->endpoint = 1U;
+	command->direction = out ? kUSBOut : kUSBIn;
+	if (!pAsyncEp ||
+		pAsyncEp->CreateTDs(command, 0U,
+							numBytes <= sizeof immediateData ? XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL) | XHCI_TRB_3_IDT_BIT : 0U,
+							numBytes <= sizeof immediateData ? static_cast<uint8_t>(numBytes) : 0xFFU,
+							&immediateData[0]) != kIOReturnSuccess ||
+		!(pTd = pAsyncEp->GetTD(&pAsyncEp->queuedTDs))) {
+		DeleteController(hc);
+		DeleteCommand(command);
+		return 0.0;
+	}
+	if (!pTd->numTRBsInTD)
+		pTd->numTRBsInTD = hc->CountTRBsInTD(&hc->_tdSegmentCache, command->dmaCommand, 0U, pTd->bytesThisTD);
+	cycles = Cycles();
+	for (round = 0U; round < numRounds; ++round) {
+		if (reference)
+			rc = ReferenceCreateTransfer(hc, pTd, false, pTd->bytesThisTD, pTd->mystery, 0U,
+										 pTd->interruptThisTD, pTd->multiTDTransaction, &first, &count, &last);
+		else
+			rc = hc->_createTransfer(pTd, false, pTd->bytesThisTD, pTd->mystery, 0U,
+									 pTd->interruptThisTD, pTd->multiTDTransaction, &first, &count, &last);
+		if (rc != kIOReturnSuccess)
+			break;
+		trbs += count;
+		pAsyncEp->pRing->dequeueIndex = pAsyncEp->pRing->enqueueIndex;
+	}
+	cycles = Cycles() - cycles;
+	pAsyncEp->PutTD(&pAsyncEp->doneTDs, pTd);
+	DeleteController(hc);
+	DeleteCommand(command);
+	return round == numRounds && trbs ? static_cast<double>(cycles) / trbs : 0.0;
+}
+
+static void BenchBuilder(char const* name, bool out, uint32_t numBytes, uint32_t numRounds)
+{
+	double specialized = BuilderCyclesPerTRB(false, out, numBytes, numRounds);
+	double reference = BuilderCyclesPerTRB(true, out, numBytes, numRounds);
+
+	printf("%-28s %9.1f cycles/TRB  reference %9.1f cycles/TRB%s\n",
+		   name,
+		   specialized,
+		   reference,
+		   specialized == 0.0 || reference == 0.0 ? "  ** FAILED **" : "");
+}
+
+/*
+ * Note: Keeps 16 transactions of numBytes outstanding on a bulk IN
+ *   ring of ringPages, with the xHC consuming at most 64 TRBs per
+ *   run.  Growth is cancelled after each run, so the ring keeps
+ *   its size throughout.
+ */
+static void BenchRingSize(int32_t ringPages, uint32_t numBytes, uint32_t numTransactions)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, 3, ringPages, 512U, BULK_IN_EP);
+	IOUSBCommand* commands[16];
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+	double start, elapsed;
+	uint32_t i, submitted, doorbells;
+	char name[32];
+
+	if (!pAsyncEp)
+		return;
+	for (i = 0U; i < 16U; ++i) {
+		commands[i] = NewCommand(numBytes);
+		commands[i]->endpoint = 1U;
+		commands[i]->direction = kUSBIn;
+		LogCompletions(commands[i], &log);
+	}
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	doorbells = gFakes.doorbells;
+	start = Seconds();
+	for (submitted = 0U; log.count < numTransactions && !xhc.corrupt; ) {
+		while (submitted < numTransactions && submitted - log.count < 16U)
+			hc->CreateTransfer(commands[submitted++ % 16U], 0U);
+		FakeXHCRun(hc, pAsyncEp->pRing, &xhc, 64U);
+		pAsyncEp->pRing->needsGrowth = false;
+	}
+	elapsed = Seconds() - start;
+	snprintf(name, sizeof name, "%uKB in, %d page ring", numBytes / 1024U, ringPages);
+	printf("%-28s %9.0f xact/s %11.0f TRB/s  %5.2f doorbells/xact  ring full stalls/xact %5.2f%s\n",
+		   name,
+		   numTransactions / elapsed,
+		   xhc.trbsConsumed / elapsed,
+		   static_cast<double>(gFakes.doorbells - doorbells) / numTransactions,
+		   static_cast<double>(pAsyncEp->stats.ringFullStalls) / numTransactions,
+		   xhc.corrupt || log.failures || pAsyncEp->pRing->numPages != ringPages ? "  ** FAILED **" : "");
+	DeleteController(hc);
+	for (i = 0U; i < 16U; ++i)
+		DeleteCommand(commands[i]);
+}
+
+/*
+ * Note: Bounces numEvents command completions through FilterEventRing,
+ *   an event ring's worth at a time, and times PollInterrupts draining
+ *   them with _eventBatchSize set to batchSize.
+ */
+static void BenchPollInterrupts(uint16_t batchSize, uint32_t numEvents)
+{
+	GenericUSBXHCI* hc = NewController();
+	EventRingStruct* ePtr = &hc->_eventRing[0];
+	TRBStruct* pTrb;
+	double elapsed = 0.0, start;
+	uint32_t done, i, n;
+	uint16_t index = 0U;
+	uint8_t cycleState = 1U;
+	char name[32];
+
+	hc->_eventBatchSize = batchSize;
+	if (hc->InitAnEventRing(0) != kIOReturnSuccess) {
+		DeleteController(hc);
+		return;
+	}
+	gFakes.cmdCompletions = 0U;
+	for (done = 0U; done < numEvents; done += n) {
+		n = numEvents - done;
+		if (n > ePtr->numxHCEntries - 1U)
+			n = ePtr->numxHCEntries - 1U;
+		for (i = 0U; i < n; ++i) {
+			pTrb = reinterpret_cast<TRBStruct*>(&ePtr->erstPtr[index]);
+			pTrb->a = done + i;
+			pTrb->b = 0U;
+			pTrb->c = XHCI_TRB_2_ERROR_SET(XHCI_TRB_ERROR_SUCCESS);
+			pTrb->d = XHCI_TRB_3_TYPE_SET(XHCI_TRB_EVENT_CMD_COMPLETE) | (cycleState ? XHCI_TRB_3_CYCLE_BIT : 0U);
+			if (++index >= ePtr->numxHCEntries) {
+				index = 0U;
+				cycleState ^= 1U;
+			}
+		}
+		while (hc->FilterEventRing(0, 0));
+		hc->postFilterEventRing(0);
+		start = Seconds();
+		hc->PollInterrupts(0);
+		elapsed += Seconds() - start;
+	}
+	snprintf(name, sizeof name, "PollInterrupts, batch %u", batchSize);
+	printf("%-28s %9.1f ns/event%s\n",
+		   name,
+		   elapsed * 1e9 / numEvents,
+		   gFakes.cmdCompletions != 2U * numEvents ? "  ** FAILED **" : "");
+	DeleteController(hc);
+}
+
+/*
+ * Note: Times Abort with numCommands small transactions
+ *   outstanding, most of them still queued.
+ */
+static void BenchAbort(uint32_t numCommands, uint32_t numRounds)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, 3, 1, 512U, BULK_IN_EP);
+	IOUSBCommand** commands = static_cast<IOUSBCommand**>(calloc(numCommands, sizeof *commands));
+	CompletionLog log = { 0 };
+	double elapsed = 0.0, start;
+	uint32_t i, round;
+
+	if (!pAsyncEp || !commands)
+		return;
+	for (i = 0U; i < numCommands; ++i) {
+		commands[i] = NewCommand(16U * 1024U);
+		commands[i]->endpoint = 1U;
+		commands[i]->direction = kUSBIn;
+		LogCompletions(commands[i], &log);
+	}
+	for (round = 0U; round < numRounds; ++round) {
+		for (i = 0U; i < numCommands; ++i)
+			hc->CreateTransfer(commands[i], 0U);
+		start = Seconds();
+		pAsyncEp->Abort();
+		hc->_completer.Flush();
+		elapsed += Seconds() - start;
+		hc->InitPreallocedRing(pAsyncEp->pRing);
+	}
+	printf("%-28s %9.1f us/abort  %5u commands%s\n",
+		   "abort, 16KB in",
+		   elapsed * 1e6 / numRounds,
+		   numCommands,
+		   log.count != numCommands * numRounds ? "  ** FAILED **" : "");
+	DeleteController(hc);
+	for (i = 0U; i < numCommands; ++i)
+		DeleteCommand(commands[i]);
+	free(commands);
+}
+
+int main(int, char**)
+{
+	bzero(&gFakes, sizeof gFakes);
+	Bench("8B out, immediate", 1, 8U, PAGE_SIZE, BULK_OUT_EP, 8U, 2000000U);
+	Bench("8B out, DMA", 1, 8U, PAGE_SIZE, BULK_OUT_EP, 8U, 2000000U, NoImmediateData);
+	Bench("512B in", 1, 512U, PAGE_SIZE, BULK_IN_EP, 8U, 2000000U);
+	Bench("16KB in, 4KB pages", 1, 16U * 1024U, PAGE_SIZE, BULK_IN_EP, 8U, 500000U);
+	Bench("64KB in, 4KB pages", 2, 64U * 1024U, PAGE_SIZE, BULK_IN_EP, 8U, 200000U);
+	Bench("64KB in, contiguous", 2, 64U * 1024U, 64U * 1024U, BULK_IN_EP, 8U, 500000U);
+	Bench("256KB in, 4KB pages", 1, 256U * 1024U, PAGE_SIZE, BULK_IN_EP, 4U, 40000U);
+	Bench("256KB in, 128KB TDs", 1, 256U * 1024U, PAGE_SIZE, BULK_IN_EP, 4U, 40000U, FixedSizeTDs);
+	Bench("1MB in, 4KB pages", 1, 1024U * 1024U, PAGE_SIZE, BULK_IN_EP, 4U, 10000U);
+	Bench("1MB in, 128KB TDs", 1, 1024U * 1024U, PAGE_SIZE, BULK_IN_EP, 4U, 10000U, FixedSizeTDs);
+	Bench("1MB in, 1 segment/fetch", 1, 1024U * 1024U, PAGE_SIZE, BULK_IN_EP, 4U, 10000U, OneSegmentPerFetch);
+	Bench("1MB in, 4KB TDs", 1, 1024U * 1024U, PAGE_SIZE, BULK_IN_EP, 4U, 10000U, PageSizedTDs);
+	Bench("1MB out, 4KB pages", 4, 1024U * 1024U, PAGE_SIZE, BULK_OUT_EP, 4U, 10000U);
+	BenchBuilder("build, 8B out immediate", true, 8U, 2000000U);
+	BenchBuilder("build, 512B in", false, 512U, 2000000U);
+	BenchBuilder("build, 64KB in, 4KB pages", false, 64U * 1024U, 200000U);
+	for (int32_t ringPages = 1; ringPages <= 8; ringPages *= 2)
+		BenchRingSize(ringPages, 64U * 1024U, 200000U);
+	for (int32_t ringPages = 1; ringPages <= 8; ringPages *= 2)
+		BenchRingSize(ringPages, 256U * 1024U, 50000U);
+	BenchMixed("mixed 512B/256KB in", 512U, 256U * 1024U, 100000U);
+	BenchMixed("mixed 512B/1MB in", 512U, 1024U * 1024U, 20000U);
+	BenchPollInterrupts(1U, 2000000U);
+	BenchPollInterrupts(64U, 2000000U);
+	BenchAbort(500U, 200U);
+	return 0;
+}
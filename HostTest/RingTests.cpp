@@ -0,0 +1,242 @@
+//
+//  RingTests.cpp
+//  GenericUSBXHCI
+//
+//  Transfer ring layout: allocation, TRB enqueue, wrap, space accounting.
+//
+
+#include "Harness.h"
+
+static void FillTRB(ringStruct* pRing, TRBStruct** ppFirstTrbInFragment, bool last)
+{
+	TRBStruct* pTrb = GenericUSBXHCI::GetNextTRB(pRing, last ? pRing : 0, ppFirstTrbInFragment, true);
+	if (pTrb)
+		pTrb->d |= XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL) | (last ? XHCI_TRB_3_IOC_BIT : XHCI_TRB_3_CHAIN_BIT);
+}
+
+/*
+ * Note: Queues a one-TRB TD with the right cycle bit, and closes it
+ */
+static bool QueueTD(ringStruct* pRing)
+{
+	TRBStruct* pFirstTrbInFragment = 0;
+	TRBStruct* pTrb = GenericUSBXHCI::GetNextTRB(pRing, pRing, &pFirstTrbInFragment, true);
+	uint32_t fourth;
+
+	if (!pTrb)
+		return false;
+	fourth = pTrb->d & XHCI_TRB_3_CYCLE_BIT;
+	fourth ^= XHCI_TRB_3_CYCLE_BIT;
+	fourth |= XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL) | XHCI_TRB_3_IOC_BIT;
+	GenericUSBXHCI::CloseFragment(pRing, pFirstTrbInFragment, fourth);
+	return true;
+}
+
+HOST_TEST(AllocRingSetsUpLinkTRB)
+{
+	GenericUSBXHCI* hc = NewController();
+	ringStruct ring;
+
+	bzero(&ring, sizeof ring);
+	CHECK(hc->AllocRing(&ring, 2) == kIOReturnSuccess);
+	CHECK(ring.numTRBs == 2U * PAGE_SIZE / sizeof(TRBStruct));
+	CHECK(ring.numPages == 2U && ring.basePages == 2U);
+	CHECK(ring.cycleState == 1U);
+	CHECK(XHCI_TRB_3_TYPE_GET(ring.ptr[ring.numTRBs - 1U].d) == XHCI_TRB_TYPE_LINK);
+	CHECK(ring.ptr[ring.numTRBs - 1U].d & XHCI_TRB_3_TC_BIT);
+	CHECK(GenericUSBXHCI::GetTRBAddr64(&ring.ptr[ring.numTRBs - 1U]) == ring.physAddr);
+	CHECK(GenericUSBXHCI::CheckRingInvariants(&ring));
+	hc->DeallocRing(&ring);
+	DeleteController(hc);
+}
+
+HOST_TEST(RingWrapsKeepingInvariants)
+{
+	GenericUSBXHCI* hc = NewController();
+	ringStruct ring;
+	uint32_t i, queued;
+
+	bzero(&ring, sizeof ring);
+	CHECK(hc->AllocRing(&ring, 1) == kIOReturnSuccess);
+	/*
+	 * Note: Three full turns, retiring as we go like the xHC would
+	 */
+	for (i = 0U; i < 3U * ring.numTRBs; ++i) {
+		CHECK(QueueTD(&ring));
+		CHECK(GenericUSBXHCI::CheckRingInvariants(&ring));
+		ring.dequeueIndex = ring.enqueueIndex;
+	}
+	/*
+	 * Note: A full ring keeps one slot open
+	 */
+	for (queued = 0U; QueueTD(&ring); ++queued)
+		CHECK(GenericUSBXHCI::CheckRingInvariants(&ring));
+	CHECK(queued == ring.numTRBs - 2U);
+	hc->DeallocRing(&ring);
+	DeleteController(hc);
+}
+
+HOST_TEST(CanTDFragmentFitArithmetic)
+{
+	ringStruct ring;
+
+	bzero(&ring, sizeof ring);
+	ring.numTRBs = 256U;
+	/*
+	 * Empty ring at start: all but link TRB and one spare
+	 */
+	CHECK(GenericUSBXHCI::CanTDFragmentFit(&ring, 254U));
+	CHECK(!GenericUSBXHCI::CanTDFragmentFit(&ring, 255U));
+	CHECK(GenericUSBXHCI::FreeSlotsOnRing(&ring) == 253U);
+	/*
+	 * Enqueue behind dequeue: strictly the gap less one
+	 */
+	ring.enqueueIndex = 10U;
+	ring.dequeueIndex = 20U;
+	CHECK(GenericUSBXHCI::CanTDFragmentFit(&ring, 9U));
+	CHECK(!GenericUSBXHCI::CanTDFragmentFit(&ring, 10U));
+	CHECK(GenericUSBXHCI::FreeSlotsOnRing(&ring) == 9U);
+	/*
+	 * Enqueue ahead: the larger of tail and head space
+	 */
+	ring.enqueueIndex = 250U;
+	ring.dequeueIndex = 100U;
+	CHECK(GenericUSBXHCI::CanTDFragmentFit(&ring, 99U));
+	CHECK(!GenericUSBXHCI::CanTDFragmentFit(&ring, 100U));
+	ring.enqueueIndex = 100U;
+	ring.dequeueIndex = 20U;
+	CHECK(GenericUSBXHCI::CanTDFragmentFit(&ring, 155U));
+	CHECK(!GenericUSBXHCI::CanTDFragmentFit(&ring, 156U));
+	/*
+	 * Full ring
+	 */
+	ring.enqueueIndex = 19U;
+	CHECK(!GenericUSBXHCI::CanTDFragmentFit(&ring, 1U));
+	CHECK(GenericUSBXHCI::FreeSlotsOnRing(&ring) == 0U);
+	/*
+	 * Cached room follows a resize with the same indices
+	 */
+	ring.enqueueIndex = 0U;
+	ring.dequeueIndex = 0U;
+	CHECK(GenericUSBXHCI::CanTDFragmentFit(&ring, 254U));
+	ring.numTRBs = 512U;
+	CHECK(GenericUSBXHCI::CanTDFragmentFit(&ring, 510U));
+	CHECK(!GenericUSBXHCI::CanTDFragmentFit(&ring, 511U));
+}
+
+HOST_TEST(NextTransferDQSkipsLinks)
+{
+	GenericUSBXHCI* hc = NewController();
+	ringStruct ring;
+
+	bzero(&ring, sizeof ring);
+	CHECK(hc->AllocRing(&ring, 1) == kIOReturnSuccess);
+	ring.enqueueIndex = 5U;
+	CHECK(GenericUSBXHCI::NextTransferDQ(&ring, 3) == 4U);
+	CHECK(GenericUSBXHCI::NextTransferDQ(&ring, ring.numTRBs - 2U) == 0U);
+	ring.ptr[4].d = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_LINK);
+	ring.enqueueIndex = 100U;
+	CHECK(GenericUSBXHCI::NextTransferDQ(&ring, 3) == 0U);
+	hc->DeallocRing(&ring);
+	DeleteController(hc);
+}
+
+/*
+ * Note: A fragment that would straddle the link TRB is moved to
+ *   the start of the ring, and can still be put back from there.
+ */
+HOST_TEST(FragmentRelocatesAcrossWrapAndPutsBack)
+{
+	GenericUSBXHCI* hc = NewController();
+	TRBStruct* pFirstTrbInFragment = 0;
+	ringStruct ring;
+
+	bzero(&ring, sizeof ring);
+	CHECK(hc->AllocRing(&ring, 1) == kIOReturnSuccess);
+	ring.enqueueIndex = ring.numTRBs - 3U;
+	ring.dequeueIndex = 40U;
+	FillTRB(&ring, &pFirstTrbInFragment, false);
+	FillTRB(&ring, &pFirstTrbInFragment, false);
+	CHECK(ring.enqueueIndex == 0U && ring.cycleState == 0U);
+	FillTRB(&ring, &pFirstTrbInFragment, true);
+	CHECK(pFirstTrbInFragment == ring.ptr);
+	CHECK(ring.enqueueIndex == 3U);
+	CHECK(XHCI_TRB_3_TYPE_GET(ring.ptr[ring.numTRBs - 3U].d) == XHCI_TRB_TYPE_LINK);
+	GenericUSBXHCI::PutBackTRB(&ring, pFirstTrbInFragment);
+	CHECK(ring.enqueueIndex == 0U);
+	CHECK(ring.cycleState == 0U);
+	hc->DeallocRing(&ring);
+	DeleteController(hc);
+}
+
+/*
+ * Note: Once the slabs are used up rings come from MakeBuffer,
+ *   and a full size ring must still not cross 64KB.
+ */
+HOST_TEST(FallbackRingDoesNotCross64KB)
+{
+	GenericUSBXHCI* hc = NewController();
+	ringStruct rings[kMaxRingSlabs + 1U];
+	uint32_t i;
+
+	bzero(&rings[0], sizeof rings);
+	for (i = 0U; i <= kMaxRingSlabs; ++i)
+		CHECK(hc->AllocRing(&rings[i], kMaxTransferRingPages) == kIOReturnSuccess);
+	CHECK(hc->_ringSlabStats.fallbacks == 1U);
+	CHECK(!(rings[kMaxRingSlabs].physAddr & 0xFFFFULL));
+	for (i = 0U; i <= kMaxRingSlabs; ++i)
+		hc->DeallocRing(&rings[i]);
+	DeleteController(hc);
+}
+
+/*
+ * Note: speed is an xHCI speed (XDEV_*)
+ */
+static uint32_t RingPagesAtSpeed(GenericUSBXHCI* hc, uint32_t speed, int32_t endpointType, uint32_t maxBurst)
+{
+	hc->GetSlotContext(kTestSlot)->_s.dwSctx0 = 0U;
+	GenericUSBXHCI::SetSlCtxSpeed(hc->GetSlotContext(kTestSlot), speed);
+	return hc->RingPagesForEndpoint(kTestSlot, endpointType, maxBurst);
+}
+
+HOST_TEST(RingPagesFollowEndpointPolicy)
+{
+	GenericUSBXHCI* hc = NewController();
+
+	CHECK(RingPagesAtSpeed(hc, XDEV_HS, CTRL_EP, 0U) == 1U);
+	CHECK(RingPagesAtSpeed(hc, XDEV_SS, INT_IN_EP, 0U) == 1U);
+	CHECK(RingPagesAtSpeed(hc, XDEV_SS, INT_OUT_EP, 0U) == 1U);
+	CHECK(RingPagesAtSpeed(hc, XDEV_FS, BULK_IN_EP, 0U) == 1U);
+	CHECK(RingPagesAtSpeed(hc, XDEV_HS, BULK_OUT_EP, 0U) == 2U);
+	CHECK(RingPagesAtSpeed(hc, XDEV_SS, BULK_IN_EP, 0U) == 1U);
+	CHECK(RingPagesAtSpeed(hc, XDEV_SS, BULK_IN_EP, 15U) == 4U);
+	/*
+	 * Note: Overrides win, but stay within kMaxTransferRingPages
+	 */
+	hc->_ringPagesOverride.bulk = 3U;
+	hc->_ringPagesOverride.bulkSS = 40U;
+	hc->_ringPagesOverride.interrupt = 2U;
+	CHECK(RingPagesAtSpeed(hc, XDEV_HS, BULK_IN_EP, 0U) == 3U);
+	CHECK(RingPagesAtSpeed(hc, XDEV_SS, BULK_OUT_EP, 3U) == kMaxTransferRingPages);
+	CHECK(RingPagesAtSpeed(hc, XDEV_LS, INT_IN_EP, 0U) == 2U);
+	DeleteController(hc);
+}
+
+HOST_TEST(SlabRingsDoNotCross64KB)
+{
+	GenericUSBXHCI* hc = NewController();
+	ringStruct rings[24];
+	uint64_t first, last;
+	uint32_t i;
+
+	bzero(&rings[0], sizeof rings);
+	for (i = 0U; i < 24U; ++i) {
+		CHECK(hc->AllocRing(&rings[i], static_cast<int32_t>(1U + (i * 7U) % kRingSlabPages)) == kIOReturnSuccess);
+		first = rings[i].physAddr;
+		last = first + rings[i].numPages * PAGE_SIZE - 1U;
+		CHECK((first >> 16) == (last >> 16));
+	}
+	for (i = 0U; i < 24U; ++i)
+		hc->DeallocRing(&rings[i]);
+	DeleteController(hc);
+}
@@ -0,0 +1,152 @@
+//
+//  TimeoutWheelTests.cpp
+//  GenericUSBXHCI
+//
+//  Timer wheel for async endpoint timeouts.
+//
+
+#include "Harness.h"
+
+#define kBulkInEndpoint 3
+#define kWheelTurn (kTimeoutWheelBuckets << kTimeoutWheelShift)
+
+HOST_TEST(WheelVisitsEndpointWhenDue)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP);
+
+	CHECK(pAsyncEp);
+	hc->ArmTimeoutWheel(pAsyncEp, 5000U);
+	CHECK(pAsyncEp->wheelLink);
+	hc->ExpireTimeoutWheel(4999U);
+	CHECK(!gFakes.timeoutChecks);
+	CHECK(pAsyncEp->wheelLink);
+	hc->ExpireTimeoutWheel(5000U);
+	CHECK(gFakes.timeoutChecks == 1U);
+	CHECK(!pAsyncEp->wheelLink);
+	DeleteController(hc);
+}
+
+HOST_TEST(WheelKeepsFarEntriesUntilDue)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP);
+	uint32_t frame, due = 3U * kWheelTurn + 77U;
+
+	CHECK(pAsyncEp);
+	hc->ArmTimeoutWheel(pAsyncEp, due);
+	for (frame = 1U << kTimeoutWheelShift; frame < due; frame += 1U << kTimeoutWheelShift) {
+		hc->ExpireTimeoutWheel(frame);
+		CHECK(!gFakes.timeoutChecks);
+		CHECK(pAsyncEp->wheelLink);
+	}
+	hc->ExpireTimeoutWheel(due);
+	CHECK(gFakes.timeoutChecks == 1U);
+	DeleteController(hc);
+}
+
+HOST_TEST(WheelRearmsEarlierAndDisarms)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP);
+
+	CHECK(pAsyncEp);
+	hc->ArmTimeoutWheel(pAsyncEp, 9000U);
+	hc->ArmTimeoutWheel(pAsyncEp, 12000U);
+	CHECK(pAsyncEp->wheelFrame == 9000U);
+	hc->ArmTimeoutWheel(pAsyncEp, 3000U);
+	CHECK(pAsyncEp->wheelFrame == 3000U);
+	hc->DisarmTimeoutWheel(pAsyncEp);
+	CHECK(!pAsyncEp->wheelLink);
+	hc->ExpireTimeoutWheel(20000U);
+	CHECK(!gFakes.timeoutChecks);
+	DeleteController(hc);
+}
+
+HOST_TEST(EndpointWithoutTimeoutsStaysOffWheel)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(512U);
+	uint32_t frame;
+
+	CHECK(pAsyncEp);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(XHCIAsyncEndpoint::NumTDs(&pAsyncEp->scheduledTDs));
+	CHECK(!pAsyncEp->wheelLink);
+	for (frame = 1U; frame <= 2U * kWheelTurn; ++frame)
+		hc->ExpireTimeoutWheel(frame);
+	CHECK(!gFakes.timeoutChecks);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+HOST_TEST(WheelVisitsAtCompletionDeadline)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP);
+	IOUSBCommand* command = NewCommand(512U);
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+	uint32_t frame;
+
+	CHECK(pAsyncEp);
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBIn;
+	command->completionTimeout = 2000U;
+	FakeXHCAttach(&xhc, pAsyncEp->pRing);
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(pAsyncEp->wheelLink);
+	CHECK(pAsyncEp->timeoutFrame == 1U);
+	/*
+	 * Note: Stamped as UpdateTimeouts would on the first visit
+	 */
+	command->SetUIMScratch(5U, 1U);
+	hc->ExpireTimeoutWheel(1U);
+	CHECK(gFakes.timeoutChecks == 1U);
+	CHECK(pAsyncEp->timeoutFrame == 2002U);
+	for (frame = 2U; frame < 2002U; ++frame)
+		hc->ExpireTimeoutWheel(frame);
+	CHECK(gFakes.timeoutChecks == 1U);
+	hc->ExpireTimeoutWheel(2002U);
+	CHECK(gFakes.timeoutChecks == 2U);
+	CHECK(pAsyncEp->wheelLink);
+	FakeXHCRun(hc, pAsyncEp->pRing, &xhc);
+	CHECK(log.count == 1U);
+	CHECK(!pAsyncEp->timeoutFrame);
+	for (frame = 2003U; frame < 2003U + kWheelTurn; ++frame)
+		hc->ExpireTimeoutWheel(frame);
+	CHECK(gFakes.timeoutChecks == 3U);
+	CHECK(!pAsyncEp->wheelLink);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+HOST_TEST(StreamsRestartOncePerEndpoint)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkInEndpoint, 1, 512U, BULK_IN_EP, 2U);
+	ringStruct* pRing;
+	XHCIAsyncEndpoint* pStreamEp;
+
+	CHECK(pAsyncEp);
+	hc->SlotPtr(kTestSlot)->lastStreamForEndpoint[kBulkInEndpoint] = 2U;
+	pRing = hc->GetRing(kTestSlot, kBulkInEndpoint, 2U);
+	CHECK(pRing);
+	CHECK(hc->AllocRing(pRing, 1) == kIOReturnSuccess);
+	pRing->epType = BULK_IN_EP;
+	pStreamEp = pRing->asyncEndpoint = XHCIAsyncEndpoint::withParameters(hc, pRing, 512U, 0U, 0U);
+	CHECK(pStreamEp);
+	pStreamEp->streamId = 2U;
+	gFakes.timeoutsFound = true;
+	hc->ArmTimeoutWheel(pAsyncEp, 100U);
+	hc->ArmTimeoutWheel(pStreamEp, 100U);
+	hc->ExpireTimeoutWheel(100U);
+	CHECK(gFakes.timeoutChecks == 2U);
+	CHECK(gFakes.restartStreams == 1U);
+	CHECK(!pAsyncEp->wheelLink && !pStreamEp->wheelLink);
+	DeleteController(hc);
+}
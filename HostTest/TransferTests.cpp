@@ -0,0 +1,410 @@
+//
+//  TransferTests.cpp
+//  GenericUSBXHCI
+//
+//  TRB layout of a TD: DMA segments, TRB counts, immediate data,
+//  early links and the TRBs _buildTransfer writes, also against
+//  the reference _createTransfer.
+//
+
+#include "Harness.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define kBulkOutEndpoint 2
+
+static void InitSegmentCache(SegmentCache* pCache, IODMACommand::Segment64* pSegments)
+{
+	bzero(pCache, sizeof *pCache);
+	pCache->segments = pSegments;
+	pCache->maxSegments = kSegmentCacheEntries;
+}
+
+/*
+ * Note: 40 segments through a 16 entry cache take 3 fetches,
+ *   not one per TRB.
+ */
+HOST_TEST(SegmentCacheFetchesInBatches)
+{
+	IOUSBCommand* command = NewCommand(40U * PAGE_SIZE);
+	IODMACommand::Segment64 segments[kSegmentCacheEntries];
+	SegmentCache cache;
+	TRBStruct trb;
+	uint32_t length;
+	size_t offset;
+
+	InitSegmentCache(&cache, &segments[0]);
+	for (offset = 0U; offset < 40U * PAGE_SIZE; offset += length) {
+		length = static_cast<uint32_t>(40U * PAGE_SIZE - offset);
+		CHECK(GenericUSBXHCI::GenerateNextPhysicalSegment(&trb, &length, offset, command->dmaCommand, &cache) == kIOReturnSuccess);
+		CHECK(length == PAGE_SIZE);
+		CHECK(GenericUSBXHCI::GetTRBAddr64(&trb) == 0x100000000ULL + 2U * offset);
+	}
+	CHECK(command->dmaCommand->genCalls == (40U + kSegmentCacheEntries - 1U) / kSegmentCacheEntries);
+	DeleteCommand(command);
+}
+
+HOST_TEST(SegmentIsClippedAt64KB)
+{
+	IOUSBCommand* command = NewCommand(0x18000U, 0x18000U, 0x100008000ULL);
+	IODMACommand::Segment64 segments[kSegmentCacheEntries];
+	SegmentCache cache;
+	TRBStruct trb;
+	uint32_t length;
+
+	InitSegmentCache(&cache, &segments[0]);
+	length = 0x18000U;
+	CHECK(GenericUSBXHCI::GenerateNextPhysicalSegment(&trb, &length, 0U, command->dmaCommand, &cache) == kIOReturnSuccess);
+	CHECK(length == 0x8000U);
+	length = 0x10000U;
+	CHECK(GenericUSBXHCI::GenerateNextPhysicalSegment(&trb, &length, 0x8000U, command->dmaCommand, &cache) == kIOReturnSuccess);
+	CHECK(length == 0x10000U);
+	CHECK(GenericUSBXHCI::GetTRBAddr64(&trb) == 0x100010000ULL);
+	CHECK(command->dmaCommand->genCalls == 1U);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: The segments fetched to count a TD's TRBs are the
+ *   ones _buildTransfer writes, so there's one fetch per TD.
+ */
+HOST_TEST(TDSegmentsAreFetchedOnce)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 1, 512U, BULK_OUT_EP);
+	IOUSBCommand* command = NewCommand(32U * PAGE_SIZE);
+	XHCIAsyncTD* pTd;
+
+	CHECK(pAsyncEp);
+	command->endpoint = 1U;
+	command->direction = kUSBOut;
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(command->dmaCommand->genCalls == 1U);
+	pTd = pAsyncEp->PeekTD(&pAsyncEp->scheduledTDs);
+	CHECK(pTd);
+	CHECK(pTd->numTRBsInTD == 33U);
+	CHECK(pTd->TrbCount == 33U);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+HOST_TEST(CountTRBsInTDEstimatesWithoutSegments)
+{
+	IODMACommand::Segment64 segments[kSegmentCacheEntries];
+	SegmentCache cache;
+
+	InitSegmentCache(&cache, &segments[0]);
+	CHECK(GenericUSBXHCI::CountTRBsInTD(&cache, static_cast<IODMACommand*>(0), 0U, 3U * PAGE_SIZE) == 5U);
+	CHECK(GenericUSBXHCI::CountTRBsInTD(&cache, static_cast<IODMACommand*>(0), 0U, 3U * PAGE_SIZE + 1U) == 6U);
+	CHECK(!cache.numSegments);
+}
+
+/*
+ * Note: More segments than the cache holds are still counted exactly
+ */
+HOST_TEST(CountTRBsInTDBeyondCache)
+{
+	IOUSBCommand* command = NewCommand(40U * PAGE_SIZE);
+	IODMACommand::Segment64 segments[kSegmentCacheEntries];
+	SegmentCache cache;
+
+	InitSegmentCache(&cache, &segments[0]);
+	CHECK(GenericUSBXHCI::CountTRBsInTD(&cache, command->dmaCommand, PAGE_SIZE, 39U * PAGE_SIZE) == 40U);
+	CHECK(cache.command == command->dmaCommand);
+	CHECK(cache.cursorOffset == PAGE_SIZE);
+	CHECK(cache.numSegments == kSegmentCacheEntries);
+	CHECK(cache.segments[0].fIOVMAddr == 0x100000000ULL + 2U * PAGE_SIZE);
+	DeleteCommand(command);
+}
+
+static bool SendsImmediate(uint32_t maxPacketSize, uint32_t maxStream)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 1, maxPacketSize, BULK_OUT_EP, maxStream);
+	IOUSBCommand* command = NewCommand(8U);
+	XHCIAsyncTD* pTd;
+	bool immediate = false;
+
+	command->endpoint = 1U;
+	command->direction = kUSBOut;
+	if (pAsyncEp &&
+		hc->CreateTransfer(command, maxStream ? 1U : 0U) == kIOReturnSuccess &&
+		(pTd = pAsyncEp->PeekTD(&pAsyncEp->scheduledTDs)) != 0) {
+		TRBStruct const* pTrb = &pAsyncEp->pRing->ptr[pTd->firstTrbIndex];
+		immediate = pTd->haveImmediateData;
+		if (immediate != !!(pTrb->d & XHCI_TRB_3_IDT_BIT) ||
+			(immediate && pTrb->a != 0x04030201U))
+			immediate = false;
+	}
+	DeleteController(hc);
+	DeleteCommand(command);
+	return immediate;
+}
+
+HOST_TEST(ImmediateDataOnlyWhereAllowed)
+{
+	CHECK(SendsImmediate(512U, 0U));
+	CHECK(SendsImmediate(8U, 0U));
+	CHECK(!SendsImmediate(4U, 0U));
+	CHECK(!SendsImmediate(512U, 2U));
+}
+
+/*
+ * Note: A TD that won't fit before the link TRB goes to the start of
+ *   the ring behind an early link, without relocating a fragment.
+ */
+HOST_TEST(EarlyLinkInsteadOfRelocation)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 1, 512U, BULK_OUT_EP);
+	IOUSBCommand* command = NewCommand(32U * PAGE_SIZE);
+	CompletionLog log = { 0 };
+	FakeXHCRing xhc;
+	XHCIAsyncTD* pTd;
+	ringStruct* pRing;
+	uint32_t i;
+
+	CHECK(pAsyncEp);
+	pRing = pAsyncEp->pRing;
+	LogCompletions(command, &log);
+	command->endpoint = 1U;
+	command->direction = kUSBOut;
+	/*
+	 * Note: As left by a previous pass over the ring
+	 */
+	for (i = 0U; i < 230U; ++i)
+		pRing->ptr[i].d = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL) | XHCI_TRB_3_CYCLE_BIT;
+	pRing->enqueueIndex = pRing->dequeueIndex = 230U;
+	FakeXHCAttach(&xhc, pRing);
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(hc->_diagCounters[DIAGCTR_EARLYLINKS] == 1);
+	CHECK(!hc->_diagCounters[DIAGCTR_RELOCATIONS]);
+	CHECK(XHCI_TRB_3_TYPE_GET(pRing->ptr[230].d) == XHCI_TRB_TYPE_LINK);
+	CHECK(pRing->cycleState == 0U);
+	pTd = pAsyncEp->PeekTD(&pAsyncEp->scheduledTDs);
+	CHECK(pTd && pTd->lastTrbIndex == 32);
+	CHECK(GenericUSBXHCI::CheckRingInvariants(pRing));
+	FakeXHCRun(hc, pRing, &xhc);
+	CHECK(!xhc.corrupt);
+	CHECK(log.count == 1U && !log.failures);
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+HOST_TEST(NoEarlyLinkWhenStartOfRingIsBusy)
+{
+	GenericUSBXHCI* hc = NewController();
+	ringStruct ring;
+
+	bzero(&ring, sizeof ring);
+	CHECK(hc->AllocRing(&ring, 1) == kIOReturnSuccess);
+	ring.enqueueIndex = 240U;
+	ring.dequeueIndex = 20U;
+	CHECK(!GenericUSBXHCI::PlaceEarlyLink(&ring, 10U, false));
+	CHECK(!GenericUSBXHCI::PlaceEarlyLink(&ring, 20U, false));
+	CHECK(GenericUSBXHCI::PlaceEarlyLink(&ring, 19U, false));
+	CHECK(!ring.enqueueIndex && !ring.cycleState);
+	hc->DeallocRing(&ring);
+	DeleteController(hc);
+}
+
+/*
+ * Note: Checks each TRB of a three page bulk OUT TD
+ */
+HOST_TEST(BuildTransferWritesNormalAndEventDataTRBs)
+{
+	GenericUSBXHCI* hc = NewController();
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, kBulkOutEndpoint, 1, 512U, BULK_OUT_EP);
+	IOUSBCommand* command = NewCommand(3U * PAGE_SIZE);
+	static uint32_t const tdSize[3] = { 16U, 8U, 0U };
+	TRBStruct const* pTrb;
+	ringStruct* pRing;
+	uint32_t i;
+
+	CHECK(pAsyncEp);
+	pRing = pAsyncEp->pRing;
+	command->endpoint = 1U;
+	command->direction = kUSBOut;
+	CHECK(hc->CreateTransfer(command, 0U) == kIOReturnSuccess);
+	CHECK(pRing->enqueueIndex == 4U);
+	for (i = 0U; i < 3U; ++i) {
+		pTrb = &pRing->ptr[i];
+		CHECK(XHCI_TRB_3_TYPE_GET(pTrb->d) == XHCI_TRB_TYPE_NORMAL);
+		CHECK(pTrb->d & XHCI_TRB_3_CYCLE_BIT);
+		CHECK(pTrb->d & XHCI_TRB_3_CHAIN_BIT);
+		CHECK(!(pTrb->d & (XHCI_TRB_3_IOC_BIT | XHCI_TRB_3_IDT_BIT)));
+		CHECK(!!(pTrb->d & XHCI_TRB_3_ENT_BIT) == (i == 2U));
+		CHECK(GenericUSBXHCI::GetTRBAddr64(pTrb) == 0x100000000ULL + 2U * i * PAGE_SIZE);
+		CHECK(XHCI_TRB_2_BYTES_GET(pTrb->c) == PAGE_SIZE);
+		CHECK(XHCI_TRB_2_TDSZ_GET(pTrb->c) == tdSize[i]);
+	}
+	pTrb = &pRing->ptr[3];
+	CHECK(XHCI_TRB_3_TYPE_GET(pTrb->d) == XHCI_TRB_TYPE_EVENT_DATA);
+	CHECK(pTrb->d & XHCI_TRB_3_CYCLE_BIT);
+	CHECK(pTrb->d & XHCI_TRB_3_IOC_BIT);
+	CHECK(!(pTrb->d & XHCI_TRB_3_CHAIN_BIT));
+	CHECK(GenericUSBXHCI::GetTRBAddr64(pTrb) == pRing->physAddr + 3U * sizeof *pTrb);
+	CHECK(!(pRing->ptr[4].d & XHCI_TRB_3_CYCLE_BIT));
+	DeleteController(hc);
+	DeleteCommand(command);
+}
+
+/*
+ * Note: Everything a TRB builder can change
+ */
+struct BuilderState
+{
+	ringStruct ring;
+	TRBStruct* trbs;
+	SegmentCache cache;
+	IODMACommand::Segment64 segments[kAsyncTDSegments];
+	int32_t diagCounters[NUM_DIAGCTRS];
+};
+
+static void SaveBuilderState(GenericUSBXHCI* hc, ringStruct const* pRing, BuilderState* pState)
+{
+	memcpy(&pState->ring, pRing, sizeof pState->ring);
+	memcpy(pState->trbs, pRing->ptr, pRing->numTRBs * sizeof *pRing->ptr);
+	pState->cache = hc->_tdSegmentCache;
+	memcpy(&pState->segments[0], hc->_tdSegmentCache.segments, sizeof pState->segments);
+	memcpy(&pState->diagCounters[0], &hc->_diagCounters[0], sizeof pState->diagCounters);
+}
+
+static void RestoreBuilderState(GenericUSBXHCI* hc, ringStruct* pRing, BuilderState const* pState)
+{
+	memcpy(pRing, &pState->ring, sizeof *pRing);
+	memcpy(pRing->ptr, pState->trbs, pRing->numTRBs * sizeof *pRing->ptr);
+	hc->_tdSegmentCache = pState->cache;
+	memcpy(hc->_tdSegmentCache.segments, &pState->segments[0], sizeof pState->segments);
+	memcpy(&hc->_diagCounters[0], &pState->diagCounters[0], sizeof pState->diagCounters);
+}
+
+static bool SameBuilderState(GenericUSBXHCI* hc, ringStruct const* pRing, BuilderState const* pState)
+{
+	return !memcmp(pRing, &pState->ring, sizeof *pRing) &&
+		!memcmp(pRing->ptr, pState->trbs, pRing->numTRBs * sizeof *pRing->ptr) &&
+		!memcmp(&hc->_diagCounters[0], &pState->diagCounters[0], sizeof pState->diagCounters);
+}
+
+/*
+ * Note: Queues one transaction, then lays out each of its TDs with
+ *   the reference builder and with _createTransfer from the same
+ *   state, and compares the TRBs, ring and counters they leave.
+ */
+static bool BuildersAgree(bool in, uint32_t mystery, uint32_t numBytes, uint32_t segmentBytes,
+						  uint64_t physAddr, uint16_t startIndex)
+{
+	GenericUSBXHCI* hc = NewController();
+	int32_t endpoint = in ? 3 : 2;
+	XHCIAsyncEndpoint* pAsyncEp = NewAsyncEndpoint(hc, endpoint, 4, 512U, in ? BULK_IN_EP : BULK_OUT_EP);
+	IOUSBCommand* command = NewCommand(numBytes ? numBytes : 1U, segmentBytes, physAddr);
+	BuilderState* pBefore = static_cast<BuilderState*>(calloc(1U, sizeof *pBefore));
+	BuilderState* pReference = static_cast<BuilderState*>(calloc(1U, sizeof *pReference));
+	static uint8_t const immediateData[8] = { 1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U };
+	uint32_t refFirst, refCount, first, count, i;
+	int16_t refLast, last;
+	IOReturn refRc, rc;
+	XHCIAsyncTD* pTd;
+	ringStruct* pRing;
+	bool agree = false;
+
+	if (!pAsyncEp || !pBefore || !pReference)
+		goto done;
+	pRing = pAsyncEp->pRing;
+	pBefore->trbs = static_cast<TRBStruct*>(calloc(pRing->numTRBs, sizeof(TRBStruct)));
+	pReference->trbs = static_cast<TRBStruct*>(calloc(pRing->numTRBs, sizeof(TRBStruct)));
+	if (!pBefore->trbs || !pReference->trbs)
+		goto done;
+	/*
+	 * Note: As left by a previous pass over the ring
+	 */
+	for (i = 0U; i < startIndex; ++i)
+		pRing->ptr[i].d = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL) | XHCI_TRB_3_CYCLE_BIT;
+	pRing->enqueueIndex = pRing->dequeueIndex = startIndex;
+	command->endpoint = 1U;
+	command->direction = in ? kUSBIn : kUSBOut;
+	if (XHCI_TRB_3_TYPE_GET(mystery) == XHCI_TRB_TYPE_NOOP ||
+		XHCI_TRB_3_TYPE_GET(mystery) == XHCI_TRB_TYPE_STATUS_STAGE)
+		rc = pAsyncEp->CreateTDs(command, 0U, mystery, 0U, 0);
+	else if (mystery & XHCI_TRB_3_IDT_BIT)
+		rc = pAsyncEp->CreateTDs(command, 0U, mystery, static_cast<uint8_t>(numBytes), &immediateData[0]);
+	else
+		rc = pAsyncEp->CreateTDs(command, 0U, mystery, 0xFFU, 0);
+	if (rc != kIOReturnSuccess)
+		goto done;
+	while ((pTd = pAsyncEp->GetTD(&pAsyncEp->queuedTDs))) {
+		if (!pTd->numTRBsInTD)
+			pTd->numTRBsInTD = hc->CountTRBsInTD(&hc->_tdSegmentCache,
+												 pTd->command->GetDMACommand(),
+												 pTd->bytesPreceedingThisTD,
+												 pTd->bytesThisTD);
+		SaveBuilderState(hc, pRing, pBefore);
+		refRc = ReferenceCreateTransfer(hc, pTd, false, pTd->bytesThisTD, pTd->mystery,
+										pTd->bytesPreceedingThisTD, pTd->interruptThisTD,
+										pTd->multiTDTransaction, &refFirst, &refCount, &refLast);
+		SaveBuilderState(hc, pRing, pReference);
+		RestoreBuilderState(hc, pRing, pBefore);
+		rc = hc->_createTransfer(pTd, false, pTd->bytesThisTD, pTd->mystery,
+								 pTd->bytesPreceedingThisTD, pTd->interruptThisTD,
+								 pTd->multiTDTransaction, &first, &count, &last);
+		if (rc != refRc || first != refFirst || count != refCount || last != refLast ||
+			!SameBuilderState(hc, pRing, pReference)) {
+			fprintf(stderr, "    builders differ: %s mystery %#x, %u bytes in %#x byte segments at %#llx, "
+					"ring index %u, TD at %lu\n",
+					in ? "in" : "out", mystery, numBytes, segmentBytes,
+					static_cast<unsigned long long>(physAddr), startIndex,
+					static_cast<unsigned long>(pTd->bytesPreceedingThisTD));
+			pAsyncEp->PutTD(&pAsyncEp->doneTDs, pTd);
+			goto done;
+		}
+		pAsyncEp->PutTD(&pAsyncEp->scheduledTDs, pTd);
+	}
+	agree = true;
+done:
+	if (pBefore)
+		free(pBefore->trbs);
+	if (pReference)
+		free(pReference->trbs);
+	free(pBefore);
+	free(pReference);
+	DeleteController(hc);
+	DeleteCommand(command);
+	return agree;
+}
+
+HOST_TEST(BuildTransferMatchesReference)
+{
+	static struct
+	{
+		uint32_t segmentBytes;
+		uint64_t physAddr;
+	} const layouts[] = {
+		{ PAGE_SIZE, 0x100000000ULL },
+		{ 512U, 0x100000000ULL },
+		{ 3U * PAGE_SIZE, 0x100000200ULL },
+		{ 0x18000U, 0x100008000ULL },
+		{ 0x100000U, 0x10000F000ULL },
+	};
+	static uint32_t const sizes[] = { 1U, 512U, 3U * PAGE_SIZE, 100000U, 300000U };
+	static uint16_t const startIndices[] = { 0U, 200U, 1000U };
+	uint32_t layout, size, start, in;
+
+	for (start = 0U; start < sizeof startIndices / sizeof startIndices[0]; ++start) {
+		for (in = 0U; in < 2U; ++in) {
+			for (layout = 0U; layout < sizeof layouts / sizeof layouts[0]; ++layout)
+				for (size = 0U; size < sizeof sizes / sizeof sizes[0]; ++size)
+					CHECK(BuildersAgree(in, 0U, sizes[size], layouts[layout].segmentBytes,
+										layouts[layout].physAddr, startIndices[start]));
+			CHECK(BuildersAgree(in, XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_DATA_STAGE) | (in ? XHCI_TRB_3_DIR_IN : 0U),
+								3U * PAGE_SIZE, PAGE_SIZE, 0x100000000ULL, startIndices[start]));
+			CHECK(BuildersAgree(in, XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_STATUS_STAGE) | XHCI_TRB_3_IOC_BIT,
+								0U, PAGE_SIZE, 0x100000000ULL, startIndices[start]));
+			CHECK(BuildersAgree(in, XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NOOP) | XHCI_TRB_3_IOC_BIT,
+								0U, PAGE_SIZE, 0x100000000ULL, startIndices[start]));
+		}
+		for (size = 1U; size <= 8U; size += 7U)
+			CHECK(BuildersAgree(false, XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL) | XHCI_TRB_3_IDT_BIT,
+								size, PAGE_SIZE, 0x100000000ULL, startIndices[start]));
+	}
+}
@@ -0,0 +1,448 @@
+//
+//  HostKernel.h
+//  GenericUSBXHCI
+//
+//  Stand-ins for the parts of IOKit, libkern and IOUSBFamily that the
+//  ring, TD and event ring code touches, so those translation units can
+//  be compiled and exercised in a plain user process on Linux.
+//
+//  Only declarations the driver sources actually use are provided.  All
+//  hardware facing behaviour lives in HostTest/Fakes.cpp.
+//
+
+#ifndef GenericUSBXHCI_HostKernel_h
+#define GenericUSBXHCI_HostKernel_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+
+#ifndef __LP64__
+#define __LP64__ 1
+#endif
+
+#pragma mark -
+#pragma mark Basic Types
+#pragma mark -
+
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int8_t SInt8;
+typedef int16_t SInt16;
+typedef int32_t SInt32;
+typedef int64_t SInt64;
+typedef int kern_return_t;
+typedef kern_return_t IOReturn;
+typedef uint64_t IOByteCount;
+typedef uint32_t IOOptionBits;
+typedef uint64_t IOPhysicalAddress;
+typedef uint64_t IOPhysicalAddress64;
+typedef unsigned long IOPMPowerFlags;
+typedef uint64_t AbsoluteTime;
+typedef void* task_t;
+typedef void* thread_call_t;
+typedef uint32_t IOPMDriverAssertionID;
+typedef uint16_t USBDeviceAddress;
+
+#define __unused __attribute__((unused))
+
+#define PAGE_SIZE 4096U
+#define PAGE_MASK (PAGE_SIZE - 1U)
+
+#pragma mark -
+#pragma mark IOReturn
+#pragma mark -
+
+#define iokit_common_err(x) (static_cast<IOReturn>(0xE0000000U | (x)))
+#define iokit_usb_err(x) (static_cast<IOReturn>(0xE0004000U | (x)))
+
+#define kIOReturnSuccess 0
+#define kIOReturnError iokit_common_err(0x2BCU)
+#define kIOReturnNoMemory iokit_common_err(0x2BDU)
+#define kIOReturnNoResources iokit_common_err(0x2BEU)
+#define kIOReturnNoDevice iokit_common_err(0x2C0U)
+#define kIOReturnBadArgument iokit_common_err(0x2C2U)
+#define kIOReturnUnsupported iokit_common_err(0x2C7U)
+#define kIOReturnInternalError iokit_common_err(0x2C9U)
+#define kIOReturnBusy iokit_common_err(0x2D5U)
+#define kIOReturnTimeout iokit_common_err(0x2D6U)
+#define kIOReturnNotReady iokit_common_err(0x2D8U)
+#define kIOReturnNoSpace iokit_common_err(0x2DBU)
+#define kIOReturnNotPermitted iokit_common_err(0x2E2U)
+#define kIOReturnUnderrun iokit_common_err(0x2E7U)
+#define kIOReturnOverrun iokit_common_err(0x2E8U)
+#define kIOReturnAborted iokit_common_err(0x2EBU)
+#define kIOReturnNoBandwidth iokit_common_err(0x2ECU)
+#define kIOReturnNotResponding iokit_common_err(0x2EDU)
+#define kIOReturnIsoTooOld iokit_common_err(0x2EEU)
+#define kIOReturnIsoTooNew iokit_common_err(0x2EFU)
+#define kIOReturnNotFound iokit_common_err(0x2F0U)
+
+#define kIOUSBUnknownPipeErr iokit_usb_err(0x61U)
+#define kIOUSBTooManyPipesErr iokit_usb_err(0x60U)
+#define kIOUSBNoAsyncPortErr iokit_usb_err(0x5FU)
+#define kIOUSBNotEnoughPipesErr iokit_usb_err(0x5EU)
+#define kIOUSBNotEnoughPowerErr iokit_usb_err(0x5DU)
+#define kIOUSBEndpointNotFound iokit_usb_err(0x57U)
+#define kIOUSBConfigNotFound iokit_usb_err(0x56U)
+#define kIOUSBTransactionTimeout iokit_usb_err(0x51U)
+#define kIOUSBTransactionReturned iokit_usb_err(0x50U)
+#define kIOUSBPipeStalled iokit_usb_err(0x4FU)
+#define kIOUSBInterfaceNotFound iokit_usb_err(0x4EU)
+#define kIOUSBLinkErr iokit_usb_err(0x10U)
+#define kIOUSBNotSent2Err iokit_usb_err(0x0FU)
+#define kIOUSBNotSent1Err iokit_usb_err(0x0EU)
+#define kIOUSBBufferUnderrunErr iokit_usb_err(0x0DU)
+#define kIOUSBBufferOverrunErr iokit_usb_err(0x0CU)
+#define kIOUSBReserved2Err iokit_usb_err(0x0BU)
+#define kIOUSBReserved1Err iokit_usb_err(0x0AU)
+#define kIOUSBWrongPIDErr iokit_usb_err(0x07U)
+#define kIOUSBPIDCheckErr iokit_usb_err(0x06U)
+#define kIOUSBDataToggleErr iokit_usb_err(0x03U)
+#define kIOUSBBitstufErr iokit_usb_err(0x02U)
+#define kIOUSBCRCErr iokit_usb_err(0x01U)
+#define kIOUSBHighSpeedSplitError iokit_usb_err(0x44U)
+
+#pragma mark -
+#pragma mark libkern
+#pragma mark -
+
+#define OSDeclareFinalStructors(className)
+#define OSDeclareAbstractStructors(className)
+#define OSDeclareDefaultStructors(className)
+#define OSDefineMetaClassAndFinalStructors(className, superclassName)
+#define OSDynamicCast(type, inst) (static_cast<type*>(inst))
+
+class OSObject
+{
+	int32_t retainCount;
+
+public:
+	OSObject(void) : retainCount(1) {}
+	virtual ~OSObject(void) {}
+	void retain(void) { ++retainCount; }
+	void release(void) { if (!--retainCount) delete this; }
+	int32_t getRetainCount(void) const { return retainCount; }
+};
+
+class OSArray;
+class OSData;
+class OSDictionary;
+class OSNumber;
+class OSString;
+
+#pragma mark -
+#pragma mark IOKit Kernel Services
+#pragma mark -
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void IOLog(char const*, ...) __attribute__((format(printf, 1, 2)));
+void* IOMalloc(size_t);
+void IOFree(void*, size_t);
+void* IOMallocAligned(size_t, size_t);
+void IOFreeAligned(void*, size_t);
+void IOSleep(unsigned);
+void IODelay(unsigned);
+uint64_t mach_absolute_time(void);
+void absolutetime_to_nanoseconds(uint64_t, uint64_t*);
+void nanoseconds_to_absolutetime(uint64_t, uint64_t*);
+uint64_t ml_cpu_int_event_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+struct IOSimpleLock { int32_t held; };
+typedef IOSimpleLock IOSimpleLockT;
+static inline void IOSimpleLockLock(IOSimpleLock* lock) { ++lock->held; }
+static inline void IOSimpleLockUnlock(IOSimpleLock* lock) { --lock->held; }
+static inline IOSimpleLock* IOSimpleLockAlloc(void) { IOSimpleLock* lock = static_cast<IOSimpleLock*>(IOMalloc(sizeof *lock)); if (lock) lock->held = 0; return lock; }
+static inline void IOSimpleLockFree(IOSimpleLock* lock) { IOFree(lock, sizeof *lock); }
+typedef int IOInterruptState;
+static inline IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock* lock) { IOSimpleLockLock(lock); return 0; }
+static inline void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock* lock, IOInterruptState) { IOSimpleLockUnlock(lock); }
+
+#define kIOMemoryPhysicallyContiguous 0x00000010U
+#define kIODirectionIn 1U
+#define kIODirectionOut 2U
+#define kIODirectionInOut 3U
+#define kIOInterruptTypePCIMessaged 0x00010000
+
+class IOService : public OSObject
+{
+public:
+	int32_t numMessageInterrupts;	// fake: MSI vectors offered from index 1
+	IOReturn getInterruptType(int source, int* interruptType);
+};
+
+class IOPCIDevice : public IOService {};
+class IOACPIPlatformDevice : public IOService {};
+class IOUserClient : public IOService {};
+class IOCommandGate;
+class IOTimerEventSource;
+class IOCommandPool;
+
+class IOEventSource : public OSObject {};
+class IOInterruptEventSource : public IOEventSource
+{
+public:
+	typedef void (*Action)(OSObject*, IOInterruptEventSource*, int);
+};
+
+class IOFilterInterruptEventSource : public IOInterruptEventSource
+{
+public:
+	typedef bool (*Filter)(OSObject*, IOFilterInterruptEventSource*);
+
+	int intIndex;
+	bool autoDisable;
+	int32_t signals;
+
+	IOFilterInterruptEventSource(void) : intIndex(0), autoDisable(true), signals(0) {}
+	static IOFilterInterruptEventSource* filterInterruptEventSource(OSObject*, Action, Filter, IOService*, int);
+	int getIntIndex(void) const { return intIndex; }
+	bool getAutoDisable(void) const { return autoDisable; }
+	void disable(void) {}
+	void enable(void) {}
+	void signalInterrupt(void) { ++signals; }
+};
+
+class IOWorkLoop : public OSObject
+{
+public:
+	IOReturn addEventSource(IOEventSource*) { return kIOReturnSuccess; }
+	IOReturn removeEventSource(IOEventSource*) { return kIOReturnSuccess; }
+};
+
+#pragma mark -
+#pragma mark Memory
+#pragma mark -
+
+/*
+ * Note: Fake buffers are host memory, and their "physical"
+ *   address is simply the host address.
+ */
+class IOMemoryDescriptor : public OSObject
+{
+public:
+	uint8_t* bytes;
+	IOByteCount length;
+
+	IOMemoryDescriptor(void) : bytes(0), length(0U) {}
+	IOByteCount getLength(void) const { return length; }
+	IOByteCount readBytes(IOByteCount offset, void* buffer, IOByteCount count);
+	IOReturn prepare(void) { return kIOReturnSuccess; }
+	IOReturn complete(void) { return kIOReturnSuccess; }
+};
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+public:
+	void* allocBase;
+	size_t allocSize;
+
+	IOBufferMemoryDescriptor(void) : allocBase(0), allocSize(0U) {}
+	~IOBufferMemoryDescriptor(void);
+	void* getBytesNoCopy(void) { return bytes; }
+};
+
+class IOMemoryMap : public OSObject {};
+
+/*
+ * Note: Segments are whatever the test sets up, and genIOVMSegments
+ *   walks them like IODMACommand walks a prepared descriptor.
+ */
+class IODMACommand : public OSObject
+{
+public:
+	struct Segment64
+	{
+		UInt64 fIOVMAddr;
+		UInt64 fLength;
+	};
+
+	enum { kMaxFakeSegments = 1024 };
+
+	IOMemoryDescriptor* md;
+	Segment64 fakeSegments[kMaxFakeSegments];
+	UInt32 numFakeSegments;
+	uint32_t genCalls;
+
+	IODMACommand(void) : md(0), numFakeSegments(0U), genCalls(0U) {}
+	IOMemoryDescriptor const* getMemoryDescriptor(void) const { return md; }
+	IOReturn genIOVMSegments(UInt64* offset, Segment64* segments, UInt32* numSegments);
+};
+
+#pragma mark -
+#pragma mark USB
+#pragma mark -
+
+#define kUSBMaxDevices 128
+#define kUSBMaxPipes 32
+#define kUSBDeviceSpeedLow 0
+#define kUSBDeviceSpeedFull 1
+#define kUSBDeviceSpeedHigh 2
+#define kUSBDeviceSpeedSuper 3
+#define kUSBBusStateReset 0
+#define kUSBBusStateSuspended 1
+#define kUSBBusStateRunning 2
+#define kUSBHSHubFlagsMultiTTMask 0x1
+#define kUSBHSHubFlagsTTThinkTimeShift 1
+#define kUSBHSHubFlagsTTThinkTimeMask 0x6
+#define kUSBHSHubFlagsNumPortsShift 8
+#define kUSBHSHubFlagsNumPortsMask 0xFF00
+#define kUSBHSHubFlagsMoreInfoMask 0x10000
+#define kUSBIn 1
+#define kUSBOut 0
+#define kUSBNone 2
+#define kUSBAnyDirn 3
+
+typedef void (*IOUSBCompletionAction)(void* target, void* parameter, IOReturn status, UInt32 bufferSizeRemaining);
+
+struct IOUSBCompletion
+{
+	void* target;
+	IOUSBCompletionAction action;
+	void* parameter;
+};
+
+struct IOUSBIsocFrame
+{
+	IOReturn frStatus;
+	UInt16 frReqCount;
+	UInt16 frActCount;
+};
+
+struct IOUSBLowLatencyIsocFrame
+{
+	IOReturn frStatus;
+	UInt16 frReqCount;
+	UInt16 frActCount;
+	AbsoluteTime frTimeStamp;
+};
+
+typedef void (*IOUSBIsocCompletionAction)(void*, void*, IOReturn, IOUSBIsocFrame*);
+
+struct IOUSBIsocCompletion
+{
+	void* target;
+	IOUSBIsocCompletionAction action;
+	void* parameter;
+};
+
+struct IOUSBDeviceDescriptor;
+struct IOUSBHubDescriptor;
+struct IOUSB3HubDescriptor;
+struct IOUSBHubStatus;
+struct IOUSBHubPortStatus;
+struct IOUSBDevRequest;
+class IOUSBDevice;
+class IOUSBHubPolicyMaker;
+class IOUSBControllerIsochEndpoint;
+
+class IOUSBCommand : public OSObject
+{
+public:
+	USBDeviceAddress address;
+	UInt8 endpoint;
+	UInt8 direction;
+	UInt32 reqCount;
+	UInt32 noDataTimeout;
+	UInt32 completionTimeout;
+	IOMemoryDescriptor* buffer;
+	IODMACommand* dmaCommand;
+	IOUSBCompletion uslCompletion;
+	UInt32 uimScratch[10];
+
+	IOUSBCommand(void) : address(0U), endpoint(0U), direction(0U), reqCount(0U), noDataTimeout(0U),
+		completionTimeout(0U), buffer(0), dmaCommand(0) { bzero(&uslCompletion, sizeof uslCompletion); bzero(&uimScratch[0], sizeof uimScratch); }
+	USBDeviceAddress GetAddress(void) const { return address; }
+	UInt8 GetEndpoint(void) const { return endpoint; }
+	UInt8 GetDirection(void) const { return direction; }
+	IOByteCount GetReqCount(void) const { return reqCount; }
+	UInt32 GetNoDataTimeout(void) const { return noDataTimeout; }
+	void SetNoDataTimeout(UInt32 v) { noDataTimeout = v; }
+	UInt32 GetCompletionTimeout(void) const { return completionTimeout; }
+	IOMemoryDescriptor* GetBuffer(void) const { return buffer; }
+	IODMACommand* GetDMACommand(void) const { return dmaCommand; }
+	IOUSBCompletion GetUSLCompletion(void) const { return uslCompletion; }
+	UInt32 GetUIMScratch(UInt32 i) const { return uimScratch[i]; }
+	void SetUIMScratch(UInt32 i, UInt32 v) { uimScratch[i] = v; }
+};
+
+class IOUSBIsocCommand : public OSObject
+{
+public:
+	IODMACommand* dmaCommand;
+
+	IOUSBIsocCommand(void) : dmaCommand(0) {}
+	IODMACommand* GetDMACommand(void) const { return dmaCommand; }
+};
+
+struct V3ExpansionData
+{
+	bool _onThunderbolt;
+};
+
+class IOUSBControllerV2;
+
+/*
+ * Note: None of the IOUSBController virtuals are declared, so the
+ *   driver's overrides are plain methods and GenericUSBXHCI can be
+ *   instantiated by the tests.
+ */
+class IOUSBControllerV3 : public OSObject
+{
+public:
+	IOWorkLoop* _workLoop;
+	IOPCIDevice* _device;
+	bool _controllerAvailable;
+	UInt8 _myBusState;
+	UInt8 _rootHubNumPorts;
+	IOUSBControllerIsochEndpoint* _isochEPList;
+	V3ExpansionData* _v3ExpansionData;
+	int32_t completions;	// fake: count of Complete calls
+
+	bool isInactive(void) const { return false; }
+	void Complete(IOUSBCompletion completion, IOReturn status, UInt32 actualByteCount);
+};
+
+class IOUSBControllerIsochEndpoint : public OSObject
+{
+public:
+	IOUSBControllerIsochEndpoint* nextEP;
+	int16_t functionAddress;
+	int16_t endpointNumber;
+	IOReturn accumulatedStatus;
+	volatile int32_t onToDoList;
+	volatile int32_t scheduledTDs;
+	volatile int32_t onProducerQ;
+	volatile int32_t onReversedList;
+	volatile int32_t onDoneQueue;
+	int32_t activeTDs;
+	uint16_t inSlot;
+	UInt8 interval;
+	UInt8 direction;
+};
+
+class IOUSBControllerIsochListElement : public OSObject
+{
+public:
+	IOUSBControllerIsochEndpoint* _pEndpoint;
+	IOUSBIsocFrame* _pFrames;
+	IOUSBIsocCompletion _completion;
+	bool _lowLatency;
+	UInt8 _framesInTD;
+	UInt64 _frameNumber;
+	UInt16 _frameIndex;
+	IOUSBControllerIsochListElement* _doneQueueLink;
+};
+
+#endif
@@ -0,0 +1,8 @@
+//
+//  IOFilterInterruptEventSource.h
+//  GenericUSBXHCI
+//
+//  Host build stand-in, see HostKernel.h
+//
+
+#include "HostKernel.h"
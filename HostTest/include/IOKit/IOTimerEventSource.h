@@ -0,0 +1,8 @@
+//
+//  IOTimerEventSource.h
+//  GenericUSBXHCI
+//
+//  Host build stand-in, see HostKernel.h
+//
+
+#include "HostKernel.h"
@@ -0,0 +1,8 @@
+//
+//  IOUSBControllerV3.h
+//  GenericUSBXHCI
+//
+//  Host build stand-in, see HostKernel.h
+//
+
+#include "HostKernel.h"
@@ -81,11 +81,17 @@ void CLASS::FilterInterrupt(IOFilterInterruptEventSource* source)
 	 * Interrupt Context
 	 */
 	bool invokeContinuation = false;
+	uint32_t events = 0U;
 	int32_t interrupter = source->getIntIndex() - _baseInterruptIndex;
 	if (preFilterEventRing(source, interrupter)) {
 		static_cast<void>(__sync_fetch_and_add(&_interruptCounters[0], 1));
-		while (FilterEventRing(interrupter, &invokeContinuation));
+		IOSimpleLockLock(_eventRing[interrupter].filterLock);
+		while (FilterEventRing(interrupter, &invokeContinuation))
+			++events;
 		postFilterEventRing(interrupter);
+		IOSimpleLockUnlock(_eventRing[interrupter].filterLock);
+		if (events)	// Note: a shared pin interrupt may not be ours
+			ModerateInterrupter(interrupter, events);
 	}
 	if (m_invalid_regspace) {
 		source->disable();	// Note: For MSI this is a no-op
@@ -140,10 +146,67 @@ void CLASS::postFilterEventRing(int32_t interrupter)
 	}
 	erdp = ePtr->erdp + ePtr->xHCDequeueIndex * sizeof *ePtr->erstPtr;
 	erdp |= XHCI_ERDP_LO_BUSY;
+	erdp |= XHCI_ERDP_LO_SINDEX((ePtr->xHCDequeueIndex + ePtr->erstEntries) / (PAGE_SIZE / sizeof *ePtr->erstPtr));
 	Write64Reg(&_pXHCIRuntimeRegisters->irs[interrupter].erdp, erdp, true);
 	ePtr->erdpNeedsUpdate = false;
 }
 
+/*
+ * Note: Samples interrupts and events over kIMODSampleNanoseconds.
+ *   If the interrupt rate goes above target, IMODI is doubled.  If
+ *   the event rate drops below half the target, so one interrupt
+ *   per event would be fine, IMODI goes straight back to minimum
+ *   for latency.  The event rate doesn't depend on IMODI, so this
+ *   doesn't oscillate.
+ */
+__attribute__((noinline, visibility("hidden")))
+void CLASS::ModerateInterrupter(int32_t interrupter, uint32_t events)
+{
+	uint64_t now, elapsed;
+	uint32_t interruptRate, eventRate, interval;
+	EventRingStruct* ePtr = &_eventRing[interrupter];
+
+	/*
+	 * Interrupt Context
+	 */
+	++ePtr->imodInterrupts;
+	ePtr->imodEvents += events;
+	now = mach_absolute_time();
+	if (now - ePtr->imodSampleStart < _imod.samplePeriod)
+		return;
+	absolutetime_to_nanoseconds(now - ePtr->imodSampleStart, &elapsed);
+	interruptRate = static_cast<uint32_t>((ePtr->imodInterrupts * 1000000000ULL) / elapsed);
+	eventRate = static_cast<uint32_t>((ePtr->imodEvents * 1000000000ULL) / elapsed);
+	ePtr->interruptsPerSecond = interruptRate;
+	ePtr->eventsPerInterrupt = static_cast<uint32_t>((ePtr->imodEvents * 100ULL) / ePtr->imodInterrupts);
+	ePtr->imodInterrupts = 0U;
+	ePtr->imodEvents = 0U;
+	ePtr->imodSampleStart = now;
+	if (m_invalid_regspace || _imod.minimum == _imod.maximum)
+		return;
+	interval = ePtr->imodInterval;
+	if (interruptRate > _imod.targetRate)
+		interval = interval ? 2U * interval : 1U;
+	else if (eventRate < _imod.targetRate / 2U)
+		interval = _imod.minimum;
+	if (interval < _imod.minimum)
+		interval = _imod.minimum;
+	else if (interval > _imod.maximum)
+		interval = _imod.maximum;
+	if (interval == ePtr->imodInterval)
+		return;
+	ePtr->imodInterval = static_cast<uint16_t>(interval);
+	Write32Reg(&_pXHCIRuntimeRegisters->irs[interrupter].imod, interval);
+}
+
+/*
+ * Note: Each interrupter is filtered on its own vector, so filters
+ *   may run at once on several CPUs.  Apart from atomic counters they
+ *   share nothing.  Command completions, MFINDEX wraps and port status
+ *   changes only arrive on the primary interrupter, and all events of
+ *   an isoch endpoint on the one interrupter its TRBs target.  The
+ *   filter lock only keeps DrainEventRing out.
+ */
 __attribute__((noinline, visibility("hidden")))
 bool CLASS::FilterEventRing(int32_t interrupter, bool* pInvokeContinuation)
 {
@@ -159,12 +222,8 @@ bool CLASS::FilterEventRing(int32_t interrupter, bool* pInvokeContinuation)
 	if (cb & XHCI_TRB_3_CYCLE_BIT)
 		return false;
 	localTrb = *reinterpret_cast<TRBStruct*>(&ePtr->erstPtr[ePtr->xHCDequeueIndex]);
-	++ePtr->xHCDequeueIndex;
-	if (ePtr->xHCDequeueIndex >= ePtr->numxHCEntries) {
-		ePtr->xHCDequeueIndex = 0U;
-		ePtr->cycleState ^= 1U;
-	}
-	ePtr->erdpNeedsUpdate = true;
+	if (ePtr->bounceStalled)
+		goto bounce;
 	switch (XHCI_TRB_3_TYPE_GET(localTrb.d)) {
 		case TRB_RENESAS_CMD_COMP:
 			if (_vendorID != kVendorRenesas)
@@ -172,40 +231,74 @@ bool CLASS::FilterEventRing(int32_t interrupter, bool* pInvokeContinuation)
 		case XHCI_TRB_EVENT_CMD_COMPLETE:
 			if (!DoCMDCompletion(localTrb))
 				break;
-			return true;
+			goto consumed;
 		case XHCI_TRB_EVENT_TRANSFER:
 			if (processTransferEvent(&localTrb))
 				break;
 			if (pInvokeContinuation)	// Note: Invoke PollEventRing2 to handle _isochEPList
 				*pInvokeContinuation = true;
-			return true;
+			goto consumed;
 		case XHCI_TRB_EVENT_MFINDEX_WRAP:
 			_millsecondCounter += 2048U;	// 2^14 * 0.125 us = 2048 ms
 			_millsecondsTimers[2] = _millsecondCounter;
 			_millsecondsTimers[0] = ml_cpu_int_event_time();	// Note: time stored by kernel interrupt handler close to interrupt entry
-			break;
+			if (!BounceQueueFull(ePtr))
+				break;
+			/*
+			 * Note: Do PollEventRing2's part here rather than hold up the event ring
+			 */
+			_millsecondsTimers[1] = _millsecondsTimers[0];
+			_millsecondsTimers[3] = _millsecondsTimers[2];
+			goto consumed;
 		case XHCI_TRB_EVENT_PORT_STS_CHANGE:
 			rhPort = static_cast<uint8_t>(localTrb.a >> 24);
 			if (rhPort && rhPort <= kMaxRootPorts)
 				RHPortStatusChangeBitmapSet(1U << rhPort);
 			if (pInvokeContinuation)	// Note: Invoke PollInterrupts to perform code qualified by XHCI_STS_PCD
 				*pInvokeContinuation = true;
-			return true;
+			goto consumed;
 	}
-	next = ePtr->bounceEnqueueIndex + 1U;
-	if (next >= ePtr->numBounceEntries)
-		next = 0U;
-	if (next == ePtr->bounceDequeueIndex) {
+bounce:
+	/*
+	 * Note: If the bounce queue is full, the event is left on the
+	 *   event ring.  ERDP stops short of it, so the xHC raises
+	 *   the interrupt again once IMOD expires, and the xHC itself
+	 *   holds off if the event ring fills up.  The event has been
+	 *   filtered already, so that isn't done again on the retry.
+	 */
+	if (BounceQueueFull(ePtr)) {
+		ePtr->bounceStalled = true;
 		static_cast<void>(__sync_fetch_and_add(&ePtr->numBounceQueueOverflows, 1));
 		return false;
 	}
+	ePtr->bounceStalled = false;
+	next = ePtr->bounceEnqueueIndex + 1U;
+	if (next >= ePtr->numBounceEntries)
+		next = 0U;
 	ePtr->bounceQueuePtr[ePtr->bounceEnqueueIndex] = localTrb;
-	ePtr->bounceEnqueueIndex = next;
+	__atomic_store_n(&ePtr->bounceEnqueueIndex, next, __ATOMIC_RELEASE);
 	if (pInvokeContinuation)
 		*pInvokeContinuation = true;
+consumed:
+	++ePtr->xHCDequeueIndex;
+	if (ePtr->xHCDequeueIndex >= ePtr->numxHCEntries) {
+		ePtr->xHCDequeueIndex = 0U;
+		ePtr->cycleState ^= 1U;
+	}
+	ePtr->erdpNeedsUpdate = true;
 	return true;
 }
 
+__attribute__((visibility("hidden")))
+bool CLASS::BounceQueueFull(EventRingStruct const* ePtr)
+{
+	uint16_t next = ePtr->bounceEnqueueIndex + 1U;
+
+	if (next >= ePtr->numBounceEntries)
+		next = 0U;
+	return next == __atomic_load_n(&ePtr->bounceDequeueIndex, __ATOMIC_ACQUIRE);
+}
+
 #pragma mark -
 #pragma mark Pollers
 #pragma mark -
@@ -216,7 +309,7 @@ bool CLASS::PollEventRing2(int32_t interrupter)
 	/*
 	 * Threaded Handler Context
 	 */
-	uint16_t next;
+	uint16_t next, enqueueIndex, count;
 	int32_t value;
 	TRBStruct localTrb;
 	EventRingStruct* ePtr = &_eventRing[interrupter];
@@ -229,7 +322,7 @@ bool CLASS::PollEventRing2(int32_t interrupter)
 	value = __sync_lock_test_and_set(&ePtr->numBounceQueueOverflows, 0);
 	if (value > 0) {
 		_diagCounters[DIAGCTR_BNCEOVRFLW] += value;
-		IOLog("%s: Secondary event queue %d overflowed: %d\n", __FUNCTION__,
+		IOLog("%s: Secondary event queue %d full, events held on event ring: %d\n", __FUNCTION__,
 			  interrupter, value);
 	}
 	value = __sync_lock_test_and_set(&_errorCounters[3], 0);
@@ -240,55 +333,66 @@ bool CLASS::PollEventRing2(int32_t interrupter)
 		 iter = static_cast<GenericUSBXHCIIsochEP*>(iter->nextEP))
 		if (iter->producerCount != iter->consumerCount)
 			RetireIsocTransactions(iter, true);
-	if (ePtr->bounceDequeueIndex == ePtr->bounceEnqueueIndex)
-		goto done;
-	localTrb = ePtr->bounceQueuePtr[ePtr->bounceDequeueIndex];
-	ClearTRB(&ePtr->bounceQueuePtr[ePtr->bounceDequeueIndex], false);
-	next = ePtr->bounceDequeueIndex + 1U;
-	if (next >= ePtr->numBounceEntries)
-		next = 0U;
-	ePtr->bounceDequeueIndex = next;
-	switch (XHCI_TRB_3_TYPE_GET(localTrb.d)) {
-		case TRB_RENESAS_CMD_COMP:
-			if (_vendorID != kVendorRenesas)
+	/*
+	 * Note: The housekeeping above is done once per batch of up to
+	 *   _eventBatchSize events.  Returns true if any were processed,
+	 *   so the final call both retires isoch work they left behind
+	 *   and finds the queue empty.
+	 */
+	enqueueIndex = __atomic_load_n(&ePtr->bounceEnqueueIndex, __ATOMIC_ACQUIRE);
+	for (count = 0U; count < _eventBatchSize; ++count) {
+		if (ePtr->bounceDequeueIndex == enqueueIndex) {
+			enqueueIndex = __atomic_load_n(&ePtr->bounceEnqueueIndex, __ATOMIC_ACQUIRE);
+			if (ePtr->bounceDequeueIndex == enqueueIndex)
 				break;
-		case XHCI_TRB_EVENT_CMD_COMPLETE:
-			if (!DoCMDCompletion(localTrb))
-				++_diagCounters[DIAGCTR_CMDERR];
-			break;
-		case XHCI_TRB_EVENT_TRANSFER:
-			/*
-			 * Note: processTransferEvent2 returns false
-			 *   if the TransferEvent had invalid data
-			 *   in it (slot #, endpoint#, TRB pointer.)
-			 *   A faulty TransferEvent is ignored, except
-			 *   for counting them for diagnostic purposes.
-			     Some xHC may return spurious TransferEvents.
-			 */
-			if (!processTransferEvent2(&localTrb, interrupter))
-				++_diagCounters[DIAGCTR_XFERERR];
-			break;
-		case XHCI_TRB_EVENT_MFINDEX_WRAP:
-			_millsecondsTimers[1] = _millsecondsTimers[0];
-			_millsecondsTimers[3] = _millsecondsTimers[2];
-			break;
-		case XHCI_TRB_EVENT_DEVICE_NOTIFY:
-			IOLog("%s: Device Notification, slot %u, err %u, data %#llx, type %u\n", __FUNCTION__,
-				  localTrb.d >> 24, localTrb.c >> 24,
-				  (static_cast<uint64_t>(localTrb.b) << 24) | (localTrb.a >> 8),
-				  (localTrb.a >> 4) & 15U);
-			break;
-		case XHCI_TRB_EVENT_BW_REQUEST:
-			IOLog("%s: Bandwidth Request, slot %u, err %u\n", __FUNCTION__,
-				  localTrb.d >> 24, localTrb.c >> 24);
-			break;
-		case XHCI_TRB_EVENT_HOST_CTRL:
-			IOLog("%s: Host Controller, err %u\n", __FUNCTION__, localTrb.c >> 24);
-			break;
+		}
+		localTrb = ePtr->bounceQueuePtr[ePtr->bounceDequeueIndex];
+		ClearTRB(&ePtr->bounceQueuePtr[ePtr->bounceDequeueIndex], false);
+		next = ePtr->bounceDequeueIndex + 1U;
+		if (next >= ePtr->numBounceEntries)
+			next = 0U;
+		__atomic_store_n(&ePtr->bounceDequeueIndex, next, __ATOMIC_RELEASE);
+		switch (XHCI_TRB_3_TYPE_GET(localTrb.d)) {
+			case TRB_RENESAS_CMD_COMP:
+				if (_vendorID != kVendorRenesas)
+					break;
+			case XHCI_TRB_EVENT_CMD_COMPLETE:
+				if (!DoCMDCompletion(localTrb))
+					++_diagCounters[DIAGCTR_CMDERR];
+				break;
+			case XHCI_TRB_EVENT_TRANSFER:
+				/*
+				 * Note: processTransferEvent2 returns false
+				 *   if the TransferEvent had invalid data
+				 *   in it (slot #, endpoint#, TRB pointer.)
+				 *   A faulty TransferEvent is ignored, except
+				 *   for counting them for diagnostic purposes.
+				     Some xHC may return spurious TransferEvents.
+				 */
+				if (!processTransferEvent2(&localTrb, interrupter))
+					++_diagCounters[DIAGCTR_XFERERR];
+				break;
+			case XHCI_TRB_EVENT_MFINDEX_WRAP:
+				_millsecondsTimers[1] = _millsecondsTimers[0];
+				_millsecondsTimers[3] = _millsecondsTimers[2];
+				break;
+			case XHCI_TRB_EVENT_DEVICE_NOTIFY:
+				IOLog("%s: Device Notification, slot %u, err %u, data %#llx, type %u\n", __FUNCTION__,
+					  localTrb.d >> 24, localTrb.c >> 24,
+					  (static_cast<unsigned long long>(localTrb.b) << 24) | (localTrb.a >> 8),
+					  (localTrb.a >> 4) & 15U);
+				break;
+			case XHCI_TRB_EVENT_BW_REQUEST:
+				IOLog("%s: Bandwidth Request, slot %u, err %u\n", __FUNCTION__,
+					  localTrb.d >> 24, localTrb.c >> 24);
+				break;
+			case XHCI_TRB_EVENT_HOST_CTRL:
+				IOLog("%s: Host Controller, err %u\n", __FUNCTION__, localTrb.c >> 24);
+				break;
+		}
 	}
-	return true;
-
-done:
+	if (count)
+		return true;
 	sts = Read32Reg(&_pXHCIOperationalRegisters->USBSts);
 	if (!m_invalid_regspace &&
 		(sts & XHCI_STS_HSE) && !_HSEDetected) {
@@ -311,7 +415,7 @@ void CLASS::PollForCMDCompletions(int32_t interrupter)
 	uint16_t index, err;
 
 	index = ePtr->bounceDequeueIndex;
-	while (index != ePtr->bounceEnqueueIndex) {
+	while (index != __atomic_load_n(&ePtr->bounceEnqueueIndex, __ATOMIC_ACQUIRE)) {
 		if (m_invalid_regspace)
 			return;
 		localTrb = ePtr->bounceQueuePtr[index];
@@ -340,6 +444,30 @@ void CLASS::PollForCMDCompletions(int32_t interrupter)
 	}
 }
 
+/*
+ * Note: Runs the filter on a secondary interrupter's event ring
+ *   from the workloop, for events its vector may not have been
+ *   taken for yet.  The filter lock keeps the two apart.
+ */
+__attribute__((visibility("hidden")))
+void CLASS::DrainEventRing(int32_t interrupter)
+{
+	EventRingStruct* ePtr = &_eventRing[interrupter];
+	IOFilterInterruptEventSource* source;
+	IOInterruptState intState;
+	bool invokeContinuation = false;
+
+	if (!ePtr->filterLock || !ePtr->bounceQueuePtr)
+		return;
+	intState = IOSimpleLockLockDisableInterrupt(ePtr->filterLock);
+	while (FilterEventRing(interrupter, &invokeContinuation));
+	postFilterEventRing(interrupter);
+	IOSimpleLockUnlockEnableInterrupt(ePtr->filterLock, intState);
+	source = interrupter ? _secondaryInterruptSources[interrupter - 1] : _filterInterruptSource;
+	if (invokeContinuation && source)
+		source->signalInterrupt();
+}
+
 __attribute__((visibility("hidden")))
 bool CLASS::DoStopCompletion(TRBStruct const* pTrb)
 {
@@ -375,17 +503,28 @@ IOReturn CLASS::InitAnEventRing(int32_t which)
 {
 	EventRingStruct* ePtr = &_eventRing[which];
 
-	ePtr->numxHCEntries = 252U;
+	ePtr->numSegments = _eventRingSegments < _erstMax ? _eventRingSegments : _erstMax;
+	if (!ePtr->numSegments)
+		ePtr->numSegments = 1U;
+	ePtr->erstEntries = (ePtr->numSegments + 4U) & ~3U;
+	ePtr->numxHCEntries = static_cast<uint16_t>(ePtr->numSegments * (PAGE_SIZE / sizeof *ePtr->erstPtr) - ePtr->erstEntries);
 	IOReturn rc = MakeBuffer(kIOMemoryPhysicallyContiguous | kIODirectionInOut,
-							 PAGE_SIZE,
+							 ePtr->numSegments * PAGE_SIZE,
 							 -PAGE_SIZE,
 							 &ePtr->md,
 							 reinterpret_cast<void**>(&ePtr->erstPtr),
 							 &ePtr->erdp);
 	if (rc != kIOReturnSuccess)
 		return rc;
+	if (!ePtr->filterLock) {
+		ePtr->filterLock = IOSimpleLockAlloc();
+		if (!ePtr->filterLock)
+			return kIOReturnNoMemory;
+	}
 	InitEventRing(which, false);
-	ePtr->numBounceEntries = 5120U;
+	ePtr->numBounceEntries = _eventQueueEntries;
+	if (ePtr->numBounceEntries < 2U * ePtr->numxHCEntries)
+		ePtr->numBounceEntries = static_cast<uint16_t>(2U * ePtr->numxHCEntries);
 	ePtr->bounceQueuePtr = static_cast<TRBStruct*>(IOMalloc(static_cast<size_t>(ePtr->numBounceEntries) * sizeof *ePtr->bounceQueuePtr));
 	if (!ePtr->bounceQueuePtr)
 		return kIOReturnNoMemory;
@@ -406,21 +545,41 @@ void CLASS::InitEventRing(int32_t which, bool restarting)
 		if (ePtr->numxHCEntries)
 			bzero(ePtr->erstPtr, ePtr->numxHCEntries * sizeof *ePtr->erstPtr);
 	} else {
-		bzero(ePtr->erstPtr, (static_cast<size_t>(ePtr->numxHCEntries) + 4U) * sizeof *ePtr->erstPtr);
+		/*
+		 * Note: Segments are the consecutive pages of one buffer, and
+		 *   the 1st is shortened by the ERST.  So the xHC walks them in
+		 *   the order of a flat index, and only wraps, toggling its
+		 *   cycle state, at the end of the last one.
+		 */
+		bzero(ePtr->erstPtr, (static_cast<size_t>(ePtr->numxHCEntries) + ePtr->erstEntries) * sizeof *ePtr->erstPtr);
 		ePtr->erstba = ePtr->erdp;
-		ePtr->erdp += 4U * sizeof *ePtr->erstPtr;
-		ePtr->erstPtr->qwEvrsTablePtr = ePtr->erdp;
-		ePtr->erstPtr->dwEvrsTableSize = ePtr->numxHCEntries;
-		ePtr->erstPtr += 4;
+		ePtr->erdp += ePtr->erstEntries * sizeof *ePtr->erstPtr;
+		for (uint16_t segment = 0U; segment < ePtr->numSegments; ++segment) {
+			ePtr->erstPtr[segment].qwEvrsTablePtr = segment ? ePtr->erstba + segment * PAGE_SIZE : ePtr->erdp;
+			ePtr->erstPtr[segment].dwEvrsTableSize = static_cast<uint32_t>(PAGE_SIZE / sizeof *ePtr->erstPtr) -
+				(segment ? 0U : ePtr->erstEntries);
+		}
+		ePtr->erstPtr += ePtr->erstEntries;
 	}
 	Write64Reg(&irSet->erdp, ePtr->erdp, false);
-	Write32Reg(&irSet->erstsz, 1U);
+	Write32Reg(&irSet->erstsz, ePtr->numSegments);
 	Write64Reg(&irSet->erstba, ePtr->erstba, false);
-	Write32Reg(&irSet->imod, 160U);	// IMODI = 40 us
+	ePtr->imodInterval = kIMODInitialInterval;
+	if (ePtr->imodInterval < _imod.minimum)
+		ePtr->imodInterval = _imod.minimum;
+	else if (ePtr->imodInterval > _imod.maximum)
+		ePtr->imodInterval = _imod.maximum;
+	ePtr->imodInterrupts = 0U;
+	ePtr->imodEvents = 0U;
+	ePtr->imodSampleStart = mach_absolute_time();
+	ePtr->interruptsPerSecond = 0U;
+	ePtr->eventsPerInterrupt = 0U;
+	Write32Reg(&irSet->imod, ePtr->imodInterval);
 	Write32Reg(&irSet->iman, XHCI_IMAN_INTR_ENA);
 	ePtr->xHCDequeueIndex = 0U;
 	ePtr->cycleState = 1U;
 	ePtr->erdpNeedsUpdate = false;
+	ePtr->bounceStalled = false;
 }
 
 __attribute__((visibility("hidden")))
@@ -436,6 +595,10 @@ void CLASS::FinalizeAnEventRing(int32_t which)
 		IOFree(ePtr->bounceQueuePtr, static_cast<size_t>(ePtr->numBounceEntries) * sizeof *ePtr->bounceQueuePtr);
 		ePtr->bounceQueuePtr = 0;
 	}
+	if (ePtr->filterLock) {
+		IOSimpleLockFree(ePtr->filterLock);
+		ePtr->filterLock = 0;
+	}
 }
 
 #pragma mark -
@@ -490,6 +653,96 @@ int CLASS::findInterruptIndex(IOService* target, bool allowMSI)
 	return (msgInterruptToUse >= 0 && allowMSI) ? msgInterruptToUse : pinInterruptToUse;
 }
 
+/*
+ * Note: Counts message interrupts at consecutive
+ *   indices, starting at firstIndex.
+ */
+__attribute__((visibility("hidden")))
+int CLASS::countInterruptVectors(IOService* target, int firstIndex)
+{
+	int source, interruptType;
+
+	for (source = firstIndex;
+		 target->getInterruptType(source, &interruptType) == kIOReturnSuccess &&
+		 (interruptType & kIOInterruptTypePCIMessaged);
+		 ++source);
+	return source - firstIndex;
+}
+
+/*
+ * Note: Interrupter i is driven by vector _baseInterruptIndex + i.
+ *   If the xHC or the vectors run short, fewer interrupters are
+ *   used, and InterrupterForEndpoint folds routing back onto the
+ *   primary one.
+ */
+__attribute__((visibility("hidden")))
+IOReturn CLASS::InitSecondaryInterrupters(void)
+{
+	IOFilterInterruptEventSource* source;
+	int32_t interrupter, numVectors;
+	IOReturn rc;
+
+	if (_numInterrupters > static_cast<int32_t>(_maxInterrupters))
+		_numInterrupters = _maxInterrupters ? : 1;
+	numVectors = countInterruptVectors(_device, _baseInterruptIndex);
+	if (_numInterrupters > numVectors)
+		_numInterrupters = numVectors ? : 1;
+	for (interrupter = 1; interrupter < _numInterrupters; ++interrupter) {
+		source = IOFilterInterruptEventSource::filterInterruptEventSource(this,
+																		  InterruptHandler,
+																		  PrimaryInterruptFilter,
+																		  _device,
+																		  _baseInterruptIndex + interrupter);
+		if (!source)
+			break;
+		rc = _workLoop->addEventSource(source);
+		if (rc != kIOReturnSuccess) {
+			source->release();
+			return rc;
+		}
+		_secondaryInterruptSources[interrupter - 1] = source;
+	}
+	_numInterrupters = interrupter;
+	return kIOReturnSuccess;
+}
+
+__attribute__((visibility("hidden")))
+void CLASS::FinalizeSecondaryInterrupters(void)
+{
+	for (int32_t i = 0; i < kMaxActiveInterrupters - 1; ++i) {
+		if (!_secondaryInterruptSources[i])
+			continue;
+		if (_workLoop)
+			_workLoop->removeEventSource(_secondaryInterruptSources[i]);
+		_secondaryInterruptSources[i]->release();
+		_secondaryInterruptSources[i] = 0;
+	}
+}
+
+/*
+ * Note: Command completion and port status events always go to
+ *   the primary interrupter, so it keeps control and interrupt
+ *   endpoints too.  A burst of bulk events then can't hold up
+ *   isoch or commands in the filter.
+ */
+__attribute__((visibility("hidden")))
+uint32_t CLASS::InterrupterForEndpoint(uint8_t epType) const
+{
+	uint32_t interrupter;
+
+	switch (epType | CTRL_EP) {
+		case ISOC_IN_EP:
+			interrupter = kInterrupterIsoch;
+			break;
+		case BULK_IN_EP:
+			interrupter = kInterrupterBulk;
+			break;
+		default:
+			return kInterrupterPrimary;
+	}
+	return static_cast<int32_t>(interrupter) < _numInterrupters ? interrupter : kInterrupterPrimary;
+}
+
 #pragma mark -
 #pragma mark Transfer Events
 #pragma mark -
@@ -656,6 +909,11 @@ bool CLASS::processTransferEvent2(TRBStruct const* pTrb, int32_t interrupter)
 		if (diffIndex64 < 0 || diffIndex64 >= pRing->numTRBs - 1U) // Note: originally > pRing->numTRBs
 			return true;
 		trbIndexInRingQueue = static_cast<int32_t>(diffIndex64);
+		/*
+		 * Note: xHC has followed link into resized ring
+		 */
+		if (pRing->retiredMd)
+			FreeRetiredRing(pRing);
 	}
 	if ((pRing->epType | CTRL_EP) == ISOC_IN_EP) {
 	update_dq_and_done:
@@ -696,7 +954,7 @@ bool CLASS::processTransferEvent2(TRBStruct const* pTrb, int32_t interrupter)
 		shortfall = pAsyncTd->bytesThisTD - shortfall;
 		if (_errataBits & kErrataAbsoluteEDTLA) {
 			pAsyncTd->absoluteShortfall = true;
-			shortfall += pAsyncTd->bytesPreceedingThisTD;
+			shortfall += pAsyncTd->bytesPreceedingThisTD - pAsyncTd->subTransactionOffset;
 		}
 	}
 	if (err != XHCI_TRB_ERROR_SUCCESS) {
@@ -17,6 +17,16 @@
 #pragma mark Assorted
 #pragma mark -
 
+static
+uint8_t RingPagesFromProp(OSObject* o)
+{
+	OSNumber* n = OSDynamicCast(OSNumber, o);
+	if (!n)
+		return 0U;
+	uint32_t v = n->unsigned32BitValue();
+	return static_cast<uint8_t>(v > kMaxTransferRingPages ? kMaxTransferRingPages : v);
+}
+
 __attribute__((visibility("hidden")))
 void CLASS::SetVendorInfo(void)
 {
@@ -98,6 +108,59 @@ void CLASS::OverrideErrataFromProps(void)
 				_errataBits &= ~kErrataSWAssistedIdle;
 		}
 	}
+	_ringPagesOverride.control = RingPagesFromProp(getProperty("RingPagesControl"));
+	_ringPagesOverride.interrupt = RingPagesFromProp(getProperty("RingPagesInterrupt"));
+	_ringPagesOverride.bulk = RingPagesFromProp(getProperty("RingPagesBulk"));
+	_ringPagesOverride.bulkSS = RingPagesFromProp(getProperty("RingPagesBulkSS"));
+	OSNumber* n = OSDynamicCast(OSNumber, getProperty("TDPoolRetain"));
+	if (n) {
+		_tdPoolRetain = n->unsigned32BitValue();
+		if (_tdPoolRetain > kAsyncMaxTDs)
+			_tdPoolRetain = kAsyncMaxTDs;
+	}
+	n = OSDynamicCast(OSNumber, getProperty("MaxTDBytes"));
+	if (n) {
+		_tdBytesOverride = n->unsigned32BitValue();
+		if (_tdBytesOverride > kAsyncMaxAdaptiveTDBytes)
+			_tdBytesOverride = kAsyncMaxAdaptiveTDBytes;
+		else if (_tdBytesOverride && _tdBytesOverride < PAGE_SIZE)
+			_tdBytesOverride = PAGE_SIZE;
+	}
+	_eventRingSegments = kDefaultEventRingSegments;
+	n = OSDynamicCast(OSNumber, getProperty("EventRingSegments"));
+	if (n && n->unsigned32BitValue() <= kMaxEventRingSegments)
+		_eventRingSegments = static_cast<uint16_t>(n->unsigned32BitValue() ? : 1U);
+	_eventQueueEntries = kDefaultEventQueueEntries;
+	n = OSDynamicCast(OSNumber, getProperty("EventQueueEntries"));
+	if (n && n->unsigned32BitValue() <= UINT16_MAX)
+		_eventQueueEntries = static_cast<uint16_t>(n->unsigned32BitValue());
+	_eventBatchSize = kDefaultEventBatchSize;
+	n = OSDynamicCast(OSNumber, getProperty("EventBatchSize"));
+	if (n && n->unsigned32BitValue() <= UINT16_MAX)
+		_eventBatchSize = static_cast<uint16_t>(n->unsigned32BitValue() ? : 1U);
+	_numInterrupters = kMaxActiveInterrupters;
+	n = OSDynamicCast(OSNumber, getProperty("Interrupters"));
+	if (n && n->unsigned32BitValue() && n->unsigned32BitValue() <= kMaxActiveInterrupters)
+		_numInterrupters = n->unsigned32BitValue();
+	_imod.minimum = 4U * kIMODDefaultMinimum;
+	n = OSDynamicCast(OSNumber, getProperty("IMODMinimum"));
+	if (n && n->unsigned32BitValue() <= kIMODMaxMicroseconds)
+		_imod.minimum = static_cast<uint16_t>(4U * n->unsigned32BitValue());
+	_imod.maximum = 4U * kIMODDefaultMaximum;
+	n = OSDynamicCast(OSNumber, getProperty("IMODMaximum"));
+	if (n && n->unsigned32BitValue() <= kIMODMaxMicroseconds)
+		_imod.maximum = static_cast<uint16_t>(4U * n->unsigned32BitValue());
+	if (_imod.maximum < _imod.minimum)
+		_imod.maximum = _imod.minimum;
+	_imod.targetRate = kIMODDefaultTargetRate;
+	n = OSDynamicCast(OSNumber, getProperty("IMODTargetRate"));
+	if (n && n->unsigned32BitValue())
+		_imod.targetRate = n->unsigned32BitValue();
+	nanoseconds_to_absolutetime(kIMODSampleNanoseconds, &_imod.samplePeriod);
+	_qos.bulkInFlightLimit = kQoSDefaultBulkInFlight;
+	n = OSDynamicCast(OSNumber, getProperty("BulkInFlightLimit"));
+	if (n)
+		_qos.bulkInFlightLimit = n->unsigned32BitValue();
 }
 
 #pragma mark -
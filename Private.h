@@ -106,28 +106,58 @@ struct ringStruct
 	bool deleteInProgress; // 0x6B
 	bool needsDoorbell; // 0x6C
 	bool needsSetTRDQPtr;	// 0x6D (Added Mavericks)
+	bool needsGrowth;	// 0x6E (Added)
+	uint8_t idleTicks;	// 0x6F (Added)
+	uint16_t basePages;	// 0x70 (Added)
+	uint16_t retiredPages;	// 0x72 (Added)
+	IOBufferMemoryDescriptor* retiredMd;	// 0x78 (Added) - buffer left behind by ResizeRing
+	TRBStruct* retiredPtr;	// 0x80 (Added)
+	mutable uint64_t fitKey;	// 0x88 (Added) - numTRBs and indices fitTRBs was computed for
+	mutable uint16_t fitTRBs;	// 0x90 (Added) - cached by CanTDFragmentFit
 
 	__attribute__((always_inline)) bool isInactive(void) const { return !this || !this->md; }
 } __attribute__((aligned(128)));
 
+/*
+ * Note: The bounce queue is single-producer (FilterEventRing, primary
+ *   interrupt) and single-consumer (workloop).  Each side writes only
+ *   its own cache line, and publishes its index with release ordering.
+ */
 struct EventRingStruct
 {
 	/*
-	 * Total Size 56
+	 * Total Size 192 - originally 56, reordered so producer
+	 *   and consumer indices sit on cache lines of their own
+	 */
+	uint16_t numxHCEntries;	// 0x0 - originally 0x8
+	uint16_t numBounceEntries;	// 0x2 - originally 0xA
+	uint16_t numSegments;	// 0x4 (Added) - one page each, ERST at start of 1st
+	uint16_t erstEntries;	// 0x6 (Added) - includes a zero-filled spare after last segment
+	EventRingSegmentTable* erstPtr; // 0x8 - originally 0x10 - Note: doubles as TRBs
+	TRBStruct* bounceQueuePtr; // 0x10 - originally 0x18
+	uint64_t erdp;		// 0x18 - originally 0x20
+	uint64_t erstba;	// 0x20 - originally 0x28
+	IOBufferMemoryDescriptor* md;	// 0x28 - originally 0x30
+	IOSimpleLock* filterLock;	// 0x30 (Added) - held while filtering, so the workloop can drain the ring
+	/*
+	 * Producer
+	 */
+	uint16_t xHCDequeueIndex __attribute__((aligned(64))); // 0x40 - originally 0x0
+	uint16_t bounceEnqueueIndex;// 0x42 - originally 0x4
+	uint8_t cycleState; // 0x44 - originally 0x6
+	bool erdpNeedsUpdate; 	// 0x45 - originally 0x7
+	bool bounceStalled;	// 0x46 (Added) - event at xHCDequeueIndex already filtered, waiting for bounce queue room
+	int32_t volatile numBounceQueueOverflows;	// 0x48 - originally 0xC, now counts stalls on a full queue
+	uint16_t imodInterval;	// 0x4C (Added) - current IMODI, 250 ns units
+	uint32_t imodInterrupts;	// 0x50 (Added) - in current sample
+	uint32_t imodEvents;	// 0x54 (Added) - in current sample
+	uint64_t imodSampleStart;	// 0x58 (Added)
+	uint32_t volatile interruptsPerSecond;	// 0x60 (Added) - from last sample
+	uint32_t volatile eventsPerInterrupt;	// 0x64 (Added) - from last sample, x 100
+	/*
+	 * Consumer
 	 */
-	uint16_t xHCDequeueIndex; // 0x0
-	uint16_t volatile bounceDequeueIndex;// 0x2
-	uint16_t volatile bounceEnqueueIndex;// 0x4
-	uint8_t cycleState; // 0x6
-	bool erdpNeedsUpdate; 	// 0x7
-	uint16_t numxHCEntries;	// 0x8
-	uint16_t numBounceEntries;	// 0xA
-	int32_t volatile numBounceQueueOverflows;	// 0xC
-	EventRingSegmentTable* erstPtr; // 0x10 - Note: doubles as TRBs
-	TRBStruct* bounceQueuePtr; // 0x18
-	uint64_t erdp;		// 0x20
-	uint64_t erstba;	// 0x28
-	IOBufferMemoryDescriptor* md;	// 0x30
+	uint16_t bounceDequeueIndex __attribute__((aligned(64)));// 0x80 - originally 0x2
 } __attribute__((aligned(64)));
 
 struct SlotStruct
@@ -193,7 +223,17 @@ struct PrintSink
 #define DIAGCTR_ORPHANEDTDS 7
 #define DIAGCTR_SHORTSUCCESS 8
 #define DIAGCTR_BADDOORBELL 9
-#define NUM_DIAGCTRS 10
+#define DIAGCTR_RINGRESIZE 10
+#define DIAGCTR_RINGINVARIANT 11
+#define DIAGCTR_DOORBELLSAVED 12
+#define DIAGCTR_RELOCATIONS 13
+#define DIAGCTR_EARLYLINKS 14
+#define DIAGCTR_TDPOOLHIT 15
+#define DIAGCTR_TDPOOLMISS 16
+#define DIAGCTR_TDBYTESADAPT 17
+#define DIAGCTR_FLUSHFAST 18
+#define DIAGCTR_FLUSHSLOW 19
+#define NUM_DIAGCTRS 20
 
 #pragma mark -
 #pragma mark Mavericks Quirks
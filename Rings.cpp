@@ -8,6 +8,7 @@
 //
 
 #include "GenericUSBXHCI.h"
+#include "XHCITypes.h"
 
 #include "Config.h"
 
@@ -18,21 +19,209 @@
 __attribute__((visibility("hidden")))
 IOReturn CLASS::AllocRing(ringStruct* pRing, int32_t numPages)
 {
-	IOReturn rc = MakeBuffer(kIOMemoryPhysicallyContiguous | kIODirectionInOut,
-							 numPages * PAGE_SIZE,
-							 -PAGE_SIZE,
-							 &pRing->md,
-							 reinterpret_cast<void**>(&pRing->ptr),
-							 &pRing->physAddr);
+	IOReturn rc = AllocRingPages(numPages, &pRing->md, &pRing->ptr, &pRing->physAddr);
 	if (rc != kIOReturnSuccess)
 		return kIOReturnNoMemory;
 	pRing->numTRBs = static_cast<uint16_t>(numPages * (PAGE_SIZE / sizeof *pRing->ptr));
 	pRing->numPages = static_cast<uint16_t>(numPages);
+	pRing->basePages = static_cast<uint16_t>(numPages);
 	pRing->cycleState = 1U;
 	InitPreallocedRing(pRing);
 	return kIOReturnSuccess;
 }
 
+__attribute__((visibility("hidden")))
+uint32_t CLASS::RingPagesForEndpoint(int32_t slot, int32_t endpointType, uint32_t maxBurst)
+{
+	uint32_t numPages;
+
+	/*
+	 * Note: Stream rings are always a single page each (see AllocStreamsContextArray),
+	 *   so this only sizes rings allocated by AllocRing.
+	 */
+	switch (endpointType | CTRL_EP) {
+		case CTRL_EP:
+			numPages = _ringPagesOverride.control ? : 1U;
+			break;
+		case INT_IN_EP:
+			numPages = _ringPagesOverride.interrupt ? : 1U;
+			break;
+		default:	// (BULK_IN_EP)
+			switch (GetSlCtxSpeed(GetSlotContext(slot))) {
+				case kUSBDeviceSpeedSuper:
+					/*
+					 * Scale with burst, so one page per 4 packets of burst
+					 */
+					numPages = _ringPagesOverride.bulkSS ? : 1U + maxBurst / 4U;
+					break;
+				case kUSBDeviceSpeedHigh:
+					numPages = _ringPagesOverride.bulk ? : 2U;
+					break;
+				default:
+					numPages = _ringPagesOverride.bulk ? : 1U;
+					break;
+			}
+			break;
+	}
+	if (numPages > kMaxTransferRingPages)
+		numPages = kMaxTransferRingPages;
+	return numPages;
+}
+
+__attribute__((visibility("hidden")))
+IOReturn CLASS::ResizeRing(ringStruct* pRing, int32_t numPages)
+{
+	IOBufferMemoryDescriptor* md;
+	TRBStruct *ptr, *pTrb;
+	uint64_t physAddr;
+	uint32_t fourth;
+
+	/*
+	 * Note: Only an empty ring may be resized, and only after the xHC
+	 *   has let go of any previous buffer.  The new buffer is spliced
+	 *   in with a Link TRB at the enqueue position of the current one,
+	 *   so the endpoint need not be stopped.
+	 */
+	if (pRing->isInactive() ||
+		pRing->retiredMd ||
+		pRing->enqueueIndex != pRing->dequeueIndex ||
+		numPages == static_cast<int32_t>(pRing->numPages))
+		return kIOReturnNotReady;
+	if (AllocRingPages(numPages, &md, &ptr, &physAddr) != kIOReturnSuccess)
+		return kIOReturnNoMemory;
+	pTrb = &pRing->ptr[pRing->enqueueIndex];
+	ClearTRB(pTrb, false);
+	SetTRBAddr64(pTrb, physAddr);
+	/*
+	 * Note: New buffer starts out with cycleState 1, so
+	 *   toggle the xHC's cycle state if it's currently 0.
+	 */
+	fourth = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_LINK);
+	if (pRing->cycleState)
+		fourth |= XHCI_TRB_3_CYCLE_BIT;
+	else
+		fourth |= XHCI_TRB_3_TC_BIT;
+	IOSync();
+	pTrb->d = fourth;
+	IOSync();
+	pRing->retiredMd = pRing->md;
+	pRing->retiredPtr = pRing->ptr;
+	pRing->retiredPages = pRing->numPages;
+	pRing->md = md;
+	pRing->ptr = ptr;
+	pRing->physAddr = physAddr;
+	pRing->numTRBs = static_cast<uint16_t>(numPages * (PAGE_SIZE / sizeof *pRing->ptr));
+	pRing->numPages = static_cast<uint16_t>(numPages);
+	pRing->cycleState = 1U;
+	pRing->needsGrowth = false;
+	pRing->idleTicks = 0U;
+	InitPreallocedRing(pRing);
+	++_diagCounters[DIAGCTR_RINGRESIZE];
+	return kIOReturnSuccess;
+}
+
+__attribute__((visibility("hidden")))
+void CLASS::FreeRetiredRing(ringStruct* pRing)
+{
+	IOBufferMemoryDescriptor* md = pRing->retiredMd;
+	if (!md)
+		return;
+	pRing->retiredMd = 0;
+	FreeRingPages(md, pRing->retiredPtr, pRing->retiredPages);
+	pRing->retiredPtr = 0;
+	pRing->retiredPages = 0U;
+}
+
+/*
+ * Note: Ring pages are carved out of a few physically contiguous slabs of
+ *   kRingSlabPages pages each, so creating and deleting endpoints doesn't
+ *   go to the kernel allocator every time.  Each carved ring holds a
+ *   reference on its slab's md.  Rings larger than a slab, or allocated
+ *   once all slabs are full, fall back to MakeBuffer.  A ring may not
+ *   cross a 64KB boundary, so slabs and fallbacks are 64KB aligned and
+ *   no ring is carved across a 64KB line.
+ */
+__attribute__((visibility("hidden")))
+IOReturn CLASS::AllocRingPages(int32_t numPages, IOBufferMemoryDescriptor** pMd, TRBStruct** pPtr, uint64_t* pPhysAddr)
+{
+	uint32_t slab, page, mask;
+
+	if (numPages <= 0)
+		return kIOReturnBadArgument;
+	if (numPages <= static_cast<int32_t>(kRingSlabPages)) {
+		mask = (1U << numPages) - 1U;
+		for (slab = 0U; slab < kMaxRingSlabs; ++slab) {
+			if (!_ringSlabs[slab].md) {
+				void* ptr;
+				if (MakeBuffer(kIOMemoryPhysicallyContiguous | kIODirectionInOut,
+							   kRingSlabPages * PAGE_SIZE,
+							   -static_cast<int64_t>(kRingBoundaryPages * PAGE_SIZE),
+							   &_ringSlabs[slab].md,
+							   &ptr,
+							   &_ringSlabs[slab].physAddr) != kIOReturnSuccess) {
+					_ringSlabs[slab].md = 0;
+					break;
+				}
+				_ringSlabs[slab].ptr = static_cast<uint8_t*>(ptr);
+				_ringSlabs[slab].freeMap = (kRingSlabPages < 32U ? (1U << kRingSlabPages) : 0U) - 1U;
+			}
+			for (page = 0U; page + numPages <= kRingSlabPages; ++page)
+				if ((_ringSlabs[slab].freeMap & (mask << page)) == (mask << page) &&
+					page / kRingBoundaryPages == (page + numPages - 1U) / kRingBoundaryPages) {
+					_ringSlabs[slab].freeMap &= ~(mask << page);
+					_ringSlabs[slab].md->retain();
+					*pMd = _ringSlabs[slab].md;
+					*pPtr = reinterpret_cast<TRBStruct*>(_ringSlabs[slab].ptr + page * PAGE_SIZE);
+					*pPhysAddr = _ringSlabs[slab].physAddr + page * PAGE_SIZE;
+					bzero(*pPtr, numPages * PAGE_SIZE);
+					_ringSlabStats.pagesInUse += numPages;
+					if (_ringSlabStats.pagesInUse > _ringSlabStats.highWater)
+						_ringSlabStats.highWater = _ringSlabStats.pagesInUse;
+					return kIOReturnSuccess;
+				}
+		}
+	}
+	++_ringSlabStats.fallbacks;
+	return MakeBuffer(kIOMemoryPhysicallyContiguous | kIODirectionInOut,
+					  numPages * PAGE_SIZE,
+					  -static_cast<int64_t>(kRingBoundaryPages * PAGE_SIZE),
+					  pMd,
+					  reinterpret_cast<void**>(pPtr),
+					  pPhysAddr);
+}
+
+__attribute__((visibility("hidden")))
+void CLASS::FreeRingPages(IOBufferMemoryDescriptor* md, TRBStruct* ptr, int32_t numPages)
+{
+	uint32_t slab, page;
+
+	for (slab = 0U; slab < kMaxRingSlabs; ++slab)
+		if (_ringSlabs[slab].md == md) {
+			page = static_cast<uint32_t>((reinterpret_cast<uint8_t*>(ptr) - _ringSlabs[slab].ptr) / PAGE_SIZE);
+			_ringSlabs[slab].freeMap |= ((1U << numPages) - 1U) << page;
+			_ringSlabStats.pagesInUse -= numPages;
+			md->release();
+			return;
+		}
+	md->complete();
+	md->release();
+}
+
+__attribute__((visibility("hidden")))
+void CLASS::FinalizeRingSlabs(void)
+{
+	for (uint32_t slab = 0U; slab < kMaxRingSlabs; ++slab) {
+		if (!_ringSlabs[slab].md)
+			continue;
+		_ringSlabs[slab].md->complete();
+		_ringSlabs[slab].md->release();
+		_ringSlabs[slab].md = 0;
+		_ringSlabs[slab].ptr = 0;
+		_ringSlabs[slab].freeMap = 0U;
+	}
+	_ringSlabStats.pagesInUse = 0U;
+}
+
 __attribute__((visibility("hidden")))
 void CLASS::InitPreallocedRing(ringStruct* pRing)
 {
@@ -63,10 +252,10 @@ void CLASS::DeallocRing(ringStruct* pRing)
 	if (!pRing)
 		return;
 	if (pRing->md) {
-		pRing->md->complete();
-		pRing->md->release();
+		FreeRingPages(pRing->md, pRing->ptr, pRing->numPages);
 		pRing->md = 0;
 	}
+	FreeRetiredRing(pRing);
 	pRing->ptr = 0;
 	pRing->physAddr = 0ULL;
 	pRing->numTRBs = 0U;
@@ -126,6 +315,68 @@ int32_t CLASS::CountRingToED(ringStruct const* pRing, int32_t trbIndexInRingQueu
 	return trbIndexInRingQueue;
 }
 
+__attribute__((visibility("hidden")))
+bool CLASS::CheckRingInvariants(ringStruct const* pRing)
+{
+	TRBStruct const* pTrb;
+	uint32_t expectedCycle, steps, trbType;
+	int32_t index, indexOfLinkTrb;
+
+	/*
+	 * Note: Checks the ring between its dequeue and enqueue
+	 *   indices, so must not be called while a fragment is
+	 *   still open (its first TRB has inverted cycle bit).
+	 */
+	if (pRing->isInactive() || !pRing->ptr || pRing->numTRBs < 2U)
+		return true;
+	indexOfLinkTrb = static_cast<int32_t>(pRing->numTRBs) - 1;
+	if (pRing->enqueueIndex >= indexOfLinkTrb ||
+		pRing->dequeueIndex >= indexOfLinkTrb)
+		return false;
+	pTrb = &pRing->ptr[indexOfLinkTrb];
+	if (XHCI_TRB_3_TYPE_GET(pTrb->d) != XHCI_TRB_TYPE_LINK ||
+		!(pTrb->d & XHCI_TRB_3_TC_BIT) ||
+		GetTRBAddr64(pTrb) != pRing->physAddr)
+		return false;
+	/*
+	 * TRBs at or past the enqueue index must still belong to software
+	 */
+	if (((pRing->ptr[pRing->enqueueIndex].d & XHCI_TRB_3_CYCLE_BIT) != 0U) == (pRing->cycleState != 0U))
+		return false;
+	/*
+	 * Walk from dequeue to enqueue, toggling expected cycle state
+	 *   at each link TRB (including early links left by relocation)
+	 */
+	index = pRing->dequeueIndex;
+	expectedCycle = pRing->cycleState;
+	if (index > static_cast<int32_t>(pRing->enqueueIndex))
+		expectedCycle ^= 1U;
+	for (steps = 0U; index != static_cast<int32_t>(pRing->enqueueIndex); ++steps) {
+		if (steps >= pRing->numTRBs)
+			return false;
+		pTrb = &pRing->ptr[index];
+		if (((pTrb->d & XHCI_TRB_3_CYCLE_BIT) != 0U) != (expectedCycle != 0U))
+			return false;
+		trbType = XHCI_TRB_3_TYPE_GET(pTrb->d);
+		if (trbType == XHCI_TRB_TYPE_LINK) {
+			if (!(pTrb->d & XHCI_TRB_3_TC_BIT) ||
+				GetTRBAddr64(pTrb) != pRing->physAddr)
+				return false;
+			expectedCycle ^= 1U;
+			index = 0;
+			continue;
+		}
+		if (++index >= indexOfLinkTrb) {
+			pTrb = &pRing->ptr[indexOfLinkTrb];
+			if (((pTrb->d & XHCI_TRB_3_CYCLE_BIT) != 0U) != (expectedCycle != 0U))
+				return false;
+			expectedCycle ^= 1U;
+			index = 0;
+		}
+	}
+	return expectedCycle == pRing->cycleState;
+}
+
 __attribute__((visibility("hidden")))
 uint16_t CLASS::NextTransferDQ(ringStruct const* pRing, int32_t index)
 {
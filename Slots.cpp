@@ -102,9 +102,6 @@ IOReturn CLASS::AddressDevice(uint32_t deviceSlot, uint16_t maxPacketSize, bool
 	}
 // TODO: make this a function an remove goto ...
 skip_low_full:
-#if kMaxActiveInterrupters > 1
-	pContext->_s.dwSctx2 |= XHCI_SCTX_2_IRQ_TARGET_SET(1U);
-#endif
 	pContext->_s.dwSctx0 |= XHCI_SCTX_0_ROUTE_SET(routeString);
 	pContext = GetInputContextPtr(2);
 	pContext->_e.dwEpCtx1 |= XHCI_EPCTX_1_EPTYPE_SET(CTRL_EP);
@@ -242,6 +239,150 @@ void CLASS::CheckSlotForTimeouts(int32_t slot, uint32_t frameNumber, bool abortA
 	}
 }
 
+/*
+ * Note: Async endpoints whose head transaction has timeouts, or
+ *   with a grown ring or TD pool, sit in a wheel of kTimeoutWheelBuckets
+ *   buckets of 1 << kTimeoutWheelShift frames each, hashed by the
+ *   frame they need a visit.  Entries more than one turn out stay put until due.
+ *   Idle endpoints are never visited.
+ */
+__attribute__((visibility("hidden")))
+void CLASS::ArmTimeoutWheel(XHCIAsyncEndpoint* pAsyncEp, uint32_t frame)
+{
+	XHCIAsyncEndpoint** ppBucket;
+
+	if (pAsyncEp->wheelLink) {
+		if (static_cast<int32_t>(frame - pAsyncEp->wheelFrame) >= 0)
+			return;
+		DisarmTimeoutWheel(pAsyncEp);
+	}
+	pAsyncEp->wheelFrame = frame;
+	ppBucket = &_timeoutWheel.buckets[(frame >> kTimeoutWheelShift) % kTimeoutWheelBuckets];
+	pAsyncEp->wheelNext = *ppBucket;
+	if (*ppBucket)
+		(*ppBucket)->wheelLink = &pAsyncEp->wheelNext;
+	pAsyncEp->wheelLink = ppBucket;
+	*ppBucket = pAsyncEp;
+}
+
+__attribute__((visibility("hidden")))
+void CLASS::DisarmTimeoutWheel(XHCIAsyncEndpoint* pAsyncEp)
+{
+	if (!pAsyncEp->wheelLink)
+		return;
+	*pAsyncEp->wheelLink = pAsyncEp->wheelNext;
+	if (pAsyncEp->wheelNext)
+		pAsyncEp->wheelNext->wheelLink = pAsyncEp->wheelLink;
+	pAsyncEp->wheelNext = 0;
+	pAsyncEp->wheelLink = 0;
+}
+
+__attribute__((visibility("hidden")))
+void CLASS::ExpireTimeoutWheel(uint32_t frameNumber)
+{
+	XHCIAsyncEndpoint *pList, *pAsyncEp;
+	uint32_t bucket, numBuckets;
+
+	bucket = _timeoutWheel.lastFrame >> kTimeoutWheelShift;
+	numBuckets = (frameNumber >> kTimeoutWheelShift) - bucket + 1U;
+	if (numBuckets > kTimeoutWheelBuckets)
+		numBuckets = kTimeoutWheelBuckets;
+	_timeoutWheel.lastFrame = frameNumber;
+	for (; numBuckets; --numBuckets, ++bucket) {
+		/*
+		 * Note: Detach the bucket first, since visits re-arm
+		 */
+		pList = _timeoutWheel.buckets[bucket % kTimeoutWheelBuckets];
+		_timeoutWheel.buckets[bucket % kTimeoutWheelBuckets] = 0;
+		if (pList)
+			pList->wheelLink = &pList;
+		while ((pAsyncEp = pList) != 0) {
+			DisarmTimeoutWheel(pAsyncEp);
+			if (static_cast<int32_t>(frameNumber - pAsyncEp->wheelFrame) < 0)
+				ArmTimeoutWheel(pAsyncEp, pAsyncEp->wheelFrame);
+			else
+				CheckAsyncEndpointTimeouts(pAsyncEp, frameNumber);
+		}
+	}
+}
+
+__attribute__((visibility("hidden")))
+void CLASS::CheckAsyncEndpointTimeouts(XHCIAsyncEndpoint* pAsyncEp, uint32_t frameNumber)
+{
+	ringStruct* pRing = pAsyncEp->pRing;
+	XHCIAsyncEndpoint* pStreamEp;
+	int32_t slot = pRing->slot;
+	int32_t endpoint = pRing->endpoint;
+	uint16_t streamId, lastStream;
+	bool stopped;
+
+	if (ConstSlotPtr(slot)->isInactive())
+		return;
+	if (!pAsyncEp->streamId) {
+		if (VisitTimeoutWheelEntry(pAsyncEp, frameNumber))
+			StartEndpoint(slot, endpoint, 0U);
+		return;
+	}
+	/*
+	 * Note: Visit all streams that are due together, so the
+	 *   endpoint is restarted once, as in CheckSlotForTimeouts
+	 */
+	stopped = VisitTimeoutWheelEntry(pAsyncEp, frameNumber);
+	lastStream = GetLastStreamForEndpoint(slot, endpoint);
+	for (streamId = 1U; streamId <= lastStream; ++streamId) {
+		pStreamEp = GetRing(slot, endpoint, streamId)->asyncEndpoint;
+		if (!pStreamEp || pStreamEp == pAsyncEp || !pStreamEp->wheelLink ||
+			static_cast<int32_t>(frameNumber - pStreamEp->wheelFrame) < 0)
+			continue;
+		DisarmTimeoutWheel(pStreamEp);
+		if (VisitTimeoutWheelEntry(pStreamEp, frameNumber))
+			stopped = true;
+	}
+	if (stopped)
+		RestartStreams(slot, endpoint, 0U);
+}
+
+/*
+ * Note: Returns true if the endpoint was stopped.  Endpoints
+ *   whose head transaction has no timeouts stay off the wheel
+ *   unless their ring or TD pool needs shrinking.
+ */
+__attribute__((visibility("hidden")))
+bool CLASS::VisitTimeoutWheelEntry(XHCIAsyncEndpoint* pAsyncEp, uint32_t frameNumber)
+{
+	ringStruct* pRing = pAsyncEp->pRing;
+	uint32_t next;
+	bool stopped = false;
+
+	if (pRing->isInactive())
+		return false;
+	if (!pAsyncEp->timeoutFrame ||
+		static_cast<int32_t>(frameNumber - pAsyncEp->timeoutFrame) >= 0) {
+		stopped = checkEPForTimeOuts(pRing->slot, pRing->endpoint, pAsyncEp->streamId, frameNumber, false);
+		pAsyncEp->timeoutFrame = pAsyncEp->NextTimeoutFrame(frameNumber);
+	}
+	next = pAsyncEp->timeoutFrame;
+	if (pRing->numPages > pRing->basePages ||
+		pAsyncEp->tdPoolSize > pAsyncEp->tdPoolBaseSize) {
+		/*
+		 * Note: Shrink grown rings and TD pools back once idle for a while
+		 */
+		if (pRing->enqueueIndex != pRing->dequeueIndex)
+			pRing->idleTicks = 0U;
+		else if (pRing->idleTicks < kTransferRingIdleTicks)
+			++pRing->idleTicks;
+		else {
+			if (pRing->numPages > pRing->basePages)
+				ResizeRing(pRing, pRing->basePages);
+			pAsyncEp->TrimTDPool();
+		}
+		next = frameNumber + 1U;
+	}
+	if (next)
+		ArmTimeoutWheel(pAsyncEp, next);
+	return stopped;
+}
+
 #pragma mark -
 #pragma mark External Hubs
 #pragma mark -
@@ -139,6 +139,7 @@ IOReturn CLASS::CreateStream(ringStruct* pRing, uint16_t streamId)
 																   pAsyncEp->multiple);
 	if (!pStreamRing->asyncEndpoint)
 		return kIOReturnNoMemory;
+	pStreamRing->asyncEndpoint->streamId = streamId;
 	return kIOReturnSuccess;
 }
 
@@ -48,7 +48,28 @@ IOReturn CLASS::CreateTransfer(IOUSBCommand* command, uint32_t streamId)
 		case EP_STATE_ERROR:
 			return kIOUSBPipeStalled;
 	}
-	IOReturn rc = pAsyncEP->CreateTDs(command, static_cast<uint16_t>(streamId), 0U, 0xFFU, 0);
+	/*
+	 * Note: Small OUT transfers are sent as Immediate Data,
+	 *   which skips DMA segment generation altogether.  IDT
+	 *   needs a max packet size of at least 8, and isn't used
+	 *   on stream rings (isoch rings don't get this far).
+	 */
+	uint8_t immediateData[8];
+	uint32_t mystery = 0U;
+	uint8_t immediateDataSize = 0xFFU;	// Note: means data is not immediate
+	if (!(endpoint & 1U) &&
+		pAsyncEP->maxPacketSize >= sizeof immediateData &&
+		!IsStreamsEndpoint(slot, endpoint)) {
+		IOMemoryDescriptor* md;
+		IOByteCount reqCount = command->GetReqCount();
+		if (reqCount && reqCount <= sizeof immediateData &&
+			(md = command->GetBuffer()) != 0 &&
+			md->readBytes(0U, &immediateData[0], reqCount) == reqCount) {
+			mystery = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_NORMAL) | XHCI_TRB_3_IDT_BIT;
+			immediateDataSize = static_cast<uint8_t>(reqCount);
+		}
+	}
+	IOReturn rc = pAsyncEP->CreateTDs(command, static_cast<uint16_t>(streamId), mystery, immediateDataSize, &immediateData[0]);
 	pAsyncEP->ScheduleTDs();
 	return rc;
 }
@@ -109,13 +130,16 @@ IOReturn CLASS::ReinitTransferRing(int32_t slot, int32_t endpoint, uint32_t stre
 	if (retFromCMD == -1000 - XHCI_TRB_ERROR_CONTEXT_STATE)
 		return kIOReturnSuccess;
 	if (pRing->needsDoorbell) {
+		bool rung = false;
 		if ((pRing->epType | CTRL_EP) != ISOC_IN_EP &&
 			pRing->asyncEndpoint)
-			pRing->asyncEndpoint->ScheduleTDs();
+			rung = pRing->asyncEndpoint->ScheduleTDs();
 		if (IsStreamsEndpoint(slot, endpoint))
 			RestartStreams(slot, endpoint, 0U);
-		else
+		else if (!rung)
 			StartEndpoint(slot, endpoint, 0U);
+		else
+			++_diagCounters[DIAGCTR_DOORBELLSAVED];
 		pRing->needsDoorbell = false;
 	}
 	return TranslateCommandCompletion(retFromCMD);
@@ -164,6 +188,7 @@ int32_t CLASS::SetTRDQPtr(int32_t slot, int32_t endpoint, uint32_t streamId, int
 	retFromCMD = WaitForCMD(&localTrb, XHCI_TRB_TYPE_SET_TR_DEQUEUE, 0);
 	if (retFromCMD != -1 && retFromCMD > -1000) {
 		pRing->dequeueIndex = static_cast<uint16_t>(index);
+		FreeRetiredRing(pRing);
 		return retFromCMD;
 	}
 
@@ -182,7 +207,7 @@ void CLASS::ParkRing(uint8_t slot, uint8_t endpoint)
 	 * Use a 16-byte aligned zero-filled spare space in Event Ring 0
 	 *   to park the ring. (see InitEventRing)
 	 */
-	SetTRBAddr64(&localTrb, _eventRing[0].erstba + sizeof localTrb);
+	SetTRBAddr64(&localTrb, _eventRing[0].erstba + _eventRing[0].numSegments * sizeof localTrb);
 	localTrb.a |= XHCI_TRB_3_CYCLE_BIT;	// Note: set DCS to 1 so it doesn't move
 	retFromCMD = WaitForCMD(&localTrb, XHCI_TRB_TYPE_SET_TR_DEQUEUE, 0);
 	if (retFromCMD != -1 && retFromCMD > -1000)
@@ -223,15 +248,23 @@ IOReturn CLASS::AddDummyCommand(ringStruct* pRing, IOUSBCommand* command)
 }
 
 __attribute__((visibility("hidden")))
-bool CLASS::CanTDFragmentFit(ringStruct const* pRing, uint32_t numBytes)
+bool CLASS::CanTDFragmentFit(ringStruct const* pRing, uint32_t numTRBs)
 {
+	uint64_t key;
 	uint16_t numFit, spaceInStart;
-	uint32_t maxNumPages = (numBytes / PAGE_SIZE) + 2U;
-	if ((numBytes & PAGE_MASK) > 1U)
-		++maxNumPages;
+
 	/*
-	 * Note: maxNumPages accounts for possible EVENT_DATA
+	 * Note: numTRBs comes from CountTRBsInTD, and
+	 *   includes any EVENT_DATA.  The room is cached until
+	 *   either index or the ring size changes, so the
+	 *   TDs of one ScheduleTDs pass that stall on a full
+	 *   ring don't each recompute it.
 	 */
+	key = (static_cast<uint64_t>(pRing->numTRBs) << 32) |
+		(static_cast<uint32_t>(pRing->enqueueIndex) << 16) |
+		pRing->dequeueIndex;
+	if (key == pRing->fitKey)
+		return numTRBs <= pRing->fitTRBs;
 	if (pRing->enqueueIndex < pRing->dequeueIndex)
 		numFit = pRing->dequeueIndex - 1U - pRing->enqueueIndex;
 	else {
@@ -245,7 +278,9 @@ bool CLASS::CanTDFragmentFit(ringStruct const* pRing, uint32_t numBytes)
 		} else
 			numFit = (numFit > 2U) ? (numFit - 2U) : 0U;
 	}
-	return maxNumPages <= numFit;
+	pRing->fitKey = key;
+	pRing->fitTRBs = numFit;
+	return numTRBs <= numFit;
 }
 
 __attribute__((visibility("hidden")))
@@ -260,25 +295,39 @@ uint32_t CLASS::FreeSlotsOnRing(ringStruct const* pRing)
 	return 0U;
 }
 
+/*
+ * Note: Specialized at compile time on transfer kind and immediate data
+ *   mode, so the DMA data path for async TDs carries none of the branches
+ *   for the other kinds.  Dispatched from _createTransfer.
+ */
+template <bool isIsochTransfer, bool haveImmediateData>
 __attribute__((visibility("hidden")))
-IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesToTransfer, uint32_t mystery,
-								size_t startingOffsetInBuffer, bool interruptNeeded, bool multiTDTransaction,
-								uint32_t* pFirstTrbIndex, uint32_t* pTrbCount, int16_t* pLastTrbIndex)
+IOReturn CLASS::_buildTransfer(void* pTd, uint32_t bytesToTransfer, uint32_t mystery,
+							   size_t startingOffsetInBuffer, bool interruptNeeded, bool multiTDTransaction,
+							   uint32_t* pFirstTrbIndex, uint32_t* pTrbCount, int16_t* pLastTrbIndex)
 {
 	IODMACommand* command;
 	ringStruct* pRing;
 	ContextStruct* pContext;
-	TRBStruct *pFirstTrbInFragment, *pTrb;
+	TRBStruct *pFirstTrbInFragment, *pFirstTrbBefore, *pTrb;
+	SegmentCache localCache, *pCache;
+	IODMACommand::Segment64 localSegments[kSegmentCacheEntries];
 	size_t offsetInBuffer, residueEstimate, bytesFollowingThisTD, bytesPreceedingThisTD;
 	uint32_t bytesLeftInTD, bytesCurrentTrb, maxPacketSize, maxBurstSize, multiple, MBPMultiple, fourth, finalFourth;
 	int32_t lastTrbIndex, TrbCountInTD, TrbCountInFragment;
 	IOReturn rc;
-	bool isNoopOrStatus, isFirstFragment, haveImmediateData, finalTDInTransaction;
+	uint32_t numTRBsInTD, irqTarget;
+	bool isNoopOrStatus, isFirstFragment, finalTDInTransaction;
 	uint8_t slot, endpoint, copyOfImmediateData[8];
 
 	offsetInBuffer = startingOffsetInBuffer;
 	bytesLeftInTD = bytesToTransfer;
 	pFirstTrbInFragment = 0;
+	localCache.command = 0;
+	localCache.numSegments = 0U;
+	localCache.maxSegments = kSegmentCacheEntries;
+	localCache.segments = &localSegments[0];
+	pCache = &localCache;
 	if (isIsochTransfer) {
 		GenericUSBXHCIIsochTD* pIsochTd = static_cast<GenericUSBXHCIIsochTD*>(pTd);
 		pRing = static_cast<GenericUSBXHCIIsochEP*>(pIsochTd->_pEndpoint)->pRing;
@@ -286,15 +335,19 @@ IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesT
 		isNoopOrStatus = false;
 		bytesFollowingThisTD = 0U;
 		bytesPreceedingThisTD = 0U;
-		haveImmediateData = false;
 		finalTDInTransaction = false;
+		numTRBsInTD = (bytesToTransfer / PAGE_SIZE) + 3U;
 	} else {
 		XHCIAsyncTD* pATd = static_cast<XHCIAsyncTD*>(pTd);
+		/*
+		 * Note: For TRB chaining, a sub-transaction is a transaction of its own
+		 */
 		bytesFollowingThisTD = pATd->bytesFollowingThisTD;
-		finalTDInTransaction = pATd->finalTDInTransaction;
-		bytesPreceedingThisTD = pATd->bytesPreceedingThisTD;
+		finalTDInTransaction = pATd->finalTDInTransaction || pATd->lastTDInSubTransaction;
+		bytesPreceedingThisTD = pATd->bytesPreceedingThisTD - pATd->subTransactionOffset;
 		command = pATd->command->GetDMACommand();
 		pRing = pATd->provider->pRing;
+		pCache = &_tdSegmentCache;
 		switch (XHCI_TRB_3_TYPE_GET(mystery)) {
 			case XHCI_TRB_TYPE_STATUS_STAGE:
 			case XHCI_TRB_TYPE_NOOP:
@@ -304,12 +357,13 @@ IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesT
 				isNoopOrStatus = false;
 				break;
 		}
-		haveImmediateData = pATd->haveImmediateData;
+		numTRBsInTD = pATd->numTRBsInTD;
 		if (haveImmediateData)
 			bcopy(&pATd->immediateData[0], &copyOfImmediateData[0], sizeof copyOfImmediateData);
 	}
 	slot = pRing->slot;
 	endpoint = pRing->endpoint;
+	irqTarget = XHCI_TRB_2_IRQ_SET(InterrupterForEndpoint(pRing->epType));
 	pContext = GetSlotContext(slot, endpoint);
 	maxPacketSize = XHCI_EPCTX_1_MAXP_SIZE_GET(pContext->_e.dwEpCtx1);
 	if (!maxPacketSize)
@@ -326,12 +380,17 @@ IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesT
 	/*
 	 * TBD:
 	 *   If we call PutBackTRB and return an error, pTd is returned
-	 *     to queuedHead to be rescheduled later, but we may have
+	 *     to the head of queuedTDs to be rescheduled later, but we may have
 	 *     already trigerred some TD fragments from it.  So pTd
 	 *     needs to be updated to reflect fragments completed.
 	 */
+	if (PlaceEarlyLink(pRing, numTRBsInTD, !!bytesPreceedingThisTD))
+		++_diagCounters[DIAGCTR_EARLYLINKS];
 	do {
+		pFirstTrbBefore = pFirstTrbInFragment;
 		pTrb = GetNextTRB(pRing, 0, &pFirstTrbInFragment, isFirstFragment && !bytesPreceedingThisTD);
+		if (pFirstTrbBefore && pFirstTrbBefore != pFirstTrbInFragment)
+			++_diagCounters[DIAGCTR_RELOCATIONS];
 		if (!pTrb) {
 			PutBackTRB(pRing, pFirstTrbInFragment);
 			return kIOReturnInternalError;
@@ -348,7 +407,8 @@ IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesT
 			rc = GenerateNextPhysicalSegment(pTrb,
 											 &bytesCurrentTrb,
 											 offsetInBuffer,
-											 command);
+											 command,
+											 pCache);
 			if (rc != kIOReturnSuccess) {
 				/*
 				 * TBD: The transaction should be aborted if this
@@ -370,11 +430,7 @@ IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesT
 			finalTDInTransaction &&
 			TrbCountInTD > 0)
 			fourth |= XHCI_TRB_3_ENT_BIT;
-#if kMaxActiveInterrupters > 1
-		pTrb->c = XHCI_TRB_2_IRQ_SET(1U);
-#else
-		pTrb->c = 0U;
-#endif
+		pTrb->c = irqTarget;
 		if (!isNoopOrStatus) {
 			uint32_t TDSize = static_cast<uint32_t>((residueEstimate + bytesLeftInTD) / maxPacketSize);
 			if (TDSize > 31U)
@@ -425,30 +481,29 @@ IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesT
 						break;
 				}
 			fourth &= ~(XHCI_TRB_3_CHAIN_BIT | XHCI_TRB_3_ENT_BIT);
-			if (lastTrbIndex == pRing->numTRBs - 2U)
+			if (lastTrbIndex == static_cast<int32_t>(pRing->numTRBs) - 2)
 				pRing->ptr[pRing->numTRBs - 1U].d &= ~XHCI_TRB_3_CHAIN_BIT;
 		}
 	} else {
 		finalFourth = fourth;
+		pFirstTrbBefore = pFirstTrbInFragment;
 		pTrb = GetNextTRB(pRing,
 						  (finalTDInTransaction || !multiTDTransaction) ? pTd : 0,
 						  &pFirstTrbInFragment,
 						  isFirstFragment && !bytesPreceedingThisTD);
+		if (pFirstTrbBefore && pFirstTrbBefore != pFirstTrbInFragment)
+			++_diagCounters[DIAGCTR_RELOCATIONS];
 		if (!pTrb) {
 			PutBackTRB(pRing, pFirstTrbInFragment);
 			return kIOReturnInternalError;
 		}
 		lastTrbIndex = static_cast<int32_t>(pTrb - pRing->ptr);
 		SetTRBAddr64(pTrb, pRing->physAddr + lastTrbIndex * sizeof *pRing->ptr);
-#if kMaxActiveInterrupters > 1
-		pTrb->c = XHCI_TRB_2_IRQ_SET(1U);
-#else
-		pTrb->c = 0U;
-#endif
+		pTrb->c = irqTarget;
 		fourth = pTrb->d & XHCI_TRB_3_CYCLE_BIT;
 		fourth ^= (XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_EVENT_DATA) | XHCI_TRB_3_CYCLE_BIT);
 		if (multiTDTransaction && !finalTDInTransaction)
-			fourth |= XHCI_TRB_3_CHAIN_BIT;
+			fourth |= XHCI_TRB_3_CHAIN_BIT;	// Note: chains TDs through their Event Data TRBs
 		++TrbCountInFragment;
 		++TrbCountInTD;
 		if (interruptNeeded)
@@ -469,6 +524,21 @@ IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesT
 	return kIOReturnSuccess;
 }
 
+__attribute__((visibility("hidden")))
+IOReturn CLASS::_createTransfer(void* pTd, bool isIsochTransfer, uint32_t bytesToTransfer, uint32_t mystery,
+								size_t startingOffsetInBuffer, bool interruptNeeded, bool multiTDTransaction,
+								uint32_t* pFirstTrbIndex, uint32_t* pTrbCount, int16_t* pLastTrbIndex)
+{
+	if (isIsochTransfer)
+		return _buildTransfer<true, false>(pTd, bytesToTransfer, mystery, startingOffsetInBuffer, interruptNeeded,
+										   multiTDTransaction, pFirstTrbIndex, pTrbCount, pLastTrbIndex);
+	if (static_cast<XHCIAsyncTD*>(pTd)->haveImmediateData)
+		return _buildTransfer<false, true>(pTd, bytesToTransfer, mystery, startingOffsetInBuffer, interruptNeeded,
+										   multiTDTransaction, pFirstTrbIndex, pTrbCount, pLastTrbIndex);
+	return _buildTransfer<false, false>(pTd, bytesToTransfer, mystery, startingOffsetInBuffer, interruptNeeded,
+										multiTDTransaction, pFirstTrbIndex, pTrbCount, pLastTrbIndex);
+}
+
 __attribute__((visibility("hidden")))
 TRBStruct* CLASS::GetNextTRB(ringStruct* pRing, void* isLastTrbInTransaction, TRBStruct** ppFirstTrbInFragment, bool isFirstFragmentInTransaction)
 {
@@ -558,6 +628,43 @@ TRBStruct* CLASS::GetNextTRB(ringStruct* pRing, void* isLastTrbInTransaction, TR
 	return pTrb1;
 }
 
+__attribute__((visibility("hidden")))
+bool CLASS::PlaceEarlyLink(ringStruct* pRing, uint32_t numTRBs, bool chain)
+{
+	TRBStruct* pTrb;
+	uint32_t fourth;
+	int32_t indexOfLinkTrb;
+
+	/*
+	 * If a TD about to be queued won't fit before the link TRB, but
+	 *   will fit at the beginning of the ring, link back to the
+	 *   beginning right away rather than have GetNextTRB relocate
+	 *   its fragment once it straddles the link TRB.
+	 * Note: chain is set if the TD continues a multi-TD transaction
+	 */
+	indexOfLinkTrb = static_cast<int32_t>(pRing->numTRBs) - 1;
+	if (!pRing->enqueueIndex ||
+		pRing->enqueueIndex >= indexOfLinkTrb ||
+		static_cast<int32_t>(pRing->enqueueIndex + numTRBs) <= indexOfLinkTrb ||
+		pRing->dequeueIndex > pRing->enqueueIndex ||
+		numTRBs >= pRing->dequeueIndex)
+		return false;
+	pTrb = &pRing->ptr[pRing->enqueueIndex];
+	ClearTRB(pTrb, false);
+	SetTRBAddr64(pTrb, pRing->physAddr);
+	fourth = XHCI_TRB_3_TYPE_SET(XHCI_TRB_TYPE_LINK) | XHCI_TRB_3_TC_BIT;
+	if (chain)
+		fourth |= XHCI_TRB_3_CHAIN_BIT;
+	if (pRing->cycleState)
+		fourth |= XHCI_TRB_3_CYCLE_BIT;
+	IOSync();
+	pTrb->d = fourth;
+	IOSync();
+	pRing->cycleState ^= 1U;
+	pRing->enqueueIndex = 0U;
+	return true;
+}
+
 __attribute__((visibility("hidden")))
 void CLASS::CloseFragment(ringStruct* pRing, TRBStruct* pFirstTrbInFragment, uint32_t newFourth)
 {
@@ -574,31 +681,117 @@ void CLASS::CloseFragment(ringStruct* pRing, TRBStruct* pFirstTrbInFragment, uin
 }
 
 __attribute__((visibility("hidden")))
-IOReturn CLASS::GenerateNextPhysicalSegment(TRBStruct* pTrb, uint32_t* pLength, size_t offset, IODMACommand* command)
+IOReturn CLASS::GenerateNextPhysicalSegment(TRBStruct* pTrb, uint32_t* pLength, size_t offset, IODMACommand* command,
+											SegmentCache* pCache)
 {
-	IODMACommand::Segment64 segment;
-	UInt64 _offset;
-	UInt32 numSegments, returnLength;
+	IODMACommand::Segment64 const* pSegment;
+	UInt64 _offset, addr, length;
+	UInt32 returnLength;
 	IOReturn rc;
 
 	if (!(*pLength))
 		return kIOReturnSuccess;
-	numSegments = 1U;
-	_offset = offset;
-	rc = command->genIOVMSegments(&_offset, &segment, &numSegments);
-	if (rc != kIOReturnSuccess)
-		return rc;
-	if (numSegments != 1U)
-		return kIOReturnInternalError;
-	SetTRBAddr64(pTrb, segment.fIOVMAddr);
-	returnLength = (1U << 16) - static_cast<uint16_t>(segment.fIOVMAddr);
-	if (segment.fLength < returnLength)
-		returnLength = static_cast<uint32_t>(segment.fLength);
+	/*
+	 * Note: Offsets only move forward within a TD, so skip
+	 *   cached segments that end before offset, and refill
+	 *   the cache once it runs out.
+	 */
+	if (command != pCache->command || offset < pCache->cursorOffset)
+		pCache->numSegments = 0U;
+	while (pCache->cursor < pCache->numSegments &&
+		   offset >= pCache->cursorOffset + pCache->segments[pCache->cursor].fLength) {
+		pCache->cursorOffset += pCache->segments[pCache->cursor].fLength;
+		++pCache->cursor;
+	}
+	if (pCache->cursor >= pCache->numSegments) {
+		pCache->command = command;
+		pCache->numSegments = pCache->maxSegments;
+		pCache->cursor = 0U;
+		pCache->cursorOffset = offset;
+		_offset = offset;
+		rc = command->genIOVMSegments(&_offset, &pCache->segments[0], &pCache->numSegments);
+		if (rc != kIOReturnSuccess) {
+			pCache->numSegments = 0U;
+			return rc;
+		}
+		if (!pCache->numSegments)
+			return kIOReturnInternalError;
+	}
+	pSegment = &pCache->segments[pCache->cursor];
+	addr = pSegment->fIOVMAddr + (offset - pCache->cursorOffset);
+	length = pSegment->fLength - (offset - pCache->cursorOffset);
+	SetTRBAddr64(pTrb, addr);
+	returnLength = (1U << 16) - static_cast<uint16_t>(addr);
+	if (length < returnLength)
+		returnLength = static_cast<uint32_t>(length);
 	if (*pLength > returnLength)
 		*pLength = returnLength;
 	return kIOReturnSuccess;
 }
 
+__attribute__((visibility("hidden")))
+uint16_t CLASS::CountTRBsInTD(SegmentCache* pCache, IODMACommand* command, size_t offset, uint32_t numBytes)
+{
+	IODMACommand::Segment64 segments[kSegmentCacheEntries];
+	IODMACommand::Segment64 const* pSegments;
+	UInt64 _offset, length;
+	UInt32 numSegments, i;
+	uint32_t numTRBs, bytesLeft;
+
+	/*
+	 * Note: Lays out TRBs the same way as GenerateNextPhysicalSegment,
+	 *   one per segment, clipped at 64 KiB boundaries.  The segments
+	 *   are fetched into pCache, where _buildTransfer picks them up.
+	 *   Falls back to a page based estimate if segments can't be
+	 *   generated.
+	 */
+	pCache->command = command;
+	pCache->cursor = 0U;
+	pCache->cursorOffset = offset;
+	pCache->numSegments = pCache->maxSegments;
+	_offset = offset;
+	if (!command ||
+		command->genIOVMSegments(&_offset, &pCache->segments[0], &pCache->numSegments) != kIOReturnSuccess ||
+		!pCache->numSegments) {
+		pCache->numSegments = 0U;
+		goto estimate;
+	}
+	numTRBs = 0U;
+	bytesLeft = numBytes;
+	pSegments = &pCache->segments[0];
+	numSegments = pCache->numSegments;
+	for (i = 0U; bytesLeft; ++i) {
+		/*
+		 * Note: A TD of more segments than the cache holds
+		 *   counts the rest from batches of its own.
+		 */
+		if (i >= numSegments) {
+			numSegments = kSegmentCacheEntries;
+			if (command->genIOVMSegments(&_offset, &segments[0], &numSegments) != kIOReturnSuccess ||
+				!numSegments)
+				goto estimate;
+			pSegments = &segments[0];
+			i = 0U;
+		}
+		length = pSegments[i].fLength;
+		if (length > bytesLeft)
+			length = bytesLeft;
+		bytesLeft -= static_cast<uint32_t>(length);
+		numTRBs += static_cast<uint32_t>(((pSegments[i].fIOVMAddr & 0xFFFFU) + length + 0xFFFFU) >> 16);
+	}
+	if (numTRBs > 1U)
+		++numTRBs;	// EVENT_DATA
+	if (numTRBs > UINT16_MAX)
+		numTRBs = UINT16_MAX;
+	return static_cast<uint16_t>(numTRBs);
+
+estimate:
+	/*
+	 * Note: Pages the buffer can touch, plus EVENT_DATA
+	 */
+	return static_cast<uint16_t>((numBytes / PAGE_SIZE) + ((numBytes & PAGE_MASK) ? 1U : 0U) + 2U);
+}
+
 __attribute__((visibility("hidden")))
 void CLASS::PutBackTRB(ringStruct* pRing, TRBStruct* pTrb)
 {
@@ -87,12 +87,18 @@ void CLASS::UIMCheckForTimeouts(void)
 	mfIndex &= XHCI_MFINDEX_MASK;
 	if (!mfIndex)
 		return;
+	/*
+	 * Note: Slots needing reset abort everything, so they
+	 *   are still swept.  Otherwise only endpoints due in
+	 *   the timeout wheel are visited.
+	 */
 	for (slot = 1U; slot <= _numSlots; ++slot) {
 		SlotStruct const* pSlot = ConstSlotPtr(slot);
-		if (pSlot->isInactive())
+		if (pSlot->isInactive() || !pSlot->deviceNeedsReset)
 			continue;
-        CheckSlotForTimeouts(slot, frameNumber, pSlot->deviceNeedsReset);
+		CheckSlotForTimeouts(slot, frameNumber, true);
 	}
+	ExpireTimeoutWheel(frameNumber);
 }
 
 IOReturn CLASS::UIMCreateControlTransfer(short functionNumber,
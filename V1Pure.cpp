@@ -95,6 +95,12 @@ IOReturn CLASS::UIMInitialize(IOService* provider)
 		UIMFinalize();
 		return rc;
 	}
+	rc = InitSecondaryInterrupters();
+	if (rc != kIOReturnSuccess) {
+		IOLog("%s: Unable to add secondary interrupters to workloop, error == %#x\n", __FUNCTION__, rc);
+		UIMFinalize();
+		return rc;
+	}
 	rc = InitializeEventSource();
 	if (rc != kIOReturnSuccess) {
 		IOLog("%s: Unable to create private IOEventSource and add to workloop, error == %#x\n", __FUNCTION__, rc);
@@ -219,7 +225,7 @@ IOReturn CLASS::UIMInitialize(IOService* provider)
 	_istKeepAwayFrames = (hcp2 & 8U) ? (hcp2 & 7U) : 1U;	// Note: minimum of 1 frame
 	setProperty("ISTKeepAway", _istKeepAwayFrames, 8U);
 	_erstMax = 1U << XHCI_HCS2_ERST_MAX(hcp2);
-	for (int32_t interrupter = 0; interrupter < kMaxActiveInterrupters; ++interrupter) {
+	for (int32_t interrupter = 0; interrupter < _numInterrupters; ++interrupter) {
 		rc = InitAnEventRing(interrupter);
 		if (rc != kIOReturnSuccess) {
 			IOLog("%s: InitAnEventRing(%d) failed, error == %#x\n", __FUNCTION__, interrupter, rc);
@@ -295,6 +301,10 @@ IOReturn CLASS::UIMFinalize(void)
 		IOFree(_slotArray, static_cast<size_t>(_numSlots) * sizeof *_slotArray);
 		_slotArray = 0;
 	}
+	if (_tdSegmentCache.segments) {
+		IOFree(_tdSegmentCache.segments, _tdSegmentCache.maxSegments * sizeof *_tdSegmentCache.segments);
+		_tdSegmentCache.segments = 0;
+	}
 	if (_dcbaa.md) {
 		_dcbaa.md->complete();
 		_dcbaa.md->release();
@@ -316,8 +326,10 @@ IOReturn CLASS::UIMFinalize(void)
 		_inputContext.md->release();
 		_inputContext.md = 0;
 	}
+	FinalizeRingSlabs();
 	FinalizeScratchpadBuffers();
 	FinalizeEventSource();
+	FinalizeSecondaryInterrupters();
 	if (_filterInterruptSource && _workLoop) {
 		_workLoop->removeEventSource(_filterInterruptSource);
 		_filterInterruptSource->release();
@@ -872,7 +884,7 @@ void CLASS::PollInterrupts(IOUSBCompletionAction safeAction)
 			RHCheckForPortResumes();
 		}
 	}
-	for (int32_t interrupter = 0; interrupter < kMaxActiveInterrupters; ++interrupter)
+	for (int32_t interrupter = 0; interrupter < _numInterrupters; ++interrupter)
 		while (PollEventRing2(interrupter));
 }
 
@@ -70,7 +70,7 @@ IOReturn CLASS::RestartControllerFromReset(void)
 	Write32Reg(&_pXHCIOperationalRegisters->DNCtrl, UINT16_MAX);
 	Write64Reg(&_pXHCIOperationalRegisters->DCBAap, _dcbaa.physAddr, false);
 	InitCMDRing();
-	for (int32_t interrupter = 0; interrupter < kMaxActiveInterrupters; ++interrupter)
+	for (int32_t interrupter = 0; interrupter < _numInterrupters; ++interrupter)
 		InitEventRing(interrupter, true);
 	if (_scratchpadBuffers.max)
 		SetDCBAAAddr64(_dcbaa.ptr, _scratchpadBuffers.physAddr);
@@ -102,7 +102,7 @@ IOReturn CLASS::SaveControllerStateForSleep(void)
 	_sleepOpSave.Config = Read32Reg(&_pXHCIOperationalRegisters->Config);
 	if (m_invalid_regspace)
 		return kIOReturnNoDevice;
-	for (int32_t interrupter = 0; interrupter < kMaxActiveInterrupters; ++interrupter)
+	for (int32_t interrupter = 0; interrupter < _numInterrupters; ++interrupter)
 		SaveAnInterrupter(interrupter);
 	uint32_t cmd = Read32Reg(&_pXHCIOperationalRegisters->USBCmd);
 	if (m_invalid_regspace)
@@ -184,7 +184,7 @@ IOReturn CLASS::RestoreControllerStateFromSleep(void)
 		Write32Reg(&_pXHCIOperationalRegisters->DNCtrl, _sleepOpSave.DNCtrl);
 		Write64Reg(&_pXHCIOperationalRegisters->DCBAap, _sleepOpSave.DCBAap, false);
 		Write32Reg(&_pXHCIOperationalRegisters->Config, _sleepOpSave.Config);
-		for (int32_t interrupter = 0; interrupter < kMaxActiveInterrupters; ++interrupter)
+		for (int32_t interrupter = 0; interrupter < _numInterrupters; ++interrupter)
 			RestoreAnInterrupter(interrupter);
 		uint32_t cmd = Read32Reg(&_pXHCIOperationalRegisters->USBCmd);
 		if (m_invalid_regspace)
@@ -0,0 +1,44 @@
+# Host (Linux/macOS user space) build of the ring, TD and event ring code,
+# for unit tests and benchmarks.  See HostTest/Harness.h.
+
+CXX?=g++
+# Note: The -Wno- flags cover idioms the kext's own compiler accepts:
+#   #pragma mark, hidden visibility on definitions only, and
+#   isInactive() testing this against 0.
+CXXFLAGS:=-std=gnu++11 -O2 -g -Wall -Wno-unknown-pragmas -Wno-attributes -Wno-nonnull-compare \
+	-Dprivate=public -IHostTest/include -I. -pthread
+LDFLAGS:=-pthread
+BUILD:=HostTest/build
+
+DRIVER_SRCS:=Rings.cpp Transfers.cpp Async.cpp Slots.cpp Interrupts.cpp Accessors.cpp Completer.cpp
+HARNESS_SRCS:=HostTest/Fakes.cpp HostTest/Harness.cpp HostTest/Reference.cpp
+TEST_SRCS:=HostTest/Main.cpp $(wildcard HostTest/*Tests.cpp)
+BENCH_SRCS:=HostTest/RingBench.cpp
+
+objs=$(patsubst %.cpp,$(BUILD)/%.o,$(notdir $(1)))
+
+vpath %.cpp . HostTest
+
+.PHONY: test
+test: $(BUILD)/hosttest
+	$(BUILD)/hosttest
+
+.PHONY: bench
+bench: $(BUILD)/ringbench
+	$(BUILD)/ringbench
+
+$(BUILD)/hosttest: $(call objs,$(DRIVER_SRCS) $(HARNESS_SRCS) $(TEST_SRCS))
+	$(CXX) $(LDFLAGS) -o $@ $^
+
+$(BUILD)/ringbench: $(call objs,$(DRIVER_SRCS) $(HARNESS_SRCS) $(BENCH_SRCS))
+	$(CXX) $(LDFLAGS) -o $@ $^
+
+$(BUILD)/%.o: %.cpp $(wildcard *.h HostTest/*.h HostTest/include/*.h) | $(BUILD)
+	$(CXX) $(CXXFLAGS) -c -o $@ $<
+
+$(BUILD):
+	mkdir -p $@
+
+.PHONY: clean
+clean:
+	rm -rf $(BUILD)
@@ -13,6 +13,7 @@
 #define kGUXEndpointsDump 4U
 #define kGUXBandwidthDump 5U
 #define kGUXOptionsDump 6U
+#define kGUXEndpointStatsDump 7U
 
 void printMsgBuffer(io_service_t service, unsigned type)
 {
@@ -46,13 +47,14 @@ void printMsgBuffer(io_service_t service, unsigned type)
 
 void usage(char const* me)
 {
-	fprintf(stderr, "Usage: %s <caps | running | slots | endpoints <slot#> | bandwidth | options>\n", me);
+	fprintf(stderr, "Usage: %s <caps | running | slots | endpoints <slot#> | bandwidth | options | stats>\n", me);
 	fprintf(stderr, "  caps - dumps cap regs\n");
 	fprintf(stderr, "  running - dumps running regs\n");
 	fprintf(stderr, "  slots - dumps active device slots\n");
 	fprintf(stderr, "  endpoints <slot#> - dumps active endpoints on slot\n");
 	fprintf(stderr, "  bandwidth - dumps bandwidth for root hub ports\n");
 	fprintf(stderr, "  options - dumps kernel flags supported by kext\n");
+	fprintf(stderr, "  stats - dumps transfer statistics for active endpoints\n");
 }
 
 int main(int argc, char const* argv[])
@@ -81,6 +83,8 @@ int main(int argc, char const* argv[])
 		type = kGUXBandwidthDump;
 	else if (!strcmp(argv[1], "options"))
 		type = kGUXOptionsDump;
+	else if (!strcmp(argv[1], "stats"))
+		type = kGUXEndpointStatsDump;
 	else
 		goto do_usage;
 